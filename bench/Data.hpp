@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+
+// Data generators of the benchmarks. Everything is drawn from generators
+// seeded with kSeed (mixed with the sizes asked for), two runs of the same
+// binary measure the same keys in the same order.
+
+constexpr std::uint64_t kSeed = 0x5eed5eedull;
+
+inline std::mt19937_64 makeGen(std::uint64_t salt)
+{
+	return std::mt19937_64(kSeed ^ (salt * 0x9E3779B97F4A7C15ull));
+}
+
+// Order the keys of a workload are visited in.
+enum class KeyOrder : int {
+	Random  = 0,   // uniform, each key as likely as any other
+	Sorted  = 1,   // ascending
+	Reverse = 2,   // descending
+	Zipf    = 3,   // skewed (s = 0.99), a few keys get most of the accesses
+};
+
+inline const char* keyOrderName(KeyOrder order)
+{
+	switch (order) {
+	case KeyOrder::Random:  return "random";
+	case KeyOrder::Sorted:  return "sorted";
+	case KeyOrder::Reverse: return "reverse";
+	case KeyOrder::Zipf:    return "zipf";
+	}
+	return "?";
+}
+
+// Values of `_Size` bytes, to see how the layouts cope with large elements.
+template <size_t _Size>
+struct Blob {
+	std::array<unsigned char, _Size> bytes;
+
+	Blob() = default;
+	explicit Blob(std::uint64_t seed) { bytes.fill(static_cast<unsigned char>(seed)); }
+};
+
+template <class T>
+T makeValue(std::uint64_t seed) { return static_cast<T>(seed); }
+
+template <class T>
+std::uint64_t checksum(const T& value) { return static_cast<std::uint64_t>(value); }
+
+template <size_t _Size>
+std::uint64_t checksum(const Blob<_Size>& value) { return value.bytes[0]; }
+
+template <class T> struct TypeName;
+template <> struct TypeName<int>           { static std::string get() { return "int";  } };
+template <> struct TypeName<std::uint64_t> { static std::string get() { return "u64";  } };
+template <size_t _Size> struct TypeName<Blob<_Size>> {
+	static std::string get() { return "blob" + std::to_string(_Size); }
+};
+
+// `n` distinct keys in the map and `n` distinct keys that are not, both in
+// random order.
+template <class Key, class Value>
+struct MapData {
+	std::vector<std::pair<Key, Value>> present;
+	std::vector<Key>                   missing;
+};
+
+template <class Key, class Value>
+MapData<Key, Value> getMapData(size_t n)
+{
+	auto gen = makeGen(n);
+
+	std::unordered_set<Key> seen;
+	MapData<Key, Value> data;
+	data.present.reserve(n);
+	data.missing.reserve(n);
+	while (data.missing.size() < n) {
+		Key key = static_cast<Key>(gen());
+		if (!seen.insert(key).second)
+			continue;
+		if (data.present.size() < n)
+			data.present.emplace_back(key, makeValue<Value>(gen()));
+		else
+			data.missing.push_back(key);
+	}
+	return data;
+}
+
+// The present pairs arranged in `order`, for inserts and construction. A
+// Zipf order is the random one, the keys are distinct.
+template <class KV>
+std::vector<KV> arrange(std::vector<KV> values, KeyOrder order)
+{
+	auto byKey = [](const KV& a, const KV& b) { return a.first < b.first; };
+	if (order == KeyOrder::Sorted)
+		std::sort(values.begin(), values.end(), byKey);
+	else if (order == KeyOrder::Reverse)
+		std::sort(values.rbegin(), values.rend(), byKey);
+	return values;
+}
+
+// Ranks 0..n-1 with P(rank k) proportional to 1 / (k + 1)^s.
+class ZipfDistribution {
+public:
+	explicit ZipfDistribution(size_t n, double s = 0.99)
+		: m_cdf(n)
+	{
+		double sum = 0;
+		for (size_t k = 0; k < n; ++k)
+			m_cdf[k] = sum += 1.0 / std::pow(static_cast<double>(k + 1), s);
+		for (auto& c : m_cdf)
+			c /= sum;
+	}
+
+	template <class Gen>
+	size_t operator()(Gen& gen) const
+	{
+		double u = std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+		size_t k = std::lower_bound(m_cdf.begin(), m_cdf.end(), u) - m_cdf.begin();
+		return std::min(k, m_cdf.size() - 1);
+	}
+
+private:
+	std::vector<double> m_cdf;
+};
+
+// `n` lookup keys, `successPct` percent of them taken from `vs`, the others
+// from `ms`, visited in `order`. Under Zipf the popular keys are a random
+// subset of each set, not the smallest ones.
+template <class KV>
+std::vector<typename KV::first_type> getRandomData(
+		const std::vector<KV>& vs,
+		const std::vector<typename KV::first_type>& ms,
+		size_t n,          // number of elements
+		double successPct, // percent of elements to pull from `vs`
+		KeyOrder order = KeyOrder::Random)
+{
+	using Key = typename KV::first_type;
+	auto gen = makeGen(n * 131 + static_cast<size_t>(successPct) * 7 + static_cast<size_t>(order));
+
+	successPct = std::max(std::min(successPct, 100.0), 0.0);
+	size_t present = vs.empty() ? 0 : static_cast<size_t>(n * successPct / 100.0);
+	size_t missing = ms.empty() ? 0 : n - present;
+
+	std::vector<Key> rs;
+	rs.reserve(present + missing);
+	if (order == KeyOrder::Zipf) {
+		ZipfDistribution hit(vs.size()), miss(std::max<size_t>(ms.size(), 1));
+		for (size_t i = 0; i < present; ++i)
+			rs.push_back(vs[hit(gen)].first);
+		for (size_t i = 0; i < missing; ++i)
+			rs.push_back(ms[miss(gen)]);
+	} else {
+		std::uniform_int_distribution<size_t> dist1(0, vs.empty() ? 0 : vs.size() - 1);
+		std::uniform_int_distribution<size_t> dist2(0, ms.empty() ? 0 : ms.size() - 1);
+		for (size_t i = 0; i < present; ++i)
+			rs.push_back(vs[dist1(gen)].first);
+		for (size_t i = 0; i < missing; ++i)
+			rs.push_back(ms[dist2(gen)]);
+	}
+
+	if (order == KeyOrder::Sorted)
+		std::sort(rs.begin(), rs.end());
+	else if (order == KeyOrder::Reverse)
+		std::sort(rs.rbegin(), rs.rend());
+	else
+		std::shuffle(rs.begin(), rs.end(), gen);
+	return rs;
+}
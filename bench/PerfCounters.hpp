@@ -0,0 +1,160 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// Hardware counters of the timed part of a benchmark, from perf_event_open(2),
+// reported as user counters per item processed:
+//
+//     PerfCounters perf(state, keys.size());   // after the setup
+//     for (auto _ : state) { ... }
+//
+// Off unless the bench runs with --perf_counters. Each event is opened on its
+// own, one the kernel or the machine does not have (VMs often lack the cache
+// events, perf_event_paranoid may forbid all of them) is left out of the
+// report instead of failing the run.
+class PerfCounters {
+public:
+	static bool& enabled()
+	{
+		static bool on = false;
+		return on;
+	}
+
+	// Number of events that can be opened here, errno set when none.
+	static int available()
+	{
+		PerfCounters probe;
+		return probe.m_open;
+	}
+
+	// Counts from here to the destructor, divided by `itemsPerIteration` times
+	// the number of iterations.
+	PerfCounters(benchmark::State& state, size_t itemsPerIteration)
+		: m_state(&state), m_items(itemsPerIteration != 0 ? itemsPerIteration : 1)
+	{
+		if (enabled())
+			open();
+		resume();
+	}
+
+	~PerfCounters()
+	{
+		pause();
+		if (m_state != nullptr && m_state->iterations() != 0)
+			report();
+		for (auto& event : m_events) {
+#ifdef __linux__
+			if (event.fd >= 0)
+				::close(event.fd);
+#endif
+		}
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	// Leaves out work the benchmark does not time either.
+	void pause()
+	{
+		control(false);
+	}
+
+	void resume()
+	{
+		control(true);
+	}
+
+private:
+	struct Event {
+		const char*   name;
+		std::uint32_t type;
+		std::uint64_t config;
+		int           fd;
+	};
+
+	PerfCounters()
+	{
+		open();
+	}
+
+#ifdef __linux__
+	static constexpr std::uint64_t cacheEvent(std::uint64_t cache, std::uint64_t result)
+	{
+		return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+	}
+
+	std::array<Event, 5> m_events{{
+		{"cycles",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1},
+		{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1},
+		{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, -1},
+		{"L1d-misses",   PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS), -1},
+		{"LLC-misses",   PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_RESULT_MISS), -1},
+	}};
+
+	void open()
+	{
+		for (auto& event : m_events) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = event.type;
+			attr.config = event.config;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			// scaled by hand when the kernel multiplexes the events
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			event.fd = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+			m_open += event.fd >= 0;
+		}
+	}
+
+	void control(bool on)
+	{
+		for (auto& event : m_events) {
+			if (event.fd >= 0)
+				::ioctl(event.fd, on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+
+	void report()
+	{
+		double items = static_cast<double>(m_items);
+		double cycles = 0, instructions = 0;
+		for (auto& event : m_events) {
+			std::uint64_t value[3];   // count, time enabled, time running
+			if (event.fd < 0 || ::read(event.fd, value, sizeof(value)) != sizeof(value) || value[2] == 0)
+				continue;
+			double count = static_cast<double>(value[0]) * value[1] / value[2];
+			m_state->counters[event.name] = benchmark::Counter(count / items, benchmark::Counter::kAvgIterations);
+			if (event.config == PERF_COUNT_HW_CPU_CYCLES && event.type == PERF_TYPE_HARDWARE)
+				cycles = count;
+			if (event.config == PERF_COUNT_HW_INSTRUCTIONS && event.type == PERF_TYPE_HARDWARE)
+				instructions = count;
+		}
+		if (cycles > 0 && instructions > 0)
+			m_state->counters["IPC"] = instructions / cycles;
+	}
+#else
+	std::array<Event, 0> m_events{};
+
+	void open() {}
+	void control(bool) {}
+	void report() {}
+#endif
+
+	benchmark::State* m_state = nullptr;
+	size_t            m_items = 1;
+	int               m_open = 0;
+};
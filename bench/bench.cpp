@@ -1,184 +1,259 @@
 #include <benchmark/benchmark.h>
+#include <FlatMap/FlatMap.hpp>
 #include <FlatMap/StaticFlatMap.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
 #include <map>
-#include <unordered_set>
-#include <vector>
+#include <string>
+#include <unordered_map>
 #include <utility>
-#include <random>
-#include <cassert>
-#include <climits>
+#include <vector>
+
+#include "Data.hpp"
+#include "PerfCounters.hpp"
+
+
+// Benchmarks of every map on the same workloads:
+//
+//   Lookup/<map>/<n>/hit:<pct>/<order>   finds, <pct> percent of them hits
+//   Insert/<map>/<n>/<order>             n single inserts into an empty map
+//   Erase/<map>/<n>                      n single erases down to empty
+//   Iterate/<map>/<n>                    one pass over the elements
+//   Construct/<map>/<n>/<order>          range constructor
+//   Copy/<map>/<n>                       copy constructor
+//
+// <map> is the container and its key and value types, eg. FlatMap<u64,blob64>.
+// Keys are drawn from fixed seeds (see Data.hpp), runs are comparable.
+// Pick benchmarks with --benchmark_filter=<regex>, export results with
+// --benchmark_out=<file> --benchmark_out_format=json|csv (make bench-json).
+// With --perf_counters the hardware counters per item (lookup, insert, ...)
+// are reported next to the times, see PerfCounters.hpp.
+//
+// All the work a benchmark reports is inside the timed loop, nothing is
+// paused per iteration: Insert includes freeing the filled map, Erase times
+// the erases only, by hand, the copy it erases from is not counted.
+
+constexpr size_t kLookups = 1024;   // lookups per iteration
 
+template <class Map> struct MapTraits;
 
-#define SUCCESSFUL_LOOKUP_BENCH 1
-#define COPY_MAP_BENCH          1
+template <class K, class V>
+struct MapTraits<std::map<K, V>> {
+	static std::string name() { return "std::map<" + TypeName<K>::get() + "," + TypeName<V>::get() + ">"; }
+	static constexpr size_t maxSize = SIZE_MAX;
+};
 
+template <class K, class V>
+struct MapTraits<std::unordered_map<K, V>> {
+	static std::string name() { return "std::unordered_map<" + TypeName<K>::get() + "," + TypeName<V>::get() + ">"; }
+	static constexpr size_t maxSize = SIZE_MAX;
+};
 
-// The Google.Benchmark macros don't play nicely with templated types
-// because of the commas. Have to love macros...
-using IntIntStlMap = std::map<int, int>;
-using IntIntStaticFlatMap32  = StaticFlatMap<int, int, 32>;
-using IntIntStaticFlatMap64  = StaticFlatMap<int, int, 64>;
-using IntIntStaticFlatMap128 = StaticFlatMap<int, int, 128>;
-using IntIntStaticFlatMap256 = StaticFlatMap<int, int, 256>;
+template <class K, class V>
+struct MapTraits<FlatMap<K, V>> {
+	static std::string name() { return "FlatMap<" + TypeName<K>::get() + "," + TypeName<V>::get() + ">"; }
+	static constexpr size_t maxSize = SIZE_MAX;
+};
+
+template <class K, class V, size_t N>
+struct MapTraits<StaticFlatMap<K, V, N>> {
+	static std::string name()
+	{
+		return "StaticFlatMap<" + TypeName<K>::get() + "," + TypeName<V>::get() + "," + std::to_string(N) + ">";
+	}
+	static constexpr size_t maxSize = N;
+};
 
 // -----------------------------------------------------------------------------
-// Data Generators
+// Benchmarks
 //
 
-auto getIntMapData(size_t n, int min = INT_MIN, int max = INT_MAX)
+template <class Map>
+static void BM_Lookup(benchmark::State& state, size_t n, double successPct, KeyOrder order)
 {
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_int_distribution<int> dist(min, max);
-
-	std::unordered_set<int> vs;
-	while (vs.size() < 2*n) {
-		vs.insert(dist(gen));
-	}
+	using Key = typename Map::key_type;
+	using Value = typename Map::mapped_type;
+	auto data = getMapData<Key, Value>(n);
+	Map m(data.present.begin(), data.present.end());
+	auto keys = getRandomData(data.present, data.missing, kLookups, successPct, order);
 
-	std::vector<std::pair<int, int>> present;
-	std::vector<int>                 missing;
-	for (auto v : vs) {
-		if (present.size() < n) {
-			present.emplace_back(v, dist(gen));
-		} else {
-			missing.emplace_back(v);
+	size_t hits = 0;
+	PerfCounters perf(state, keys.size());
+	for (auto _ : state) {
+		for (auto key : keys) {
+			auto it = m.find(key);
+			benchmark::DoNotOptimize(hits += it != m.end());
 		}
 	}
-	assert(present.size() == n);
-	assert(missing.size() == n);
+	state.SetItemsProcessed(state.iterations() * keys.size());
+	if (hits != static_cast<size_t>(kLookups * successPct / 100.0) * state.iterations())
+		state.SkipWithError("unexpected number of hits");
+}
 
-	std::shuffle(present.begin(), present.end(), gen);
-	std::shuffle(missing.begin(), missing.end(), gen);
-	std::shuffle(present.begin(), present.end(), gen);
-	std::shuffle(missing.begin(), missing.end(), gen);
+template <class Map>
+static void BM_Insert(benchmark::State& state, size_t n, KeyOrder order)
+{
+	using Key = typename Map::key_type;
+	using Value = typename Map::mapped_type;
+	auto values = arrange(getMapData<Key, Value>(n).present, order);
 
-	return std::make_pair(present, missing);
+	PerfCounters perf(state, values.size());
+	for (auto _ : state) {
+		Map m;
+		for (const auto& v : values)
+			m.insert(v);
+		benchmark::DoNotOptimize(m.size());
+	}
+	state.SetItemsProcessed(state.iterations() * values.size());
 }
 
-template <class KV>
-auto getRandomData(
-		const std::vector<KV>& vs,
-		const std::vector<typename KV::first_type>& ms,
-		int n,            // number of elements
-		double successPct // percent of elements to pull from `vs`
-	)
+template <class Map>
+static void BM_Erase(benchmark::State& state, size_t n)
 {
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_int_distribution<int> dist1(0, vs.size() - 1);
-	std::uniform_int_distribution<int> dist2(0, ms.size() - 1);
-	std::uniform_int_distribution<int> prob(0, 100);
-
-	using Key = typename KV::first_type;
-	std::vector<Key> rs;
-	rs.reserve(n);
-
-	successPct = std::max(std::min(successPct, 100.0), 0.0);
-	int present = n * successPct;
-	int missing = n - present;
-
-	std::generate_n(
-		std::back_inserter(rs),
-		present,
-		[&]() -> Key { return vs[dist1(gen)].first; }
-	);
-
-	std::generate_n(
-		std::back_inserter(rs),
-		missing,
-		[&]() -> Key { return ms[dist2(gen)]; }
-	);
-
-	// for good measure...
-	std::shuffle(rs.begin(), rs.end(), gen);
-	std::shuffle(rs.begin(), rs.end(), gen);
-	std::shuffle(rs.begin(), rs.end(), gen);
-
-	return rs;
+	using Key = typename Map::key_type;
+	using Value = typename Map::mapped_type;
+	auto data = getMapData<Key, Value>(n);
+	const Map full(data.present.begin(), data.present.end());
+	auto values = arrange(data.present, KeyOrder::Random);
+	std::shuffle(values.begin(), values.end(), makeGen(n + 1));
+
+	PerfCounters perf(state, values.size());
+	for (auto _ : state) {
+		perf.pause();
+		Map m = full;
+		perf.resume();
+		auto start = std::chrono::steady_clock::now();
+		for (const auto& v : values)
+			m.erase(v.first);
+		benchmark::DoNotOptimize(m.size());
+		auto stop = std::chrono::steady_clock::now();
+		state.SetIterationTime(std::chrono::duration<double>(stop - start).count());
+	}
+	state.SetItemsProcessed(state.iterations() * values.size());
 }
 
-// -----------------------------------------------------------------------------
-// Successful Lookup Benchmarks
-//
-#if SUCCESSFUL_LOOKUP_BENCH
+template <class Map>
+static void BM_Iterate(benchmark::State& state, size_t n)
+{
+	using Key = typename Map::key_type;
+	using Value = typename Map::mapped_type;
+	auto data = getMapData<Key, Value>(n);
+	const Map m(data.present.begin(), data.present.end());
 
-#define SUCCESSFUL_LOOKUP_ARGS \
-	->Args({1<<10, 10})   \
-	->Args({2<<10, 10})   \
-	->Args({1<<10, 20})   \
-	->Args({2<<10, 20})   \
-	->Args({1<<10, 32})   \
-	->Args({2<<10, 32})   \
+	PerfCounters perf(state, m.size());
+	for (auto _ : state) {
+		std::uint64_t sum = 0;
+		for (const auto& kv : m)
+			sum += checksum(kv.second);
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * m.size());
+}
 
 template <class Map>
-static void BM_SuccessfulLookups(benchmark::State& state) {
-	int count = 0;
-	for (auto _ : state) {
-		state.PauseTiming();
-		Map m;
-		auto vals = getIntMapData(state.range(1));
-		for (auto&& v : vals.first) {
-			m.insert(v);
-		}
-		auto data = getRandomData(vals.first, vals.second, state.range(0), 1.0);
-		state.ResumeTiming();
+static void BM_Construct(benchmark::State& state, size_t n, KeyOrder order)
+{
+	using Key = typename Map::key_type;
+	using Value = typename Map::mapped_type;
+	auto values = arrange(getMapData<Key, Value>(n).present, order);
 
-		for (auto key : data) {
-			auto it = m.find(key);
-			benchmark::DoNotOptimize(count += it == m.end());
-		}
+	PerfCounters perf(state, values.size());
+	for (auto _ : state) {
+		Map m(values.begin(), values.end());
+		benchmark::DoNotOptimize(m.size());
 	}
+	state.SetItemsProcessed(state.iterations() * values.size());
+}
+
+template <class Map>
+static void BM_Copy(benchmark::State& state, size_t n)
+{
+	using Key = typename Map::key_type;
+	using Value = typename Map::mapped_type;
+	auto data = getMapData<Key, Value>(n);
+	const Map m(data.present.begin(), data.present.end());
 
-	// just to be safe, use `count` so compiler doesn't optimize away
-	if (count != 0) {
-		throw std::runtime_error("");
+	PerfCounters perf(state, m.size());
+	for (auto _ : state) {
+		Map m2 = m;
+		benchmark::DoNotOptimize(m2.size());
 	}
+	state.SetBytesProcessed(state.iterations() * m.size() * (sizeof(Key) + sizeof(Value)));
 }
-BENCHMARK_TEMPLATE(BM_SuccessfulLookups, IntIntStlMap          ) SUCCESSFUL_LOOKUP_ARGS;
-BENCHMARK_TEMPLATE(BM_SuccessfulLookups, IntIntStaticFlatMap32 ) SUCCESSFUL_LOOKUP_ARGS;
-BENCHMARK_TEMPLATE(BM_SuccessfulLookups, IntIntStaticFlatMap64 ) SUCCESSFUL_LOOKUP_ARGS;
-BENCHMARK_TEMPLATE(BM_SuccessfulLookups, IntIntStaticFlatMap128) SUCCESSFUL_LOOKUP_ARGS;
-BENCHMARK_TEMPLATE(BM_SuccessfulLookups, IntIntStaticFlatMap256) SUCCESSFUL_LOOKUP_ARGS;
-
-#endif
 
 // -----------------------------------------------------------------------------
-// Copy Map Benchmark
+// Registration
 //
-#if COPY_MAP_BENCH
-
-#define COPY_MAP_ARGS \
-	->Arg(10)         \
-	->Arg(20)         \
-	->Arg(30)         \
 
 template <class Map>
-static void BM_CopyMap(benchmark::State& state) {
-	size_t count = 0;
-	for (auto _ : state) {
-		state.PauseTiming();
-		Map m;
-		for (auto&& v : getIntMapData(state.range(0)).first) {
-			m.insert(v);
-		}
-		state.ResumeTiming();
+static void registerMap(const std::vector<size_t>& sizes)
+{
+	const std::string name = MapTraits<Map>::name();
+	for (size_t n : sizes) {
+		if (n > MapTraits<Map>::maxSize)
+			continue;
+		const std::string suffix = name + "/" + std::to_string(n);
 
-		Map m2 = m;
-		benchmark::DoNotOptimize(count += m2.size());
+		struct LookupCase { double successPct; KeyOrder order; };
+		for (LookupCase c : {LookupCase{100, KeyOrder::Random}, LookupCase{50, KeyOrder::Random},
+				LookupCase{0, KeyOrder::Random}, LookupCase{100, KeyOrder::Sorted},
+				LookupCase{100, KeyOrder::Zipf}}) {
+			benchmark::RegisterBenchmark(
+				("Lookup/" + suffix + "/hit:" + std::to_string(static_cast<int>(c.successPct)) +
+					"/" + keyOrderName(c.order)).c_str(),
+				BM_Lookup<Map>, n, c.successPct, c.order);
+		}
+		for (KeyOrder order : {KeyOrder::Random, KeyOrder::Sorted, KeyOrder::Reverse}) {
+			benchmark::RegisterBenchmark(("Insert/" + suffix + "/" + keyOrderName(order)).c_str(),
+				BM_Insert<Map>, n, order);
+		}
+		benchmark::RegisterBenchmark(("Erase/" + suffix).c_str(), BM_Erase<Map>, n)
+			->UseManualTime();
+		benchmark::RegisterBenchmark(("Iterate/" + suffix).c_str(), BM_Iterate<Map>, n);
+		for (KeyOrder order : {KeyOrder::Random, KeyOrder::Sorted}) {
+			benchmark::RegisterBenchmark(("Construct/" + suffix + "/" + keyOrderName(order)).c_str(),
+				BM_Construct<Map>, n, order);
+		}
+		benchmark::RegisterBenchmark(("Copy/" + suffix).c_str(), BM_Copy<Map>, n);
 	}
+}
 
-	// just to be safe, use `count` so compiler doesn't optimize away
-	if (count == 0u) {
-		throw std::runtime_error("");
-	}
+template <class K, class V>
+static void registerMaps()
+{
+	// StaticFlatMap only at the sizes that fit its capacity
+	const std::vector<size_t> sizes = {32, 256, 4096, 65536};
+	registerMap<std::map<K, V>>(sizes);
+	registerMap<std::unordered_map<K, V>>(sizes);
+	registerMap<FlatMap<K, V>>(sizes);
+	registerMap<StaticFlatMap<K, V, 32>>(sizes);
+	registerMap<StaticFlatMap<K, V, 256>>(sizes);
 }
-BENCHMARK_TEMPLATE(BM_CopyMap, IntIntStlMap          ) COPY_MAP_ARGS;
-BENCHMARK_TEMPLATE(BM_CopyMap, IntIntStaticFlatMap32 ) COPY_MAP_ARGS;
-BENCHMARK_TEMPLATE(BM_CopyMap, IntIntStaticFlatMap64 ) COPY_MAP_ARGS;
-BENCHMARK_TEMPLATE(BM_CopyMap, IntIntStaticFlatMap128) COPY_MAP_ARGS;
-BENCHMARK_TEMPLATE(BM_CopyMap, IntIntStaticFlatMap256) COPY_MAP_ARGS;
 
-#endif
+int main(int argc, char** argv)
+{
+	// our own flag, taken out before Google Benchmark sees the arguments
+	int kept = 1;
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--perf_counters") == 0)
+			PerfCounters::enabled() = true;
+		else
+			argv[kept++] = argv[i];
+	}
+	argc = kept;
+	if (PerfCounters::enabled() && PerfCounters::available() == 0)
+		std::fprintf(stderr, "perf counters unavailable: %s\n", std::strerror(errno));
 
-BENCHMARK_MAIN();
+	registerMaps<int, int>();
+	registerMaps<std::uint64_t, std::uint64_t>();
+	registerMaps<int, Blob<64>>();
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	return 0;
+}
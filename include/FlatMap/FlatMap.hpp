@@ -1,68 +1,213 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <cstddef>
+#include <initializer_list>
+#include <limits>
+#include <new>
 #include <type_traits>
 #include <vector>
 #include <utility>
+#include <functional>
 
+#include "Merge.hpp"
+#include "Policies.hpp"
+#include "Stats.hpp"
+#include "Tags.hpp"
+#include "detail/InsertBuffer.hpp"
+#include "detail/LearnedIndex.hpp"
+#include "detail/Search.hpp"
+#include "detail/SplitIterator.hpp"
 
+// Heap backed sorted map, keys and values are kept in two parallel arrays
+// (split storage) carved out of a single allocation, so a key search only
+// touches key cache lines. Keys are unique.
+//
+// Policies (see Policies.hpp) may follow the comparator:
+//     FlatMap<std::uint64_t, Value, std::less<>, flatmap::LearnedSearch>
+//
+// With flatmap::BufferedInsert, begin(), lower_bound(), upper_bound() and
+// equal_range() merge the pending inserts first, which invalidates iterators
+// as an insert would. Their const overloads never write to the map: they
+// require flush() to have been called (asserted), while find(), count() and
+// contains() search the pending inserts as well. Copies and moves are flushed.
 template <
     typename _Key,
     typename _T,
-    typename _Compare = std::less<_Key>
+    typename _Compare = std::less<_Key>,
+    typename... _Policies
 >
 class FlatMap
     : private _Compare
+    , private std::conditional_t<
+        std::is_same<flatmap::detail::select_policy_t<flatmap::detail::search_policy_tag,
+            flatmap::BinarySearch, _Policies...>, flatmap::LearnedSearch>::value,
+        flatmap::detail::LearnedIndex<_Key>, flatmap::detail::NoIndex>
+    , private flatmap::detail::InsertBuffer<
+        flatmap::detail::select_policy_t<flatmap::detail::insert_policy_tag,
+            flatmap::DirectInsert, _Policies...>::buffer != 0>
+    , private flatmap::detail::StatsCounter<
+        flatmap::detail::select_policy_t<flatmap::detail::stats_policy_tag,
+            flatmap::NoStats, _Policies...>::enabled>
 {
     static_assert(std::is_trivially_copyable<_Key>::value,
             "FlatMap key type must be Trivially Copyable");
     static_assert(std::is_trivially_copyable<_T>::value,
             "FlatMap mapped type must be Trivially Copyable");
+    static_assert(flatmap::detail::are_policies_v<_Policies...>,
+            "FlatMap policies must come from Policies.hpp");
 
-    struct Iterator;
-    struct PairPtr;
-    // struct ConstIterator;
+    using search_policy = flatmap::detail::select_policy_t<
+        flatmap::detail::search_policy_tag, flatmap::BinarySearch, _Policies...>;
+    static constexpr bool _learned = std::is_same<search_policy, flatmap::LearnedSearch>::value;
+    using _Index = std::conditional_t<_learned,
+        flatmap::detail::LearnedIndex<_Key>, flatmap::detail::NoIndex>;
+
+    static_assert(!_learned || (std::is_arithmetic<_Key>::value &&
+            flatmap::detail::is_less_v<_Compare, _Key>),
+            "LearnedSearch needs arithmetic keys ordered by std::less");
+
+    using insert_policy = flatmap::detail::select_policy_t<
+        flatmap::detail::insert_policy_tag, flatmap::DirectInsert, _Policies...>;
+    static constexpr std::size_t _max_pending = insert_policy::buffer;
+    static constexpr bool _buffered = _max_pending != 0;
+    using _Buffer = flatmap::detail::InsertBuffer<_buffered>;
+
+    static_assert(_max_pending <= 1024, "BufferedInsert buffer is merged on the stack, keep it small");
+
+    static constexpr bool _collect_stats = flatmap::detail::select_policy_t<
+        flatmap::detail::stats_policy_tag, flatmap::NoStats, _Policies...>::enabled;
+    using _Stats = flatmap::detail::StatsCounter<_collect_stats>;
+
+    static_assert(flatmap::detail::select_policy_t<
+            flatmap::detail::filter_policy_tag, flatmap::NoFilter, _Policies...>::bits_per_key == 0,
+            "BloomFilter is a StaticFlatMap policy");
+    static_assert(flatmap::detail::select_policy_t<
+            flatmap::detail::cache_policy_tag, flatmap::NoCache, _Policies...>::sets == 0,
+            "HotKeyCache is a StaticFlatMap policy");
+
+    static constexpr std::size_t _element_size = sizeof(_Key) + sizeof(_T);
 
 public:
     using key_compare = _Compare;
     using key_type = _Key;
     using mapped_type = _T;
-    using value_type = std::pair<const key_type&, mapped_type&>;
+    using value_type = std::pair<key_type, mapped_type>;
     using size_type = std::size_t;
-    using iterator = Iterator;
-    // using const_iterator = ConstIterator;
+    using iterator = flatmap::detail::SplitIterator<key_type, mapped_type, false>;
+    using const_iterator = flatmap::detail::SplitIterator<key_type, mapped_type, true>;
     using difference_type = std::ptrdiff_t;
-    using reference = value_type&;
-    using const_reference = const value_type&;
-    using pointer = 
-    // using pointer = value_type*;
-    using const_pointer = const value_type*;
+    using reference = typename iterator::reference;
+    using const_reference = typename const_iterator::reference;
+    using pointer = typename iterator::pointer;
+    using const_pointer = typename const_iterator::pointer;
+
+    // Smallest capacity allocated by the first insert.
+    static constexpr size_type min_capacity = 8;
 
     FlatMap(const key_compare& comp = key_compare()) noexcept
         : _Compare{comp} {}
 
-    // FlatMap(std::initializer_list<value_type> values) noexcept;
-    // FlatMap(const FlatMap& other) noexcept;
-    // FlatMap(FlatMap&& other) noexcept;
-    // FlatMap& operator=(const FlatMap& other) noexcept;
-    // FlatMap& operator=(FlatMap&& other) noexcept;
+    // Bulk construction: the input is sorted once (stable, so the first of
+    // equivalent keys is the one kept) instead of inserted one by one.
+    template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+    FlatMap(InputIt first, InputIt last, const key_compare& comp = key_compare())
+        : _Compare{comp}
+    {
+        insert(first, last);
+    }
+
+    FlatMap(std::initializer_list<value_type> values, const key_compare& comp = key_compare())
+        : FlatMap(values.begin(), values.end(), comp) {}
+
+    // [first, last) is already sorted and free of duplicates.
+    template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+    FlatMap(flatmap::sorted_unique_t, InputIt first, InputIt last,
+            const key_compare& comp = key_compare())
+        : _Compare{comp}
+    {
+        insert(flatmap::sorted_unique, first, last);
+    }
+
+    FlatMap(flatmap::sorted_unique_t, std::initializer_list<value_type> values,
+            const key_compare& comp = key_compare())
+        : FlatMap(flatmap::sorted_unique, values.begin(), values.end(), comp) {}
+
+    // A copy starts with fresh statistics. Copies and moves merge the pending
+    // inserts, a map defined const never has any.
+    FlatMap(const FlatMap& other)
+        : _Compare{other.key_comp()}, _Index{other._index()}, _Buffer{other._buffer()}
+    {
+        _relocate(other._size);
+        _copy_n(0, other._keys, other._vals, other._size);
+        _size = other._size;
+        flush();
+    }
+
+    FlatMap(FlatMap&& other) noexcept
+        : _Compare{other.key_comp()}
+    {
+        swap(other);
+        _sync();
+    }
+
+    FlatMap& operator=(const FlatMap& other)
+    {
+        if (this != &other) {
+            FlatMap tmp{other};
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    FlatMap& operator=(FlatMap&& other) noexcept
+    {
+        FlatMap tmp{std::move(other)};
+        swap(tmp);
+        return *this;
+    }
+
+    ~FlatMap() noexcept
+    {
+        _deallocate(_keys, _capacity);
+    }
+
     // bool operator==(const FlatMap& other) noexcept;
     // bool operator!=(const FlatMap& other) noexcept;
 
     iterator begin() noexcept
     {
-        return iterator{&_keys[0], &_vals[0]};
+        _sync();
+        return iterator{_keys, _vals};
+    }
+
+    const_iterator begin() const noexcept
+    {
+        _assert_flushed();
+        return const_iterator{_keys, _vals};
+    }
+
+    const_iterator cbegin() const noexcept
+    {
+        return begin();
     }
 
-    // const_iterator begin() const noexcept;
-    // const_iterator cbegin() const noexcept;
     iterator end() noexcept
     {
-        return iterator{&_keys[_size], &_vals[_size]};
+        return iterator{_keys + _size, _vals + _size};
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator{_keys + _size, _vals + _size};
+    }
+
+    const_iterator cend() const noexcept
+    {
+        return end();
     }
-    // const_iterator end() const noexcept;
-    // const_iterator cend() const noexcept;
 
     constexpr bool empty() const noexcept
     {
@@ -74,86 +219,387 @@ public:
         return _size;
     }
 
+    constexpr size_type capacity() const noexcept
+    {
+        return _capacity;
+    }
+
     constexpr size_type max_size() const noexcept
     {
-        return std::numeric_limits<decltype(size)>::max();
+        return std::numeric_limits<difference_type>::max()
+            / (sizeof(key_type) + sizeof(mapped_type));
+    }
+
+    // Makes room for at least `n` elements, relocating both arrays at once.
+    void reserve(size_type n)
+    {
+        if (n > _capacity)
+            _relocate(n);
     }
 
-    // void clear() noexcept;
+    // Releases the slack, a map without elements gives back its storage.
+    void shrink_to_fit()
+    {
+        if (_size < _capacity)
+            _relocate(_size);
+    }
 
-    std::pair<iterator, bool> insert(const value_type& x) noexcept
+    void clear() noexcept
     {
-        auto it = lower_bound(x.first);
-        if (it == end() || !key_comp()(x.first, it->first))
-            return std::make_pair(it, false);
-        // TODO: grow
-        difference_type pos = it - begin();
-        difference_type cnt = _size - pos + 1;
-        memmove(&_keys[pos+1], &_keys[pos], sizeof(*_keys)*cnt);
-        memmove(&_vals[pos+1], &_vals[pos], sizeof(*_vals)*cnt);
-        ++_size;
-        return std::make_pair(iterator{&_keys[pos], &_vals[pos]}, true);
+        _size = 0;
+        _index() = _Index{};
+        _buffer() = _Buffer{};
+    }
+
+    // Merges the pending inserts of a BufferedInsert map, no-op otherwise.
+    void flush()
+    {
+        if constexpr (_buffered) {
+            if (_buffer().pending() != 0 && _flush())
+                _refit();
+        }
+    }
+
+    // Counters of a map with flatmap::CollectStats, see Stats.hpp.
+    flatmap::MapStats stats() const noexcept
+    {
+        static_assert(_collect_stats, "stats() needs the flatmap::CollectStats policy");
+        return _stats().snapshot(_size, _capacity);
+    }
+
+    void reset_stats() noexcept
+    {
+        static_assert(_collect_stats, "reset_stats() needs the flatmap::CollectStats policy");
+        _stats().reset(_size);
+    }
+
+    std::pair<iterator, bool> insert(const value_type& x)
+    {
+        if constexpr (_buffered)
+            return _insert_buffered(x);
+        else
+            return _insert_direct(x);
     }
 
     // template <class P,
     //     typename = typename std::is_constructible<value_type, P&&>::value>>
     // std::pair<iterator, bool> insert(P&& value) noexcept;
 
-    // template <class InputIt>
-    // void insert(InputIt first, InputIt last) noexcept;
+    // Sorts the new elements, drops the duplicates and merges them with the
+    // current contents in one pass. Keys already in the map keep their value.
+    template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+    void insert(InputIt first, InputIt last)
+    {
+        std::vector<value_type> buf(first, last);
+        const key_compare& comp = _comp();
+        auto less = [&](const value_type& a, const value_type& b) { return comp(a.first, b.first); };
+        auto same = [&](const value_type& a, const value_type& b) { return !comp(a.first, b.first); };
+        std::stable_sort(buf.begin(), buf.end(), less);
+        buf.erase(std::unique(buf.begin(), buf.end(), same), buf.end());
+        _merge_unique(buf.data(), buf.size(), flatmap::KeepLeft{});
+    }
+
+    void insert(std::initializer_list<value_type> values)
+    {
+        insert(values.begin(), values.end());
+    }
+
+    // [first, last) is already sorted and free of duplicates, only the merge
+    // is left to do.
+    template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+    void insert(flatmap::sorted_unique_t, InputIt first, InputIt last)
+    {
+        std::vector<value_type> buf(first, last);
+        _merge_unique(buf.data(), buf.size(), flatmap::KeepLeft{});
+    }
+
+    // Adds the elements of `other` in one linear pass, `other` is left as is.
+    // For keys in both maps the value becomes resolve(key, this value, other
+    // value), see Merge.hpp. Merges backward in place when the capacity is
+    // enough, into a new block otherwise. An `other` with pending inserts is
+    // merged from a flushed copy, as are the operands of map_union() and co.
+    template <class Resolve = flatmap::KeepLeft>
+    void merge(const FlatMap& other, Resolve resolve = Resolve{})
+    {
+        if (&other == this)
+            return;
+        if (other._buffer().pending() != 0)
+            return merge(FlatMap{other}, resolve);
+        _merge_unique(other.begin(), other._size, resolve);
+    }
+
+    // The keys of either map, one linear pass each. Keys in both get
+    // resolve(key, a value, b value).
+    template <class Resolve = flatmap::KeepLeft>
+    friend FlatMap map_union(const FlatMap& a, const FlatMap& b, Resolve resolve = Resolve{})
+    {
+        if (a._buffer().pending() != 0 || b._buffer().pending() != 0)
+            return map_union(FlatMap{a}, FlatMap{b}, resolve);
+        FlatMap out{a.key_comp()};
+        out._relocate(a._size + b._size);
+        flatmap::detail::merge_by_key<true, true, true>(
+            a.begin(), a.end(), b.begin(), b.end(), a._comp(), resolve, out._appender());
+        out._refit();
+        return out;
+    }
+
+    // The keys of both maps.
+    template <class Resolve = flatmap::KeepLeft>
+    friend FlatMap map_intersection(const FlatMap& a, const FlatMap& b, Resolve resolve = Resolve{})
+    {
+        if (a._buffer().pending() != 0 || b._buffer().pending() != 0)
+            return map_intersection(FlatMap{a}, FlatMap{b}, resolve);
+        FlatMap out{a.key_comp()};
+        out._relocate(std::min(a._size, b._size));
+        flatmap::detail::merge_by_key<false, false, true>(
+            a.begin(), a.end(), b.begin(), b.end(), a._comp(), resolve, out._appender());
+        out._refit();
+        return out;
+    }
+
+    // The keys of `a` that are not in `b`.
+    friend FlatMap map_difference(const FlatMap& a, const FlatMap& b)
+    {
+        if (a._buffer().pending() != 0 || b._buffer().pending() != 0)
+            return map_difference(FlatMap{a}, FlatMap{b});
+        FlatMap out{a.key_comp()};
+        out._relocate(a._size);
+        flatmap::KeepLeft resolve;
+        flatmap::detail::merge_by_key<true, false, false>(
+            a.begin(), a.end(), b.begin(), b.end(), a._comp(), resolve, out._appender());
+        out._refit();
+        return out;
+    }
 
     // template <class... Args>
     // std::pair<iterator, bool> emplace(Args&&... args) noexcept;
 
-    // iterator find(const key_type& key) noexcept;
-    // const_iterator find(const key_type& key) const noexcept;
+    iterator find(const key_type& key) noexcept
+    {
+        return _make_iterator(_find(key));
+    }
+
+    const_iterator find(const key_type& key) const noexcept
+    {
+        return _make_iterator(_find(key));
+    }
+
+    // Lookups by any type the comparator can order against the keys, when
+    // the comparator declares is_transparent (eg. std::less<>).
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) noexcept
+    {
+        return _make_iterator(_find(key));
+    }
+
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    const_iterator find(const K& key) const noexcept
+    {
+        return _make_iterator(_find(key));
+    }
+
+    // Looks up every key of [first, last) and writes one iterator per key to
+    // `out`, end() for the missing ones. The searches are interleaved so
+    // their cache misses overlap, see lower_bound_batch in detail/Search.hpp.
+    template <class KeyIt, class OutIt>
+    OutIt find_batch(KeyIt first, KeyIt last, OutIt out) noexcept
+    {
+        _sync();
+        const key_compare& comp = _comp();
+        flatmap::detail::lower_bound_batch(_keys, _size, first, last, comp,
+            [&](const key_type& key, size_type pos) {
+                bool found = pos != _size && !comp(key, _keys[pos]);
+                _stats().count_lookup(found, _size);
+                *out++ = _make_iterator(found ? pos : _size);
+            });
+        return out;
+    }
+
+    template <class KeyIt, class OutIt>
+    OutIt find_batch(KeyIt first, KeyIt last, OutIt out) const noexcept
+    {
+        const key_compare& comp = _comp();
+        size_type sorted = _sorted_size();
+        flatmap::detail::lower_bound_batch(_keys, sorted, first, last, comp,
+            [&](const key_type& key, size_type pos) {
+                if (pos == sorted || comp(key, _keys[pos])) {
+                    if constexpr (_buffered)
+                        pos = _find_pending(key);
+                    else
+                        pos = _size;
+                }
+                _stats().count_lookup(pos != _size, sorted);
+                *out++ = const_iterator{_make_iterator(pos)};
+            });
+        return out;
+    }
+
+    iterator erase(const_iterator pos) noexcept
+    {
+        return _erase(pos.key_ptr() - _keys, 1);
+    }
+
+    iterator erase(iterator pos) noexcept
+    {
+        return erase(const_iterator{pos});
+    }
+
+    // One move of the tail, whatever the length of [first, last).
+    iterator erase(const_iterator first, const_iterator last) noexcept
+    {
+        return _erase(first.key_ptr() - _keys, last - first);
+    }
+
+    size_type erase(const key_type& key) noexcept
+    {
+        size_type pos = _find(key);
+        if (pos == _size)
+            return 0;
+        _erase(pos, 1);
+        return 1;
+    }
 
-    // template <class K,
-    //          class C = _Compare, typename = typename C::is_transparent>
-    // iterator find(const K& key) noexcept;
+    // Removes the elements `pred` returns true for, the others are compacted
+    // in one stable pass. Returns how many were removed.
+    template <class Pred>
+    friend size_type erase_if(FlatMap& map, Pred pred)
+    {
+        map._sync();
+        size_type kept = 0;
+        for (size_type i = 0; i != map._size; ++i) {
+            if (pred(*map._make_iterator(i)))
+                continue;
+            if (kept != i) {
+                map._keys[kept] = map._keys[i];
+                map._vals[kept] = map._vals[i];
+            }
+            ++kept;
+        }
+        size_type removed = map._size - kept;
+        map._stats().count_moved(kept * _element_size);
+        map._stats().count_erases(removed);
+        map._size = kept;
+        map._refit();
+        return removed;
+    }
 
-    // template <class K,
-    //          class C = _Compare, typename = typename C::is_transparent>
-    // const_iterator find(const K& key) const noexcept;
+    size_type count(const key_type& key) const noexcept
+    {
+        return contains(key) ? 1 : 0;
+    }
 
-    // iterator erase(const_iterator pos) noexcept;
-    // iterator erase(iterator pos) noexcept;
-    // iterator erase(const_iterator first, const_iterator last) noexcept;
-    // size_type erase(const key_type& key) noexcept;
+    // A transparent key may be equivalent to several keys of the map.
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    size_type count(const K& key) const noexcept
+    {
+        size_type n = _upper_bound(key) - _lower_bound(key);
+        if constexpr (_buffered) {
+            const key_compare& comp = _comp();
+            for (size_type i = _sorted_size(); i != _size; ++i)
+                n += !comp(key, _keys[i]) && !comp(_keys[i], key);
+        }
+        return n;
+    }
 
-    // size_type count(const key_type& key) const noexcept;
-    // bool contains(const key_type& key) const noexcept;
+    bool contains(const key_type& key) const noexcept
+    {
+        return _find(key) != _size;
+    }
 
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    bool contains(const K& key) const noexcept
+    {
+        return _find(key) != _size;
+    }
+
+    // The search strategy is picked off the size, see detail/Search.hpp
     iterator lower_bound(const key_type& key) noexcept
     {
-        // TODO: dispatch off size
-        return _lower_bound_linear(key);
-    }
-    // const_iterator lower_bound(const key_type& key) const noexcept;
-    // template <class K,
-    //          class C = _Compare, typename = typename C::is_transparent>
-    // iterator lower_bound(const K& k) noexcept;
-    // template <class K,
-    //          class C = _Compare, typename = typename C::is_transparent>
-    // const_iterator lower_bound(const K& k) const noexcept;
-
-    // std::pair<iterator, iterator> equal_range(const key_type& key) noexcept;
-    // std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const noexcept;
-    // template <class K,
-    //          class C = _Compare, typename = typename C::is_transparent>
-    // std::pair<iterator, iterator> equal_range(const K& key) noexcept;
-    // template <class K,
-    //          class C = _Compare, typename = typename C::is_transparent>
-    // std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const noexcept;
-
-    // iterator upper_bound(const key_type& key) noexcept;
-    // const_iterator upper_bound(const key_type& key) const noexcept;
-    // template <class K,
-    //          class C = _Compare, typename = typename C::is_transparent>
-    // iterator upper_bound(const K& k) noexcept;
-    // template <class K,
-    //          class C = _Compare, typename = typename C::is_transparent>
-    // const_iterator upper_bound(const K& k) const noexcept;
+        _sync();
+        return _make_iterator(_lower_bound(key));
+    }
+
+    const_iterator lower_bound(const key_type& key) const noexcept
+    {
+        _assert_flushed();
+        return _make_iterator(_lower_bound(key));
+    }
+
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) noexcept
+    {
+        _sync();
+        return _make_iterator(_lower_bound(key));
+    }
+
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    const_iterator lower_bound(const K& key) const noexcept
+    {
+        _assert_flushed();
+        return _make_iterator(_lower_bound(key));
+    }
+
+    std::pair<iterator, iterator> equal_range(const key_type& key) noexcept
+    {
+        _sync();
+        return _equal_range<iterator>(key);
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const noexcept
+    {
+        _assert_flushed();
+        return _equal_range<const_iterator>(key);
+    }
+
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key) noexcept
+    {
+        _sync();
+        return _equal_range<iterator>(key);
+    }
+
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    std::pair<const_iterator, const_iterator> equal_range(const K& key) const noexcept
+    {
+        _assert_flushed();
+        return _equal_range<const_iterator>(key);
+    }
+
+    iterator upper_bound(const key_type& key) noexcept
+    {
+        _sync();
+        return _make_iterator(_upper_bound(key));
+    }
+
+    const_iterator upper_bound(const key_type& key) const noexcept
+    {
+        _assert_flushed();
+        return _make_iterator(_upper_bound(key));
+    }
+
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) noexcept
+    {
+        _sync();
+        return _make_iterator(_upper_bound(key));
+    }
+
+    template <class K,
+             class C = _Compare, typename = typename C::is_transparent>
+    const_iterator upper_bound(const K& key) const noexcept
+    {
+        _assert_flushed();
+        return _make_iterator(_upper_bound(key));
+    }
 
     void swap(FlatMap& other) noexcept(std::is_nothrow_swappable<_Compare>::value)
     {
@@ -162,152 +608,423 @@ public:
         std::swap(_size,     other._size);
         std::swap(_capacity, other._capacity);
         std::swap(static_cast<_Compare&>(*this), static_cast<_Compare&>(other));
+        std::swap(_index(), other._index());
+        std::swap(_buffer(), other._buffer());
+        std::swap(_stats(), other._stats());
     }
 
     constexpr key_compare key_comp() const noexcept { return *this; }
 
 private:
-    iterator _lower_bound_linear(const key_type& key) noexcept
-    {
-        auto comp = key_compare();
-        const key_type* b = &_keys[0];
-        const key_type* e = &_keys[_size];
-        const key_type* k;
-        for (k = b; k != e; ++k) {
-            if (!comp(key, *k))
-                break;
-        }
-        return _make_iterator(k);
+    // Both arrays live in one block: [keys...][pad][vals...]
+    static constexpr std::size_t _align =
+        alignof(key_type) > alignof(mapped_type) ? alignof(key_type) : alignof(mapped_type);
+
+    static constexpr std::size_t _vals_offset(size_type capacity) noexcept
+    {
+        std::size_t bytes = capacity * sizeof(key_type);
+        return (bytes + alignof(mapped_type) - 1) & ~(alignof(mapped_type) - 1);
     }
 
-    iterator _make_iterator(const key_type* k) noexcept
+    static void _deallocate(key_type* keys, size_type capacity) noexcept
     {
-        auto pos = k - &_keys[0];
-        return iterator{k, &_vals[pos]};
+        if (keys == nullptr)
+            return;
+        ::operator delete(static_cast<void*>(keys),
+            _vals_offset(capacity) + capacity * sizeof(mapped_type),
+            std::align_val_t{_align});
     }
 
-    // const key_type* _keys = nullptr;
-    // const key_type* _keyend = nullptr;
-    // mapped_type*    _vals = nullptr;
-    // size_type       _capacity = 0;
+    size_type _grow_capacity(size_type required) const noexcept
+    {
+        size_type cap = _capacity < min_capacity ? min_capacity : _capacity * 2;
+        return cap < required ? required : cap;
+    }
 
-    // TODO: use u32 for size and capacity?
-    key_type*    _keys = nullptr;
-    mapped_type* _vals = nullptr;
-    size_type    _size = 0;
-    size_type    _capacity = 0;
-};
+    // Both arrays of a fresh block for `capacity` elements.
+    static std::pair<key_type*, mapped_type*> _allocate(size_type capacity)
+    {
+        if (capacity == 0)
+            return {nullptr, nullptr};
+        void* block = ::operator new(
+            _vals_offset(capacity) + capacity * sizeof(mapped_type),
+            std::align_val_t{_align});
+        return {static_cast<key_type*>(block), reinterpret_cast<mapped_type*>(
+            static_cast<char*>(block) + _vals_offset(capacity))};
+    }
 
-template <typename Key, typename T, typename Compare>
-struct FlatMap<Key, T, Compare>::PairPtr : std::pair<const Key&, T&> {
-    constexpr PairPtr(const Key& k, T& v) noexcept
-        : std::pair<const Key&, T&>{k, v} {}
+    void _adopt(std::pair<key_type*, mapped_type*> block, size_type capacity) noexcept
+    {
+        _deallocate(_keys, _capacity);
+        _keys = block.first;
+        _vals = block.second;
+        _capacity = capacity;
+    }
 
-    const std::pair<const Key&, T&>* operator->() const noexcept
+    // Moves the contents into a block of `capacity` elements. When `gap` is
+    // not npos, a hole is opened at that index while copying so an insert
+    // that triggers growth moves every element exactly once.
+    void _relocate(size_type capacity, size_type gap = size_type(-1))
     {
-        return this;
+        auto block = _allocate(capacity);
+        key_type*    keys = block.first;
+        mapped_type* vals = block.second;
+        if (_size != 0) {
+            _stats().count_moved(_size * _element_size);
+            size_type head = gap < _size ? gap : _size;
+            size_type skip = gap < _size ? 1 : 0;
+            std::memcpy(keys, _keys, sizeof(*_keys)*head);
+            std::memcpy(vals, _vals, sizeof(*_vals)*head);
+            std::memcpy(keys + head + skip, _keys + head, sizeof(*_keys)*(_size - head));
+            std::memcpy(vals + head + skip, _vals + head, sizeof(*_vals)*(_size - head));
+        }
+        _adopt(block, capacity);
     }
-};
 
-template <typename Key, typename T, typename Compare>
-struct FlatMap<Key, T, Compare>::Iterator {
-    constexpr Iterator() noexcept = default;
-    constexpr Iterator(const key_type* key, mapped_type* val) noexcept
-        : _key{key}, _val{val}
-    {}
+    // Merges `n` sorted, unique elements into the map, a key already present
+    // gets resolve(key, its value, the new value). With room enough the merge
+    // runs backward in place, otherwise it goes to a new block. Either way
+    // every element moves once.
+    template <class SrcIt, class Resolve>
+    void _merge_unique(SrcIt src, size_type n, Resolve resolve)
+    {
+        _sync();
+        if (n == 0)
+            return;
+        size_type required = _size + n;
+        size_type old_size = _size;
+        if (required <= _capacity && _size != 0) {
+            _merge_unique_backward(src, n, resolve);
+            _stats().count_inserts(_size - old_size, _size);
+            _refit();
+            return;
+        }
+
+        size_type capacity = required <= _capacity ? _capacity : _grow_capacity(required);
+        auto block = _size == 0 && required <= _capacity
+            ? std::make_pair(_keys, _vals) : _allocate(capacity);
+        key_type*    keys = block.first;
+        mapped_type* vals = block.second;
 
-    std::pair<const key_type&, mapped_type&> operator*() noexcept
+        const key_compare& comp = _comp();
+        size_type i = 0, j = 0, out = 0;
+        while (i < _size && j < n) {
+            const auto& kv = src[j];
+            if (comp(kv.first, _keys[i])) {
+                keys[out] = kv.first;
+                vals[out] = kv.second;
+                ++j;
+            } else {
+                if (!comp(_keys[i], kv.first)) {
+                    vals[out] = resolve(_keys[i], _vals[i], kv.second);
+                    ++j;
+                } else {
+                    vals[out] = _vals[i];
+                }
+                keys[out] = _keys[i];
+                ++i;
+            }
+            ++out;
+        }
+        for (; i < _size; ++i, ++out) {
+            keys[out] = _keys[i];
+            vals[out] = _vals[i];
+        }
+        for (; j < n; ++j, ++out) {
+            const auto& kv = src[j];
+            keys[out] = kv.first;
+            vals[out] = kv.second;
+        }
+
+        if (keys != _keys)
+            _adopt(block, capacity);
+        _size = out;
+        _stats().count_moved(out * _element_size);
+        _stats().count_inserts(out - old_size, out);
+        _refit();
+    }
+
+    // Fills [_size + n) from the back, the elements of the map never get
+    // overwritten before being read. Each key found in both leaves a hole,
+    // closed at the end by moving the merged part down once.
+    template <class SrcIt, class Resolve>
+    void _merge_unique_backward(SrcIt src, size_type n, Resolve& resolve)
     {
-        return std::make_pair(*_key, *_val);
+        const key_compare& comp = _comp();
+        size_type required = _size + n;
+        size_type i = _size, j = n, out = required;
+        while (j != 0) {
+            const auto& kv = src[j - 1];
+            --out;
+            if (i != 0 && comp(kv.first, _keys[i - 1])) {
+                --i;
+                _keys[out] = _keys[i];
+                _vals[out] = _vals[i];
+            } else if (i != 0 && !comp(_keys[i - 1], kv.first)) {
+                --i;
+                --j;
+                mapped_type val = resolve(_keys[i], _vals[i], kv.second);
+                _keys[out] = _keys[i];
+                _vals[out] = val;
+            } else {
+                --j;
+                _keys[out] = kv.first;
+                _vals[out] = kv.second;
+            }
+        }
+        // [0, i) is untouched, the merged elements start at `out`
+        if (out != i) {
+            std::memmove(_keys + i, _keys + out, sizeof(*_keys)*(required - out));
+            std::memmove(_vals + i, _vals + out, sizeof(*_vals)*(required - out));
+            _stats().count_moved((required - out) * _element_size);
+        }
+        _stats().count_moved((required - out) * _element_size);
+        _size = required - (out - i);
     }
 
-    std:: operator->() noexcept
+    // emit() of merge_by_key, the map has room for every element.
+    auto _appender() noexcept
     {
-        return &operator*();
+        return [this](const key_type& key, const mapped_type& val) {
+            _keys[_size] = key;
+            _vals[_size] = val;
+            ++_size;
+            _stats().count_inserts(1, _size);
+        };
     }
 
-    iterator& operator++() noexcept
+    iterator _erase(size_type pos, size_type count) noexcept
     {
-        ++_key; ++_val;
-        return *this;
+        if constexpr (_buffered) {
+            size_type sorted = _sorted_size();
+            if (pos + count > sorted)
+                _buffer()._pending -= pos + count - std::max(pos, sorted);
+        }
+        size_type tail = _size - pos - count;
+        if (count != 0 && tail != 0) {
+            std::memmove(_keys + pos, _keys + pos + count, sizeof(*_keys)*tail);
+            std::memmove(_vals + pos, _vals + pos + count, sizeof(*_vals)*tail);
+            _stats().count_moved(tail * _element_size);
+        }
+        _stats().count_erases(count);
+        _size -= count;
+        if (_index().drift(count))
+            _index().refit_in_place(_keys, _sorted_size());
+        return _make_iterator(pos);
     }
 
-    iterator operator++(int) noexcept
+    void _copy_n(size_type pos, const key_type* keys, const mapped_type* vals, size_type n) noexcept
     {
-        iterator tmp{*this};
-        ++(*this);
-        return tmp;
+        if (n == 0)
+            return;
+        std::memcpy(_keys + pos, keys, sizeof(*_keys)*n);
+        std::memcpy(_vals + pos, vals, sizeof(*_vals)*n);
     }
 
-    iterator& operator+=(difference_type n) noexcept
+    // Index based searches, `key` is a key_type or, for transparent
+    // comparators, anything comparable with one.
+    template <class K>
+    size_type _lower_bound(const K& key) const noexcept
     {
-        _key += n;
-        _val += n;
-        return *this;
+        if constexpr (_learned && std::is_same<K, key_type>::value)
+            return _index().search(_keys, _sorted_size(), key, _comp());
+        else
+            return flatmap::detail::lower_bound(_keys, _sorted_size(), key, _comp());
     }
 
-    iterator& operator-=(difference_type n) noexcept
+    template <class K>
+    size_type _upper_bound(const K& key) const noexcept
     {
-        _key -= n;
-        _val -= n;
+        if constexpr (_learned && std::is_same<K, key_type>::value) {
+            // keys are unique, at most one is equivalent
+            size_type pos = _lower_bound(key);
+            return pos != _sorted_size() && !_comp()(key, _keys[pos]) ? pos + 1 : pos;
+        }
+        const key_compare& comp = _comp();
+        auto not_after = [&comp](const key_type& k, const K& x) { return !comp(x, k); };
+        return flatmap::detail::lower_bound(_keys, _sorted_size(), key, not_after);
     }
 
-    iterator operator+(difference_type n) noexcept
+    // The pending inserts are scanned when the sorted part has no match.
+    template <class K>
+    size_type _find(const K& key) const noexcept
     {
-        *this += n;
-        return *this;
+        size_type sorted = _sorted_size();
+        size_type pos = _lower_bound(key);
+        if (pos == sorted || _comp()(key, _keys[pos])) {
+            if constexpr (_buffered)
+                pos = _find_pending(key);
+            else
+                pos = _size;
+        }
+        _stats().count_lookup(pos != _size, sorted);
+        return pos;
     }
 
-    iterator operator-(difference_type n) noexcept
+    template <class It, class K>
+    std::pair<It, It> _equal_range(const K& key) const noexcept
     {
-        *this += n;
-        return *this;
+        return {_make_iterator(_lower_bound(key)), _make_iterator(_upper_bound(key))};
     }
 
-    difference_type operator-(iterator other) noexcept
+    const key_compare& _comp() const noexcept { return *this; }
+
+    _Index& _index() noexcept { return *this; }
+    const _Index& _index() const noexcept { return *this; }
+
+    // After a bulk change, every position may have moved.
+    void _refit()
     {
-        return _key - other._key;
+        _index().refit(_keys, _sorted_size());
     }
 
-    friend bool operator==(Iterator a, Iterator b) noexcept
+    _Stats& _stats() noexcept { return *this; }
+    const _Stats& _stats() const noexcept { return *this; }
+
+    _Buffer& _buffer() noexcept { return *this; }
+    const _Buffer& _buffer() const noexcept { return *this; }
+
+    // [0, _sorted_size()) is sorted, the pending inserts follow.
+    size_type _sorted_size() const noexcept
     {
-        return a._key == b._key;
+        return _size - _buffer().pending();
     }
 
-    friend bool operator!=(Iterator a, Iterator b) noexcept
+    std::pair<iterator, bool> _insert_direct(const value_type& x)
     {
-        return a._key != b._key;
+        auto it = lower_bound(x.first);
+        if (it != end() && !_comp()(x.first, it->first))
+            return std::make_pair(it, false);
+        size_type pos = it - begin();
+        if (_size == _capacity) {
+            _relocate(_grow_capacity(_size + 1), pos);
+        } else {
+            size_type cnt = _size - pos;
+            std::memmove(_keys + pos + 1, _keys + pos, sizeof(*_keys)*cnt);
+            std::memmove(_vals + pos + 1, _vals + pos, sizeof(*_vals)*cnt);
+            _stats().count_moved(cnt * _element_size);
+        }
+        _keys[pos] = x.first;
+        _vals[pos] = x.second;
+        ++_size;
+        _stats().count_inserts(1, _size);
+        if (_index().drift(1))
+            _refit();
+        return std::make_pair(_make_iterator(pos), true);
     }
 
-    friend bool operator<(Iterator a, Iterator b) noexcept
+    std::pair<iterator, bool> _insert_buffered(const value_type& x)
     {
-        return a._key < b._key;
+        size_type pos = _lower_bound(x.first);
+        if (pos != _sorted_size() && !_comp()(x.first, _keys[pos]))
+            return std::make_pair(_make_iterator(pos), false);
+        pos = _find_pending(x.first);
+        if (pos != _size)
+            return std::make_pair(_make_iterator(pos), false);
+
+        if (_size == _capacity)
+            _relocate(_grow_capacity(_size + 1));
+        _keys[_size] = x.first;
+        _vals[_size] = x.second;
+        ++_size;
+        _stats().count_inserts(1, _size);
+        if (++_buffer()._pending < _max_pending)
+            return std::make_pair(_make_iterator(_size - 1), true);
+        flush();
+        return std::make_pair(_make_iterator(_lower_bound(x.first)), true);
     }
 
-    friend bool operator>(Iterator a, Iterator b) noexcept
+    template <class K>
+    size_type _find_pending(const K& key) const noexcept
     {
-        return a._key > b._key;
+        size_type sorted = _sorted_size();
+        const key_type* pending = _keys + sorted;
+        size_type n = _buffer().pending();
+        if constexpr (flatmap::detail::is_simd_searchable_v<key_type, K, key_compare>) {
+            return sorted + flatmap::detail::find_equal(pending, n, key);
+        } else {
+            const key_compare& comp = _comp();
+            for (size_type i = 0; i != n; ++i) {
+                if (!comp(key, pending[i]) && !comp(pending[i], key))
+                    return sorted + i;
+            }
+            return _size;
+        }
     }
 
-    friend bool operator<=(Iterator a, Iterator b) noexcept
+    // Merges the pending inserts before anything that needs the whole map
+    // sorted.
+    void _sync() noexcept
     {
-        return a._key <= b._key;
+        if constexpr (_buffered) {
+            if (_buffer().pending() != 0 && _flush())
+                _index().refit_in_place(_keys, _size);
+        }
     }
 
-    friend bool operator>=(Iterator a, Iterator b) noexcept
+    // The const overloads that need the whole map sorted don't merge, two
+    // threads may read the same map.
+    void _assert_flushed() const noexcept
     {
-        return a._key >= b._key;
+        assert(_buffer().pending() == 0 && "call flush() first");
     }
 
-private:
-    const key_type* _key;
-    mapped_type*    _val;
+    // Sorts the pending inserts aside, on the stack, and merges them with
+    // the sorted part from the back. Returns true when the search index
+    // asks for a refit.
+    bool _flush() noexcept
+    {
+        size_type n = _buffer().pending();
+        size_type sorted = _size - n;
+        alignas(key_type) unsigned char key_bytes[sizeof(key_type) * _max_pending];
+        alignas(mapped_type) unsigned char val_bytes[sizeof(mapped_type) * _max_pending];
+        key_type* keys = reinterpret_cast<key_type*>(key_bytes);
+        mapped_type* vals = reinterpret_cast<mapped_type*>(val_bytes);
+        std::memcpy(keys, _keys + sorted, sizeof(*_keys)*n);
+        std::memcpy(vals, _vals + sorted, sizeof(*_vals)*n);
+
+        const key_compare& comp = _comp();
+        unsigned short order[_max_pending];
+        for (size_type i = 0; i != n; ++i)
+            order[i] = static_cast<unsigned short>(i);
+        std::sort(order, order + n, [&](unsigned short a, unsigned short b) { return comp(keys[a], keys[b]); });
+
+        // pending keys are never in the sorted part, no equal keys here
+        size_type i = sorted, j = n, out = _size;
+        while (j != 0) {
+            --out;
+            size_type k = order[j - 1];
+            if (i != 0 && comp(keys[k], _keys[i - 1])) {
+                --i;
+                _keys[out] = _keys[i];
+                _vals[out] = _vals[i];
+            } else {
+                --j;
+                _keys[out] = keys[k];
+                _vals[out] = vals[k];
+            }
+        }
+        _buffer()._pending = 0;
+        _stats().count_moved((_size - i) * _element_size);
+        return _index().drift(n);
+    }
+
+    iterator _make_iterator(size_type pos) const noexcept
+    {
+        return iterator{_keys + pos, _vals + pos};
+    }
+
+    // TODO: use u32 for size and capacity?
+    key_type*    _keys = nullptr;
+    mapped_type* _vals = nullptr;
+    size_type    _size = 0;
+    size_type    _capacity = 0;
 };
 
 namespace std {
 
-template <class Key, class T, class Compare>
-void swap(FlatMap<Key, T, Compare>& x, FlatMap<Key, T, Compare>& y) noexcept
+template <class Key, class T, class Compare, class... Policies>
+void swap(FlatMap<Key, T, Compare, Policies...>& x, FlatMap<Key, T, Compare, Policies...>& y) noexcept
 {
     x.swap(y);
 }
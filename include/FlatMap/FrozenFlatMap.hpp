@@ -0,0 +1,384 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "detail/Search.hpp"
+#include "detail/SplitIterator.hpp"
+
+
+// Read-only sorted map in Eytzinger (BFS) order: the root of the implicit
+// binary search tree is at index 1 and the children of `k` at `2k` and `2k+1`.
+// A search walks down the tree without branching on the comparison, and the
+// keys of the next levels sit next to each other so they can be prefetched
+// several steps ahead. Meant for maps built once and then only read, see
+// freeze() below. Iteration visits the tree in order, ie. sorted by key.
+template <
+    typename _Key,
+    typename _T,
+    typename _Compare = std::less<_Key>
+>
+class FrozenFlatMap
+    : private _Compare
+{
+    static_assert(std::is_trivially_copyable<_Key>::value,
+            "FrozenFlatMap key type must be Trivially Copyable");
+    static_assert(std::is_trivially_copyable<_T>::value,
+            "FrozenFlatMap mapped type must be Trivially Copyable");
+
+    struct Iterator;
+
+public:
+    using key_compare = _Compare;
+    using key_type = _Key;
+    using mapped_type = _T;
+    using value_type = std::pair<key_type, mapped_type>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = Iterator;
+    using const_iterator = Iterator;
+    using reference = std::pair<const key_type&, const mapped_type&>;
+    using const_reference = reference;
+    using pointer = flatmap::detail::PairPtr<reference>;
+    using const_pointer = pointer;
+
+    FrozenFlatMap(const key_compare& comp = key_compare()) noexcept
+        : _Compare{comp} {}
+
+    // [first, last) must be sorted by `comp`, as any map's iteration is.
+    // Equivalent keys are kept, lookups find the first one.
+    template <class InputIt>
+    FrozenFlatMap(InputIt first, InputIt last, const key_compare& comp = key_compare())
+        : _Compare{comp}
+    {
+        _allocate(static_cast<size_type>(std::distance(first, last)));
+        _fill(first, 1);
+    }
+
+    FrozenFlatMap(const FrozenFlatMap& other)
+        : _Compare{other.key_comp()}
+    {
+        _allocate(other._size);
+        if (_size != 0) {
+            std::memcpy(_keys, other._keys, sizeof(*_keys)*(_size + 1));
+            std::memcpy(_vals, other._vals, sizeof(*_vals)*(_size + 1));
+        }
+    }
+
+    FrozenFlatMap(FrozenFlatMap&& other) noexcept
+        : _Compare{other.key_comp()}
+    {
+        swap(other);
+    }
+
+    FrozenFlatMap& operator=(const FrozenFlatMap& other)
+    {
+        if (this != &other) {
+            FrozenFlatMap tmp{other};
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    FrozenFlatMap& operator=(FrozenFlatMap&& other) noexcept
+    {
+        FrozenFlatMap tmp{std::move(other)};
+        swap(tmp);
+        return *this;
+    }
+
+    ~FrozenFlatMap() noexcept
+    {
+        _deallocate(_keys, _size);
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator{this, _leftmost(1)};
+    }
+
+    const_iterator cbegin() const noexcept
+    {
+        return begin();
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator{this, 0};
+    }
+
+    const_iterator cend() const noexcept
+    {
+        return end();
+    }
+
+    constexpr bool empty() const noexcept
+    {
+        return _size == 0u;
+    }
+
+    constexpr size_type size() const noexcept
+    {
+        return _size;
+    }
+
+    const_iterator find(const key_type& key) const noexcept
+    {
+        size_type k = _lower_bound(key);
+        return k != 0 && !_comp()(key, _keys[k]) ? const_iterator{this, k} : end();
+    }
+
+    const_iterator lower_bound(const key_type& key) const noexcept
+    {
+        return const_iterator{this, _lower_bound(key)};
+    }
+
+    const_iterator upper_bound(const key_type& key) const noexcept
+    {
+        const key_compare& comp = _comp();
+        return const_iterator{this, _descend([&](const key_type& k) { return !comp(key, k); })};
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const noexcept
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    size_type count(const key_type& key) const noexcept
+    {
+        auto range = equal_range(key);
+        size_type n = 0;
+        for (auto it = range.first; it != range.second; ++it)
+            ++n;
+        return n;
+    }
+
+    bool contains(const key_type& key) const noexcept
+    {
+        return find(key) != end();
+    }
+
+    void swap(FrozenFlatMap& other) noexcept(std::is_nothrow_swappable<_Compare>::value)
+    {
+        std::swap(_keys, other._keys);
+        std::swap(_vals, other._vals);
+        std::swap(_size, other._size);
+        std::swap(static_cast<_Compare&>(*this), static_cast<_Compare&>(other));
+    }
+
+    constexpr key_compare key_comp() const noexcept { return *this; }
+
+private:
+    // Tree nodes 1..size, slot 0 is unused so the children arithmetic stays
+    // simple. The key array is cache line aligned, the 64 / sizeof(key) nodes
+    // `log2(64 / sizeof(key))` levels below a node then share a line.
+    static constexpr std::size_t _align = 64;
+    static constexpr std::size_t _block = sizeof(key_type) < _align ? _align / sizeof(key_type) : 1;
+
+    static constexpr std::size_t _vals_offset(size_type size) noexcept
+    {
+        std::size_t bytes = (size + 1) * sizeof(key_type);
+        return (bytes + alignof(mapped_type) - 1) & ~(alignof(mapped_type) - 1);
+    }
+
+    static constexpr std::size_t _bytes(size_type size) noexcept
+    {
+        return _vals_offset(size) + (size + 1) * sizeof(mapped_type);
+    }
+
+    static void _deallocate(key_type* keys, size_type size) noexcept
+    {
+        if (keys == nullptr)
+            return;
+        ::operator delete(static_cast<void*>(keys), _bytes(size), std::align_val_t{_align});
+    }
+
+    void _allocate(size_type size)
+    {
+        if (size == 0)
+            return;
+        void* block = ::operator new(_bytes(size), std::align_val_t{_align});
+        _keys = static_cast<key_type*>(block);
+        _vals = reinterpret_cast<mapped_type*>(static_cast<char*>(block) + _vals_offset(size));
+        _size = size;
+    }
+
+    // In-order walk of the implicit tree, hands out the sorted input.
+    template <class InputIt>
+    InputIt _fill(InputIt it, size_type k)
+    {
+        if (k > _size)
+            return it;
+        it = _fill(it, 2 * k);
+        const auto& kv = *it;
+        _keys[k] = kv.first;
+        _vals[k] = kv.second;
+        return _fill(++it, 2 * k + 1);
+    }
+
+    // Walks down while `goes_right(node)` and returns the last node the walk
+    // turned left at, 0 when it never did.
+    template <class _Pred>
+    size_type _descend(_Pred goes_right) const noexcept
+    {
+        size_type k = 1;
+        while (k <= _size) {
+            FLATMAP_PREFETCH(_keys + k * _block);
+            k = 2 * k + (goes_right(_keys[k]) ? 1 : 0);
+        }
+        // the trailing ones are the right turns taken after the last left one
+        return k >> (_trailing_ones(k) + 1);
+    }
+
+    size_type _lower_bound(const key_type& key) const noexcept
+    {
+        const key_compare& comp = _comp();
+        return _descend([&](const key_type& k) { return comp(k, key); });
+    }
+
+    static unsigned _trailing_ones(size_type k) noexcept
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned>(__builtin_ctzll(~static_cast<unsigned long long>(k)));
+#else
+        unsigned n = 0;
+        for (; k & 1; k >>= 1)
+            ++n;
+        return n;
+#endif
+    }
+
+    size_type _leftmost(size_type k) const noexcept
+    {
+        if (k > _size)
+            return 0;
+        while (2 * k <= _size)
+            k = 2 * k;
+        return k;
+    }
+
+    size_type _rightmost(size_type k) const noexcept
+    {
+        if (k > _size)
+            return 0;
+        while (2 * k + 1 <= _size)
+            k = 2 * k + 1;
+        return k;
+    }
+
+    // In-order successor, 0 past the largest key.
+    size_type _next(size_type k) const noexcept
+    {
+        if (2 * k + 1 <= _size)
+            return _leftmost(2 * k + 1);
+        return k >> (_trailing_ones(k) + 1);
+    }
+
+    // In-order predecessor, the largest key when coming from end().
+    size_type _prev(size_type k) const noexcept
+    {
+        if (k == 0)
+            return _rightmost(1);
+        if (2 * k <= _size)
+            return _rightmost(2 * k);
+        // climb while being a left child
+        while (k != 0 && (k & 1) == 0)
+            k >>= 1;
+        return k >> 1;
+    }
+
+    const key_compare& _comp() const noexcept { return *this; }
+
+    key_type*    _keys = nullptr;
+    mapped_type* _vals = nullptr;
+    size_type    _size = 0;
+};
+
+// Bidirectional, walks the tree in order. Node 0 is end().
+template <typename Key, typename T, typename Compare>
+struct FrozenFlatMap<Key, T, Compare>::Iterator {
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = FrozenFlatMap::value_type;
+    using difference_type = FrozenFlatMap::difference_type;
+    using reference = FrozenFlatMap::reference;
+    using pointer = FrozenFlatMap::pointer;
+
+    constexpr Iterator() noexcept = default;
+    constexpr Iterator(const FrozenFlatMap* map, size_type node) noexcept
+        : _map{map}, _node{node}
+    {}
+
+    reference operator*() const noexcept
+    {
+        return reference{_map->_keys[_node], _map->_vals[_node]};
+    }
+
+    pointer operator->() const noexcept
+    {
+        return pointer{**this};
+    }
+
+    Iterator& operator++() noexcept
+    {
+        _node = _map->_next(_node);
+        return *this;
+    }
+
+    Iterator operator++(int) noexcept
+    {
+        Iterator tmp{*this};
+        ++(*this);
+        return tmp;
+    }
+
+    Iterator& operator--() noexcept
+    {
+        _node = _map->_prev(_node);
+        return *this;
+    }
+
+    Iterator operator--(int) noexcept
+    {
+        Iterator tmp{*this};
+        --(*this);
+        return tmp;
+    }
+
+    friend bool operator==(Iterator a, Iterator b) noexcept
+    {
+        return a._node == b._node;
+    }
+
+    friend bool operator!=(Iterator a, Iterator b) noexcept
+    {
+        return a._node != b._node;
+    }
+
+private:
+    const FrozenFlatMap* _map = nullptr;
+    size_type            _node = 0;
+};
+
+// Snapshot of any sorted map (StaticFlatMap, FlatMap, std::map, ...) in
+// Eytzinger order.
+template <class Map>
+FrozenFlatMap<typename Map::key_type, typename Map::mapped_type, typename Map::key_compare>
+freeze(const Map& map)
+{
+    return {map.begin(), map.end(), map.key_comp()};
+}
+
+namespace std {
+
+template <class Key, class T, class Compare>
+void swap(FrozenFlatMap<Key, T, Compare>& x, FrozenFlatMap<Key, T, Compare>& y) noexcept
+{
+    x.swap(y);
+}
+
+} // ~std
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "detail/Error.hpp"
+#include "detail/Search.hpp"
+#include "detail/SplitIterator.hpp"
+
+
+// On-disk format of a sorted map and a read-only view searching it in place.
+//
+//     flatmap::save(map, "routes.fm");          // any sorted map
+//     MappedFlatMap<std::uint32_t, Route> routes{"routes.fm"};
+//     auto it = routes.find(addr);
+//
+// The file is the split layout of FlatMap written as is: a header, the key
+// array and the value array, both starting on a cache line. Opening it is one
+// mmap() and a header check, the pages are loaded on first touch and shared
+// through the page cache by every process mapping the same file.
+//
+// Keys and values are copied byte for byte, so they must be Trivially
+// Copyable and hold no pointers. The file records the key and value sizes and
+// the byte order of the writer, a reader with a different one refuses it. The
+// comparator is not recorded, the reader must use the one the map was sorted
+// with.
+namespace flatmap {
+
+namespace detail {
+
+struct MappedHeader {
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;   // kMappedByteOrder as stored by the writer
+    std::uint64_t count;
+    std::uint32_t key_size;
+    std::uint32_t value_size;
+    std::uint64_t keys_offset;
+    std::uint64_t values_offset;
+};
+
+static_assert(sizeof(MappedHeader) == 48, "MappedHeader must not have padding");
+
+constexpr char          kMappedMagic[8] = {'F', 'L', 'A', 'T', 'M', 'A', 'P', '\0'};
+constexpr std::uint32_t kMappedVersion = 1;
+constexpr std::uint32_t kMappedByteOrder = 0x01020304;
+constexpr std::uint64_t kMappedAlign = 64;
+
+constexpr std::uint64_t mapped_align(std::uint64_t offset) noexcept
+{
+    return (offset + kMappedAlign - 1) & ~(kMappedAlign - 1);
+}
+
+inline std::string errno_message(const std::string& path)
+{
+    return path + ": " + std::strerror(errno);
+}
+
+} // ~detail
+
+// Writes `map` to `path` in the MappedFlatMap format, `map` is anything
+// iterating sorted key / value pairs. The file is written next to `path` as
+// `path`.tmp, synced, then renamed over `path`: processes that have the old
+// file mapped keep reading it, and a failed write leaves it in place.
+template <class Map>
+void save(const Map& map, const std::string& path)
+{
+    using key_type = typename Map::key_type;
+    using mapped_type = typename Map::mapped_type;
+    static_assert(std::is_trivially_copyable<key_type>::value,
+            "saved key type must be Trivially Copyable");
+    static_assert(std::is_trivially_copyable<mapped_type>::value,
+            "saved mapped type must be Trivially Copyable");
+
+    detail::MappedHeader header{};
+    std::memcpy(header.magic, detail::kMappedMagic, sizeof(header.magic));
+    header.version = detail::kMappedVersion;
+    header.byte_order = detail::kMappedByteOrder;
+    header.count = static_cast<std::uint64_t>(std::distance(map.begin(), map.end()));
+    header.key_size = sizeof(key_type);
+    header.value_size = sizeof(mapped_type);
+    header.keys_offset = detail::mapped_align(sizeof(header));
+    header.values_offset = detail::mapped_align(header.keys_offset + header.count * sizeof(key_type));
+
+    const std::string tmp_path = path + ".tmp";
+    std::FILE* file = std::fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr)
+        detail::throw_runtime_error(__PRETTY_FUNCTION__, detail::errno_message(tmp_path));
+
+    static const char zeros[detail::kMappedAlign] = {};
+    std::uint64_t offset = 0;
+    auto write = [&](const void* data, std::size_t size) {
+        offset += size;
+        return std::fwrite(data, 1, size, file) == size;
+    };
+    auto pad_to = [&](std::uint64_t target) {
+        return write(zeros, static_cast<std::size_t>(target - offset));
+    };
+
+    bool ok = write(&header, sizeof(header)) && pad_to(header.keys_offset);
+    for (auto it = map.begin(); ok && it != map.end(); ++it) {
+        const key_type& key = it->first;
+        ok = write(&key, sizeof(key));
+    }
+    ok = ok && pad_to(header.values_offset);
+    for (auto it = map.begin(); ok && it != map.end(); ++it) {
+        const mapped_type& value = it->second;
+        ok = write(&value, sizeof(value));
+    }
+    ok = ok && std::fflush(file) == 0 && ::fsync(::fileno(file)) == 0;
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::string error = detail::errno_message(ok ? path : tmp_path);
+        std::remove(tmp_path.c_str());
+        detail::throw_runtime_error(__PRETTY_FUNCTION__, error);
+    }
+}
+
+} // ~flatmap
+
+// Read-only map over a file written by flatmap::save(). Searches run directly
+// on the mapping, with the same search code as FlatMap. Move only, the
+// mapping lives as long as the object.
+template <
+    typename _Key,
+    typename _T,
+    typename _Compare = std::less<_Key>
+>
+class MappedFlatMap
+    : private _Compare
+{
+    static_assert(std::is_trivially_copyable<_Key>::value,
+            "MappedFlatMap key type must be Trivially Copyable");
+    static_assert(std::is_trivially_copyable<_T>::value,
+            "MappedFlatMap mapped type must be Trivially Copyable");
+
+public:
+    using key_compare = _Compare;
+    using key_type = _Key;
+    using mapped_type = _T;
+    using value_type = std::pair<key_type, mapped_type>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = flatmap::detail::SplitIterator<key_type, mapped_type, true>;
+    using const_iterator = iterator;
+    using reference = typename iterator::reference;
+    using const_reference = reference;
+    using pointer = typename iterator::pointer;
+    using const_pointer = pointer;
+
+    MappedFlatMap(const key_compare& comp = key_compare()) noexcept
+        : _Compare{comp} {}
+
+    explicit MappedFlatMap(const std::string& path, const key_compare& comp = key_compare())
+        : _Compare{comp}
+    {
+        _map_file(path);
+    }
+
+    MappedFlatMap(const MappedFlatMap&) = delete;
+    MappedFlatMap& operator=(const MappedFlatMap&) = delete;
+
+    MappedFlatMap(MappedFlatMap&& other) noexcept
+        : _Compare{other.key_comp()}
+    {
+        swap(other);
+    }
+
+    MappedFlatMap& operator=(MappedFlatMap&& other) noexcept
+    {
+        MappedFlatMap tmp{std::move(other)};
+        swap(tmp);
+        return *this;
+    }
+
+    ~MappedFlatMap() noexcept
+    {
+        if (_mapping != nullptr)
+            ::munmap(_mapping, _mapping_size);
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator{_keys, _vals};
+    }
+
+    const_iterator cbegin() const noexcept
+    {
+        return begin();
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator{_keys + _size, _vals + _size};
+    }
+
+    const_iterator cend() const noexcept
+    {
+        return end();
+    }
+
+    constexpr bool empty() const noexcept
+    {
+        return _size == 0u;
+    }
+
+    constexpr size_type size() const noexcept
+    {
+        return _size;
+    }
+
+    const_iterator find(const key_type& key) const noexcept
+    {
+        size_type pos = _lower_bound(key);
+        return pos != _size && !_comp()(key, _keys[pos]) ? _make_iterator(pos) : end();
+    }
+
+    const_iterator lower_bound(const key_type& key) const noexcept
+    {
+        return _make_iterator(_lower_bound(key));
+    }
+
+    const_iterator upper_bound(const key_type& key) const noexcept
+    {
+        const key_compare& comp = _comp();
+        auto not_after = [&comp](const key_type& k, const key_type& x) { return !comp(x, k); };
+        return _make_iterator(flatmap::detail::lower_bound(_keys, _size, key, not_after));
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const noexcept
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    size_type count(const key_type& key) const noexcept
+    {
+        auto range = equal_range(key);
+        return static_cast<size_type>(range.second - range.first);
+    }
+
+    bool contains(const key_type& key) const noexcept
+    {
+        return find(key) != end();
+    }
+
+    void swap(MappedFlatMap& other) noexcept(std::is_nothrow_swappable<_Compare>::value)
+    {
+        std::swap(_mapping, other._mapping);
+        std::swap(_mapping_size, other._mapping_size);
+        std::swap(_keys, other._keys);
+        std::swap(_vals, other._vals);
+        std::swap(_size, other._size);
+        std::swap(static_cast<_Compare&>(*this), static_cast<_Compare&>(other));
+    }
+
+    constexpr key_compare key_comp() const noexcept { return *this; }
+
+private:
+    void _map_file(const std::string& path)
+    {
+        namespace detail = flatmap::detail;
+
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            detail::throw_runtime_error(__PRETTY_FUNCTION__, detail::errno_message(path));
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            int err = errno;
+            ::close(fd);
+            errno = err;
+            detail::throw_runtime_error(__PRETTY_FUNCTION__, detail::errno_message(path));
+        }
+        std::uint64_t file_size = static_cast<std::uint64_t>(st.st_size);
+        if (file_size < sizeof(detail::MappedHeader)) {
+            ::close(fd);
+            detail::throw_runtime_error(__PRETTY_FUNCTION__, path + ": not a flat map file");
+        }
+        void* mapping = ::mmap(nullptr, static_cast<std::size_t>(file_size), PROT_READ, MAP_SHARED, fd, 0);
+        int err = errno;
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            errno = err;
+            detail::throw_runtime_error(__PRETTY_FUNCTION__, detail::errno_message(path));
+        }
+        _mapping = mapping;
+        _mapping_size = static_cast<std::size_t>(file_size);
+
+        const char* error = _check_header(file_size);
+        if (error != nullptr) {
+            ::munmap(_mapping, _mapping_size);
+            _mapping = nullptr;
+            detail::throw_runtime_error(__PRETTY_FUNCTION__, path + ": " + error);
+        }
+    }
+
+    // nullptr when the mapping holds a map of this type.
+    const char* _check_header(std::uint64_t file_size) noexcept
+    {
+        namespace detail = flatmap::detail;
+
+        detail::MappedHeader header;
+        std::memcpy(&header, _mapping, sizeof(header));
+        if (std::memcmp(header.magic, detail::kMappedMagic, sizeof(header.magic)) != 0)
+            return "not a flat map file";
+        if (header.byte_order != detail::kMappedByteOrder)
+            return "written with another byte order";
+        if (header.version != detail::kMappedVersion)
+            return "unsupported format version";
+        if (header.key_size != sizeof(key_type) || header.value_size != sizeof(mapped_type))
+            return "key or value size mismatch";
+        if (header.keys_offset % alignof(key_type) != 0 || header.values_offset % alignof(mapped_type) != 0 ||
+                header.keys_offset < sizeof(header) ||
+                header.values_offset < header.keys_offset ||
+                header.values_offset > file_size ||
+                // sizes compared by subtraction, the offsets come from the file and can wrap
+                header.count > (header.values_offset - header.keys_offset) / sizeof(key_type) ||
+                header.count > (file_size - header.values_offset) / sizeof(mapped_type))
+            return "truncated or corrupt";
+
+        const char* base = static_cast<const char*>(_mapping);
+        _keys = reinterpret_cast<const key_type*>(base + header.keys_offset);
+        _vals = reinterpret_cast<const mapped_type*>(base + header.values_offset);
+        _size = static_cast<size_type>(header.count);
+        return nullptr;
+    }
+
+    size_type _lower_bound(const key_type& key) const noexcept
+    {
+        return flatmap::detail::lower_bound(_keys, _size, key, _comp());
+    }
+
+    const key_compare& _comp() const noexcept { return *this; }
+
+    const_iterator _make_iterator(size_type pos) const noexcept
+    {
+        return const_iterator{_keys + pos, _vals + pos};
+    }
+
+    void*              _mapping = nullptr;
+    std::size_t        _mapping_size = 0;
+    const key_type*    _keys = nullptr;
+    const mapped_type* _vals = nullptr;
+    size_type          _size = 0;
+};
+
+namespace std {
+
+template <class Key, class T, class Compare>
+void swap(MappedFlatMap<Key, T, Compare>& x, MappedFlatMap<Key, T, Compare>& y) noexcept
+{
+    x.swap(y);
+}
+
+} // ~std
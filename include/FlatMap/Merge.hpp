@@ -0,0 +1,75 @@
+#pragma once
+
+#include <utility>
+
+
+// Combining two sorted maps in one linear pass: the merge() members and the
+// map_union / map_intersection / map_difference free functions of FlatMap and
+// StaticFlatMap. When a key is in both maps the value kept is picked by a
+// conflict resolver, any callable
+//
+//     mapped_type resolve(const key_type& key, const mapped_type& left, const mapped_type& right);
+//
+// where `left` comes from the map merged into (or the first argument) and
+// `right` from the other one. Equivalent keys repeating in a multimap are
+// paired up in order, as std::set_union and friends do.
+namespace flatmap {
+
+// The value already there / of the first map wins, the default.
+struct KeepLeft {
+    template <class _Key, class _T>
+    constexpr const _T& operator()(const _Key&, const _T& left, const _T&) const noexcept
+    {
+        return left;
+    }
+};
+
+// The incoming value / the one of the second map wins.
+struct KeepRight {
+    template <class _Key, class _T>
+    constexpr const _T& operator()(const _Key&, const _T&, const _T& right) const noexcept
+    {
+        return right;
+    }
+};
+
+namespace detail {
+
+// Walks two sorted ranges of key / value pairs side by side and calls
+// emit(key, value) for, in key order: the keys only in the first range
+// (_Left), only in the second one (_Right) and in both (_Both, the value
+// resolved).
+template <bool _Left, bool _Right, bool _Both,
+          class _It1, class _It2, class _Compare, class _Resolve, class _Emit>
+void merge_by_key(_It1 first1, _It1 last1, _It2 first2, _It2 last2,
+                  const _Compare& comp, _Resolve& resolve, _Emit&& emit)
+{
+    while (first1 != last1 && first2 != last2) {
+        if (comp(first1->first, first2->first)) {
+            if (_Left)
+                emit(first1->first, first1->second);
+            ++first1;
+        } else if (comp(first2->first, first1->first)) {
+            if (_Right)
+                emit(first2->first, first2->second);
+            ++first2;
+        } else {
+            if (_Both)
+                emit(first1->first, resolve(first1->first, first1->second, first2->second));
+            ++first1;
+            ++first2;
+        }
+    }
+    if (_Left) {
+        for (; first1 != last1; ++first1)
+            emit(first1->first, first1->second);
+    }
+    if (_Right) {
+        for (; first2 != last2; ++first2)
+            emit(first2->first, first2->second);
+    }
+}
+
+} // ~detail
+
+} // ~flatmap
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+
+// Optional behaviours of the maps are selected by appending policies to the
+// template arguments, in any order:
+//
+//     StaticFlatMap<int, Big, 256, std::less<int>, flatmap::SplitLayout> m;
+//
+// Every policy belongs to exactly one category, a category that is not given
+// falls back to its default.
+namespace flatmap {
+
+namespace detail {
+
+struct layout_policy_tag {};
+struct key_policy_tag {};
+struct search_policy_tag {};
+struct insert_policy_tag {};
+struct stats_policy_tag {};
+struct filter_policy_tag {};
+struct cache_policy_tag {};
+
+template <class _Policy, class _Tag, class = void>
+struct is_policy_of : std::false_type {};
+
+template <class _Policy, class _Tag>
+struct is_policy_of<_Policy, _Tag, std::void_t<typename _Policy::policy_category>>
+    : std::is_same<typename _Policy::policy_category, _Tag> {};
+
+template <class _Tag, class _Default, class... _Policies>
+struct select_policy {
+    using type = _Default;
+};
+
+template <class _Tag, class _Default, class _First, class... _Rest>
+struct select_policy<_Tag, _Default, _First, _Rest...>
+    : std::conditional_t<is_policy_of<_First, _Tag>::value,
+        select_policy<_Tag, _First>,
+        select_policy<_Tag, _Default, _Rest...>> {};
+
+template <class _Tag, class _Default, class... _Policies>
+using select_policy_t = typename select_policy<_Tag, _Default, _Policies...>::type;
+
+template <class _Policy, class = void>
+struct is_policy : std::false_type {};
+
+template <class _Policy>
+struct is_policy<_Policy, std::void_t<typename _Policy::policy_category>> : std::true_type {};
+
+template <class... _Policies>
+constexpr bool are_policies_v = (is_policy<_Policies>::value && ...);
+
+} // ~detail
+
+// -----------------------------------------------------------------------------
+// Storage layout (StaticFlatMap)
+//
+
+// One array of std::pair<Key, Value>, the default. Iterators are plain
+// pointers to the pairs.
+struct PairLayout {
+    using policy_category = detail::layout_policy_tag;
+};
+
+// A key array and a parallel value array. Searches only touch the keys,
+// iterators are proxies dereferencing to std::pair<const Key&, Value&>.
+struct SplitLayout {
+    using policy_category = detail::layout_policy_tag;
+};
+
+// -----------------------------------------------------------------------------
+// Key uniqueness (StaticFlatMap)
+//
+
+// Equivalent keys may repeat, they are kept in insertion order. The default.
+struct MultiKeys {
+    using policy_category = detail::key_policy_tag;
+};
+
+// At most one element per key. Insert() returns std::pair<iterator, bool> and
+// leaves the map untouched when the key is already there.
+struct UniqueKeys {
+    using policy_category = detail::key_policy_tag;
+};
+
+// -----------------------------------------------------------------------------
+// Search (FlatMap)
+//
+
+// Binary search picked off the size, see detail/Search.hpp. The default.
+struct BinarySearch {
+    using policy_category = detail::search_policy_tag;
+};
+
+// Learned index for arithmetic keys ordered by std::less: a piecewise linear
+// model of the key positions, fitted whenever the map is rebuilt in bulk,
+// predicts where a key is and only the few keys around the prediction are
+// searched. Pays off on big maps of evenly spread keys, see
+// detail/LearnedIndex.hpp. Costs about 0.5 byte per element.
+struct LearnedSearch {
+    using policy_category = detail::search_policy_tag;
+};
+
+// -----------------------------------------------------------------------------
+// Inserts (StaticFlatMap, FlatMap)
+//
+
+// Every insert moves the tail of the arrays to open a hole. The default.
+struct DirectInsert {
+    using policy_category = detail::insert_policy_tag;
+    static constexpr std::size_t buffer = 0;
+};
+
+// Single inserts are appended to an unsorted buffer at the end of the arrays,
+// which lookups scan (SIMD) and which is sorted and merged in once `_Buffer`
+// elements are waiting, or before the map is walked in order: begin(),
+// lower_bound() and friends, bulk operations. Bursts of inserts then move
+// each element about once instead of half the map each time. Only non-const
+// calls merge: const find(), count() and contains() scan the buffer too, the
+// const begin(), lower_bound() and friends need flush() first (asserted).
+// A StaticFlatMap multimap merges the buffer after the equal keys already
+// there, in insertion order, as direct inserts would have placed them.
+template <std::size_t _Buffer = 64>
+struct BufferedInsert {
+    using policy_category = detail::insert_policy_tag;
+    static constexpr std::size_t buffer = _Buffer;
+};
+
+// -----------------------------------------------------------------------------
+// Statistics (StaticFlatMap, FlatMap)
+//
+
+// No counters, nothing stored nor computed. The default.
+struct NoStats {
+    using policy_category = detail::stats_policy_tag;
+    static constexpr bool enabled = false;
+};
+
+// Counts lookups and their hits, search steps, inserts, erases, the bytes
+// shifted around and the peak size, read with stats() as a flatmap::MapStats
+// (see Stats.hpp). A few integer adds per operation, 72 more bytes per map.
+// Not for maps read by several threads at once: lookups update the counters.
+struct CollectStats {
+    using policy_category = detail::stats_policy_tag;
+    static constexpr bool enabled = true;
+};
+
+// -----------------------------------------------------------------------------
+// Negative lookup filter (StaticFlatMap)
+//
+
+// Every lookup searches the keys. The default.
+struct NoFilter {
+    using policy_category = detail::filter_policy_tag;
+    static constexpr std::size_t bits_per_key = 0;
+};
+
+// A blocked Bloom filter sized for the capacity, `_BitsPerKey` bits per key,
+// answers first: most keys that are not in the map are turned away after one
+// cache line, without a search (see detail/BloomFilter.hpp). For integral
+// keys ordered by std::less or std::greater. Inserts set the bits of their
+// key, erases leave them and the filter is rebuilt once there are more
+// erased keys than live ones. Keys that are found pay for the check as well:
+// for lookups that miss often.
+template <std::size_t _BitsPerKey = 8>
+struct BloomFilter {
+    using policy_category = detail::filter_policy_tag;
+    static constexpr std::size_t bits_per_key = _BitsPerKey;
+};
+
+// -----------------------------------------------------------------------------
+// Hot key cache (StaticFlatMap)
+//
+
+// Every lookup searches the keys. The default.
+struct NoCache {
+    using policy_category = detail::cache_policy_tag;
+    static constexpr std::size_t sets = 0;
+};
+
+// Keeps the positions of the keys found last in a small 2-way cache, `_Sets`
+// sets of 2, checked before the search: under skewed lookups (a few keys asked
+// for most of the time) those keys are found with one compare. Every change
+// that moves elements (Insert, Erase, operator[] inserting, Clear, merges)
+// drops the whole cache through a generation counter. For integral keys
+// ordered by std::less or std::greater, see detail/HotKeyCache.hpp.
+template <std::size_t _Sets = 16>
+struct HotKeyCache {
+    using policy_category = detail::cache_policy_tag;
+    static constexpr std::size_t sets = _Sets;
+};
+
+} // ~flatmap
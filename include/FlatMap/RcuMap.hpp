@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "detail/Config.hpp"
+#include "detail/Error.hpp"
+
+
+// Read-mostly wrapper publishing immutable snapshots of any map (FlatMap,
+// StaticFlatMap, FrozenFlatMap, ...), read-copy-update style. Readers look
+// up the current snapshot without locks, writers build the next snapshot
+// aside and swap it in atomically.
+//
+// Each reader thread takes a Reader handle. A read writes the handle's own
+// cache line only (the epoch it started in), so readers never contend with
+// each other and wait for nothing. A replaced snapshot is freed once every
+// reader that may still see it is done, epoch based reclamation:
+//
+//     RcuMap<FlatMap<int, int>> map;
+//     map.update([](FlatMap<int, int>& m) { m.insert({1, 10}); m.erase(2); });
+//
+//     auto reader = map.reader();            // once per thread
+//     std::optional<int> v = reader.get(1);
+//
+// Writers are serialized. update() copies the current snapshot once for the
+// whole batch of changes, so batch them.
+template <class _Map, std::size_t _MaxReaders = 128>
+class RcuMap {
+public:
+    using map_type = _Map;
+    using key_type = typename _Map::key_type;
+    using mapped_type = typename _Map::mapped_type;
+
+    class Reader;
+    class ReadGuard;
+
+    RcuMap()
+        : RcuMap(map_type{}) {}
+
+    explicit RcuMap(map_type map)
+        : _current{new map_type(std::move(map))} {}
+
+    RcuMap(const RcuMap&) = delete;
+    RcuMap& operator=(const RcuMap&) = delete;
+
+    // No Reader may be in use anymore.
+    ~RcuMap() noexcept
+    {
+        for (auto& retired : _retired)
+            delete retired.first;
+        delete _current.load(std::memory_order_relaxed);
+    }
+
+    // A handle for one thread, up to _MaxReaders at once. Throws
+    // std::range_error when they are all taken.
+    Reader reader()
+    {
+        for (std::size_t i = 0; i != _MaxReaders; ++i) {
+            bool expected = false;
+            if (!_slots[i].taken.load(std::memory_order_relaxed) &&
+                _slots[i].taken.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return Reader{this, &_slots[i]};
+        }
+        flatmap::detail::throw_range_error(__PRETTY_FUNCTION__);
+    }
+
+    // Runs fn(map_type&) on a copy of the current snapshot and publishes it.
+    template <class F>
+    void update(F&& fn)
+    {
+        std::lock_guard<std::mutex> lock{_write};
+        map_type next{*_current.load(std::memory_order_relaxed)};
+        fn(next);
+        _publish(new map_type(std::move(next)));
+    }
+
+    // Replaces the contents as a whole.
+    void store(map_type map)
+    {
+        auto* next = new map_type(std::move(map));
+        std::lock_guard<std::mutex> lock{_write};
+        _publish(next);
+    }
+
+    // A copy of the current snapshot.
+    map_type load() const
+    {
+        std::lock_guard<std::mutex> lock{_write};
+        return *_current.load(std::memory_order_relaxed);
+    }
+
+    // Replaced snapshots some reader may still be using.
+    std::size_t retired() const
+    {
+        std::lock_guard<std::mutex> lock{_write};
+        return _retired.size();
+    }
+
+private:
+    // Epoch a reader is reading in, 0 when it isn't reading.
+    struct alignas(FLATMAP_CACHELINE_SIZE) Slot {
+        std::atomic<std::uint64_t> epoch{0};
+        std::atomic<bool>          taken{false};
+    };
+
+    // Reader: store slot, fence, load snapshot. Writer: swap snapshot, bump
+    // epoch, fence, scan slots. The fences order both sides, so a scan that
+    // misses a reader's slot comes before that reader's snapshot load, which
+    // then sees the new snapshot. A stale epoch read only delays reclamation.
+    const map_type* _enter(Slot* slot) const noexcept
+    {
+        slot->epoch.store(_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return _current.load(std::memory_order_acquire);
+    }
+
+    static void _leave(Slot* slot) noexcept
+    {
+        slot->epoch.store(0, std::memory_order_release);
+    }
+
+    void _publish(const map_type* next)
+    {
+        const map_type* prev = _current.exchange(next, std::memory_order_seq_cst);
+        // readers that start from here on can't get `prev` anymore
+        std::uint64_t epoch = _epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+        _retired.emplace_back(prev, epoch);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        _reclaim();
+    }
+
+    // Frees the snapshots retired at or before the oldest epoch in use.
+    void _reclaim() noexcept
+    {
+        std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+        for (const auto& slot : _slots) {
+            std::uint64_t epoch = slot.epoch.load(std::memory_order_acquire);
+            if (epoch != 0)
+                oldest = std::min(oldest, epoch);
+        }
+        auto last = std::remove_if(_retired.begin(), _retired.end(),
+            [oldest](const std::pair<const map_type*, std::uint64_t>& retired) {
+                if (retired.second > oldest)
+                    return false;
+                delete retired.first;
+                return true;
+            });
+        _retired.erase(last, _retired.end());
+    }
+
+    std::array<Slot, _MaxReaders> _slots;
+    alignas(FLATMAP_CACHELINE_SIZE) std::atomic<const map_type*> _current;
+    std::atomic<std::uint64_t> _epoch{1};
+    alignas(FLATMAP_CACHELINE_SIZE) mutable std::mutex _write;
+    std::vector<std::pair<const map_type*, std::uint64_t>> _retired;
+};
+
+// Access to the current snapshot for one thread at a time. Reads through
+// the same Reader don't nest.
+template <class _Map, std::size_t _MaxReaders>
+class RcuMap<_Map, _MaxReaders>::Reader {
+public:
+    Reader(Reader&& other) noexcept
+        : _map{std::exchange(other._map, nullptr)}, _slot{std::exchange(other._slot, nullptr)}
+    {}
+
+    Reader& operator=(Reader&& other) noexcept
+    {
+        std::swap(_map, other._map);
+        std::swap(_slot, other._slot);
+        return *this;
+    }
+
+    ~Reader() noexcept
+    {
+        if (_slot != nullptr)
+            _slot->taken.store(false, std::memory_order_release);
+    }
+
+    // The snapshot stays alive, and unchanged, as long as the guard.
+    ReadGuard lock() const noexcept
+    {
+        return ReadGuard{_slot, _map->_enter(_slot)};
+    }
+
+    // Runs fn(const map_type&) on the current snapshot.
+    template <class F>
+    decltype(auto) read(F&& fn) const
+    {
+        ReadGuard guard = lock();
+        return fn(*guard);
+    }
+
+    template <class K>
+    std::optional<mapped_type> get(const K& key) const
+    {
+        ReadGuard guard = lock();
+        auto it = guard->find(key);
+        if (it == guard->end())
+            return std::nullopt;
+        return it->second;
+    }
+
+    template <class K>
+    bool contains(const K& key) const
+    {
+        ReadGuard guard = lock();
+        return guard->find(key) != guard->end();
+    }
+
+private:
+    friend class RcuMap;
+
+    Reader(const RcuMap* map, Slot* slot) noexcept
+        : _map{map}, _slot{slot} {}
+
+    const RcuMap* _map;
+    Slot*         _slot;
+};
+
+template <class _Map, std::size_t _MaxReaders>
+class RcuMap<_Map, _MaxReaders>::ReadGuard {
+public:
+    ReadGuard(ReadGuard&& other) noexcept
+        : _slot{std::exchange(other._slot, nullptr)}, _snapshot{other._snapshot}
+    {}
+
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+    ReadGuard& operator=(ReadGuard&&) = delete;
+
+    ~ReadGuard() noexcept
+    {
+        if (_slot != nullptr)
+            RcuMap::_leave(_slot);
+    }
+
+    const map_type& operator*() const noexcept { return *_snapshot; }
+    const map_type* operator->() const noexcept { return _snapshot; }
+
+private:
+    friend class Reader;
+
+    ReadGuard(Slot* slot, const map_type* snapshot) noexcept
+        : _slot{slot}, _snapshot{snapshot} {}
+
+    Slot*           _slot;
+    const map_type* _snapshot;
+};
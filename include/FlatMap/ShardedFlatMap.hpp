@@ -0,0 +1,414 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "FlatMap.hpp"
+#include "Tags.hpp"
+#include "detail/Config.hpp"
+
+
+namespace flatmap {
+
+// Spreads the keys evenly over the shards. The hash is scrambled first,
+// std::hash of integers is the identity and consecutive keys would otherwise
+// land in consecutive shards only by luck of the modulo.
+template <class _Key, class _Hash = std::hash<_Key>>
+struct HashPartition : private _Hash {
+    HashPartition(const _Hash& hash = _Hash()) : _Hash{hash} {}
+
+    std::size_t operator()(const _Key& key, std::size_t shards) const
+    {
+        std::uint64_t h = static_cast<std::uint64_t>(static_cast<const _Hash&>(*this)(key));
+        h *= 0x9E3779B97F4A7C15ull;
+        // multiply-shift range reduction, no division
+        return static_cast<std::size_t>(((h >> 32) * shards) >> 32);
+    }
+};
+
+// Key ranges: shard i holds the keys in [splitters[i-1], splitters[i]), the
+// last one everything from the last splitter on. Keeps related keys together
+// and each shard covers a contiguous slice of the key space.
+template <class _Key, class _Compare = std::less<_Key>>
+struct RangePartition : private _Compare {
+    RangePartition(std::vector<_Key> splitters = {}, const _Compare& comp = _Compare())
+        : _Compare{comp}, _splitters{std::move(splitters)}
+    {
+        std::sort(_splitters.begin(), _splitters.end(), comp);
+    }
+
+    std::size_t operator()(const _Key& key, std::size_t shards) const
+    {
+        auto it = std::upper_bound(_splitters.begin(), _splitters.end(), key,
+                static_cast<const _Compare&>(*this));
+        return std::min(static_cast<std::size_t>(it - _splitters.begin()), shards - 1);
+    }
+
+private:
+    std::vector<_Key> _splitters;
+};
+
+} // ~flatmap
+
+// Keys partitioned over `_Shards` independent FlatMaps, each with its own
+// lock, so writers to different shards do not serialize behind one memmove.
+// Every shard sits on cache lines of its own, lock and map header included,
+// to keep the locks of neighbour shards from false sharing.
+//
+//     ShardedFlatMap<int, int, 16> map;
+//     map.insert(data.begin(), data.end());   // partitioned, shards in parallel
+//     map.insert({5, 50});
+//     std::optional<int> v = map.get(5);
+//     map.for_each([](int key, int value) { ... });   // in key order
+//
+// The shard of a key is `_Partition{}(key, _Shards)`, see HashPartition and
+// RangePartition above. Lookups return copies: an iterator into a shard would
+// not survive a concurrent write. with_shard() runs code on the shard of a
+// key under its lock for anything more involved.
+template <
+    typename _Key,
+    typename _T,
+    std::size_t _Shards,
+    typename _Compare = std::less<_Key>,
+    typename _Partition = flatmap::HashPartition<_Key>
+>
+class ShardedFlatMap
+{
+    static_assert(_Shards > 0, "ShardedFlatMap needs at least one shard");
+
+public:
+    using flat_map_type = FlatMap<_Key, _T, _Compare>;
+    using key_compare = _Compare;
+    using key_type = _Key;
+    using mapped_type = _T;
+    using value_type = std::pair<key_type, mapped_type>;
+    using size_type = std::size_t;
+    using partition_type = _Partition;
+
+    static constexpr size_type shard_count = _Shards;
+
+    class OrderedView;
+
+    ShardedFlatMap(const partition_type& partition = partition_type(),
+                   const key_compare& comp = key_compare())
+        : _partition{partition}, _compare{comp}
+    {
+        for (auto& shard : _shards)
+            shard.map = flat_map_type{comp};
+    }
+
+    ShardedFlatMap(const ShardedFlatMap&) = delete;
+    ShardedFlatMap& operator=(const ShardedFlatMap&) = delete;
+
+    size_type shard_of(const key_type& key) const
+    {
+        return _partition(key, _Shards);
+    }
+
+    bool insert(const value_type& x)
+    {
+        Shard& shard = _shard(x.first);
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        return shard.map.insert(x).second;
+    }
+
+    // Returns true when the key was not there yet.
+    bool insert_or_assign(const key_type& key, const mapped_type& value)
+    {
+        Shard& shard = _shard(key);
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        auto res = shard.map.insert(value_type{key, value});
+        if (!res.second)
+            res.first->second = value;
+        return res.second;
+    }
+
+    // Bulk insert: the input is split per shard first, then the shards are
+    // filled in parallel on up to `threads` threads (the calling one
+    // included, 0 for std::thread::hardware_concurrency()), each with one
+    // FlatMap bulk merge. Keys already there keep their value.
+    template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+    void insert(InputIt first, InputIt last, unsigned threads = 0)
+    {
+        std::array<std::vector<value_type>, _Shards> buckets;
+        for (; first != last; ++first) {
+            const value_type& x = *first;
+            buckets[shard_of(x.first)].push_back(x);
+        }
+
+        auto fill = [&](size_type i) {
+            std::lock_guard<std::mutex> lock{_shards[i].mutex};
+            _shards[i].map.insert(buckets[i].begin(), buckets[i].end());
+        };
+#ifndef FLATMAP_NO_EXCEPTIONS
+        // the first error is rethrown on the calling thread, once all joined
+        std::mutex error_mutex;
+        std::exception_ptr error;
+#endif
+        std::atomic<size_type> next{0};
+        auto work = [&] {
+            for (size_type i; (i = next.fetch_add(1, std::memory_order_relaxed)) < _Shards; ) {
+                if (buckets[i].empty())
+                    continue;
+#ifdef FLATMAP_NO_EXCEPTIONS
+                fill(i);
+#else
+                try {
+                    fill(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock{error_mutex};
+                    if (!error)
+                        error = std::current_exception();
+                }
+#endif
+            }
+        };
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        size_type helpers = std::min<size_type>(threads, _Shards) - 1;
+        std::vector<std::thread> pool;
+        pool.reserve(helpers);
+        for (size_type i = 0; i < helpers; ++i)
+            pool.emplace_back(work);
+        work();
+        for (auto& t : pool)
+            t.join();
+#ifndef FLATMAP_NO_EXCEPTIONS
+        if (error)
+            std::rethrow_exception(error);
+#endif
+    }
+
+    void insert(std::initializer_list<value_type> values)
+    {
+        insert(values.begin(), values.end(), 1);
+    }
+
+    size_type erase(const key_type& key)
+    {
+        Shard& shard = _shard(key);
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        return shard.map.erase(key);
+    }
+
+    std::optional<mapped_type> get(const key_type& key) const
+    {
+        const Shard& shard = _shard(key);
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        auto it = shard.map.find(key);
+        if (it == shard.map.end())
+            return std::nullopt;
+        return it->second;
+    }
+
+    bool contains(const key_type& key) const
+    {
+        const Shard& shard = _shard(key);
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        return shard.map.contains(key);
+    }
+
+    // fn(flat_map_type&) on the shard holding `key`, under its lock. Other
+    // keys of that shard may be touched too as long as they belong there,
+    // ie. shard_of() maps them to the same shard.
+    template <class F>
+    decltype(auto) with_shard(const key_type& key, F&& fn)
+    {
+        Shard& shard = _shard(key);
+        std::lock_guard<std::mutex> lock{shard.mutex};
+        return std::forward<F>(fn)(shard.map);
+    }
+
+    // Sums the shards one at a time, not a snapshot under concurrent writes.
+    size_type size() const
+    {
+        size_type n = 0;
+        for (const auto& shard : _shards) {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            n += shard.map.size();
+        }
+        return n;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    void clear()
+    {
+        for (auto& shard : _shards) {
+            std::lock_guard<std::mutex> lock{shard.mutex};
+            shard.map.clear();
+        }
+    }
+
+    // Every shard locked for as long as the view lives, iteration k-way
+    // merges the shards into key order.
+    OrderedView ordered() const
+    {
+        return OrderedView{*this};
+    }
+
+    // fn(key, value) for every element, in key order.
+    template <class F>
+    void for_each(F&& fn) const
+    {
+        OrderedView view = ordered();
+        for (auto kv : view)
+            fn(kv.first, kv.second);
+    }
+
+    // All the shards merged into a single map.
+    flat_map_type to_flat_map() const
+    {
+        OrderedView view = ordered();
+        return flat_map_type{flatmap::sorted_unique, view.begin(), view.end(), _compare};
+    }
+
+    constexpr key_compare key_comp() const { return _compare; }
+
+private:
+    struct alignas(FLATMAP_CACHELINE_SIZE) Shard {
+        mutable std::mutex mutex;
+        flat_map_type map;
+    };
+
+    Shard& _shard(const key_type& key)
+    {
+        return _shards[shard_of(key)];
+    }
+
+    const Shard& _shard(const key_type& key) const
+    {
+        return _shards[shard_of(key)];
+    }
+
+    std::array<Shard, _Shards> _shards;
+    partition_type _partition;
+    key_compare _compare;
+};
+
+template <typename Key, typename T, std::size_t Shards, typename Compare, typename Partition>
+class ShardedFlatMap<Key, T, Shards, Compare, Partition>::OrderedView {
+    using shard_iterator = typename flat_map_type::const_iterator;
+
+public:
+    // Forward iterator over the union of the shards. Holds a cursor per shard
+    // and a min-heap of the shards by current key, ++ costs O(log Shards).
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = ShardedFlatMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = typename shard_iterator::reference;
+        using pointer = typename shard_iterator::pointer;
+
+        const_iterator() = default;
+
+        reference operator*() const
+        {
+            return *_cur[_heap[0]];
+        }
+
+        pointer operator->() const
+        {
+            return _cur[_heap[0]].operator->();
+        }
+
+        const_iterator& operator++()
+        {
+            auto greater = _greater();
+            std::pop_heap(_heap.begin(), _heap.begin() + _count, greater);
+            std::size_t shard = _heap[_count - 1];
+            if (++_cur[shard] == _end[shard])
+                --_count;
+            else
+                std::push_heap(_heap.begin(), _heap.begin() + _count, greater);
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator tmp{*this};
+            ++(*this);
+            return tmp;
+        }
+
+        friend bool operator==(const const_iterator& a, const const_iterator& b)
+        {
+            if (a._count != b._count)
+                return false;
+            return a._count == 0 || a._cur[a._heap[0]] == b._cur[b._heap[0]];
+        }
+
+        friend bool operator!=(const const_iterator& a, const const_iterator& b)
+        {
+            return !(a == b);
+        }
+
+    private:
+        friend class OrderedView;
+
+        explicit const_iterator(const ShardedFlatMap& map)
+            : _comp{map._compare}
+        {
+            for (std::size_t i = 0; i < Shards; ++i) {
+                _cur[i] = map._shards[i].map.begin();
+                _end[i] = map._shards[i].map.end();
+                if (_cur[i] != _end[i])
+                    _heap[_count++] = i;
+            }
+            std::make_heap(_heap.begin(), _heap.begin() + _count, _greater());
+        }
+
+        auto _greater() const
+        {
+            return [this](std::size_t a, std::size_t b) {
+                return _comp(_cur[b]->first, _cur[a]->first);
+            };
+        }
+
+        std::array<shard_iterator, Shards> _cur{};
+        std::array<shard_iterator, Shards> _end{};
+        std::array<std::size_t, Shards>    _heap{};
+        std::size_t _count = 0;
+        key_compare _comp{};
+    };
+
+    using iterator = const_iterator;
+
+    explicit OrderedView(const ShardedFlatMap& map)
+        : _map{&map}
+    {
+        // always in shard order, two views never deadlock
+        for (std::size_t i = 0; i < Shards; ++i)
+            _locks[i] = std::unique_lock<std::mutex>{map._shards[i].mutex};
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator{*_map};
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator{};
+    }
+
+private:
+    const ShardedFlatMap* _map;
+    std::array<std::unique_lock<std::mutex>, Shards> _locks;
+};
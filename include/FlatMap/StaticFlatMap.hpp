@@ -1,24 +1,60 @@
 #pragma once
 
-#include <sstream>
 #include <array>
 #include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <type_traits>
 #include <functional>
 
+#include "Merge.hpp"
+#include "Policies.hpp"
+#include "Stats.hpp"
+#include "Tags.hpp"
+#include "detail/BloomFilter.hpp"
+#include "detail/Config.hpp"
+#include "detail/Error.hpp"
+#include "detail/HotKeyCache.hpp"
+#include "detail/InsertBuffer.hpp"
+#include "detail/Search.hpp"
+#include "detail/StaticStorage.hpp"
+
 
 // This class is a statically allocated version of a memory continuous map, mainly useful for small data sets.
 // Notice that this is a multimap! Inserting the same key twice will result with duplicate entries (sorted by order of insertion).
-// Getters will always return the first matching entry
+// Getters will always return the first matching entry. With the flatmap::UniqueKeys policy it is a map with unique keys.
+// The storage layout is picked with a policy (see Policies.hpp): flatmap::PairLayout (default)
+// keeps an array of pairs, flatmap::SplitLayout a key array and a parallel value array.
+// Maps built with the flatmap::constant_init tag can be constexpr, lookups on them are constexpr too:
+//     constexpr StaticFlatMap<int, const char*, 4> names{flatmap::constant_init, {{2, "two"}, {1, "one"}}};
+//     static_assert(names.at(2)[0] == 't');
+// Compile time lookups need __builtin_is_constant_evaluated (GCC 9, Clang 9), see detail/Config.hpp.
+// With flatmap::BufferedInsert, begin(), lower_bound(), upper_bound() and equal_range() merge the
+// pending inserts first. Their const overloads never write to the map, they require flush() to
+// have been called (asserted). Find(), count() and contains() search the pending inserts as well.
 template <
     class _KeyType,
     class _ValueType,
     size_t _MaxMembers,
-    class _Compare = std::less<_KeyType>
+    class _Compare = std::less<_KeyType>,
+    class... _Policies
 >
 class StaticFlatMap
     : private _Compare
+    , private flatmap::detail::StatsCounter<flatmap::detail::select_policy_t<
+        flatmap::detail::stats_policy_tag, flatmap::NoStats, _Policies...>::enabled>
+    , private std::conditional_t<flatmap::detail::select_policy_t<
+        flatmap::detail::filter_policy_tag, flatmap::NoFilter, _Policies...>::bits_per_key == 0,
+        flatmap::detail::NoKeyFilter,
+        flatmap::detail::BlockedBloomFilter<_MaxMembers, flatmap::detail::select_policy_t<
+            flatmap::detail::filter_policy_tag, flatmap::NoFilter, _Policies...>::bits_per_key>>
+    , private std::conditional_t<flatmap::detail::select_policy_t<
+        flatmap::detail::cache_policy_tag, flatmap::NoCache, _Policies...>::sets == 0,
+        flatmap::detail::NoKeyCache,
+        flatmap::detail::KeyPositionCache<_KeyType, flatmap::detail::select_policy_t<
+            flatmap::detail::cache_policy_tag, flatmap::NoCache, _Policies...>::sets>>
+    , private flatmap::detail::InsertBuffer<flatmap::detail::select_policy_t<
+        flatmap::detail::insert_policy_tag, flatmap::DirectInsert, _Policies...>::buffer != 0>
 {
 	static_assert(std::is_trivially_copyable<_KeyType>::value,
 			"StaticFlatMap key type must be IsTriviallyCopyable");
@@ -26,22 +62,59 @@ class StaticFlatMap
 			"StaticFlatMap value type must be IsTriviallyCopyable");
 	static_assert(std::is_default_constructible<_ValueType>::value,
 			"StaticFlatMap value type must be default constructible");
+	static_assert(flatmap::detail::are_policies_v<_Policies...>,
+			"StaticFlatMap extra template arguments must be policies from Policies.hpp");
+
+	using LayoutPolicy = flatmap::detail::select_policy_t<
+		flatmap::detail::layout_policy_tag, flatmap::PairLayout, _Policies...>;
+	using Storage = flatmap::detail::StaticStorage<_KeyType, _ValueType, _MaxMembers, LayoutPolicy>;
+	using KeyPolicy = flatmap::detail::select_policy_t<
+		flatmap::detail::key_policy_tag, flatmap::MultiKeys, _Policies...>;
+	static constexpr bool kUniqueKeys = std::is_same<KeyPolicy, flatmap::UniqueKeys>::value;
+	static constexpr size_t kMaxPending = flatmap::detail::select_policy_t<
+		flatmap::detail::insert_policy_tag, flatmap::DirectInsert, _Policies...>::buffer;
+	static constexpr bool kBuffered = kMaxPending != 0;
+	using Buffer = flatmap::detail::InsertBuffer<kBuffered>;
+	static_assert(kMaxPending <= 1024, "BufferedInsert buffer is merged on the stack, keep it small");
+	static constexpr bool kCollectStats = flatmap::detail::select_policy_t<
+		flatmap::detail::stats_policy_tag, flatmap::NoStats, _Policies...>::enabled;
+	using Stats = flatmap::detail::StatsCounter<kCollectStats>;
+	static constexpr size_t kElementSize = sizeof(_KeyType) + sizeof(_ValueType);
+	static constexpr size_t kFilterBits = flatmap::detail::select_policy_t<
+		flatmap::detail::filter_policy_tag, flatmap::NoFilter, _Policies...>::bits_per_key;
+	static constexpr bool kFiltered = kFilterBits != 0;
+	using Filter = std::conditional_t<kFiltered,
+		flatmap::detail::BlockedBloomFilter<_MaxMembers, kFilterBits>, flatmap::detail::NoKeyFilter>;
+	static_assert(!kFiltered || (std::is_integral<_KeyType>::value &&
+			(flatmap::detail::is_less_v<_Compare, _KeyType> || flatmap::detail::is_greater_v<_Compare, _KeyType>)),
+			"BloomFilter needs integral keys ordered by std::less or std::greater");
+	static constexpr size_t kCacheSets = flatmap::detail::select_policy_t<
+		flatmap::detail::cache_policy_tag, flatmap::NoCache, _Policies...>::sets;
+	static constexpr bool kCached = kCacheSets != 0;
+	using KeyCache = std::conditional_t<kCached,
+		flatmap::detail::KeyPositionCache<_KeyType, kCacheSets>, flatmap::detail::NoKeyCache>;
+	static_assert(!kCached || (std::is_integral<_KeyType>::value &&
+			(flatmap::detail::is_less_v<_Compare, _KeyType> || flatmap::detail::is_greater_v<_Compare, _KeyType>)),
+			"HotKeyCache needs integral keys ordered by std::less or std::greater");
+	static_assert(!kCached || _MaxMembers <= 0xFFFFFFFFu, "HotKeyCache stores 32 bit positions");
 
 public:
 	using KeyType = _KeyType;
 	using ValueType = _ValueType;
 	using KeyValuePair = std::pair<KeyType, ValueType>;
-	using ContainerType = std::array<KeyValuePair, _MaxMembers>;
+	using ContainerType = typename Storage::ContainerType;
 
 	// Iterators
-	using iterator = typename ContainerType::iterator;
-	using const_iterator = typename ContainerType::const_iterator;
-	using reverse_iterator = typename ContainerType::reverse_iterator;
-	using const_reverse_iterator = typename ContainerType::const_reverse_iterator;
+	using iterator = typename Storage::iterator;
+	using const_iterator = typename Storage::const_iterator;
+	using reverse_iterator = std::reverse_iterator<iterator>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 	using value_type = KeyValuePair;
 	using key_type = KeyType;
 	using mapped_type = ValueType;
 	using key_compare = _Compare;
+	// Insert() of a single element returns where it is, and with unique keys whether it was inserted
+	using InsertResult = std::conditional_t<kUniqueKeys, std::pair<iterator, bool>, iterator>;
 
 	struct value_compare {
 		_Compare comp;
@@ -52,137 +125,993 @@ public:
 		}
 	};
 
+	// Bulk construction appends everything and stable sorts once, equal keys stay in input order
+	// (with unique keys the first one is kept). Only the slots in use are written, the rest of
+	// the capacity is left as the default constructor leaves it.
 	StaticFlatMap(const std::initializer_list<KeyValuePair>& values)
 	{
-		for (auto& value : values)
+		Insert(values.begin(), values.end());
+	}
+
+	// Usable in constant expressions: the elements are insertion sorted, the same order as the
+	// bulk path, O(n^2). The whole array is zeroed first, C++17 constant expressions don't allow
+	// uninitialized members.
+	constexpr StaticFlatMap(flatmap::constant_init_t, const std::initializer_list<KeyValuePair>& values)
+		: _Compare(), m_storage{}
+	{
+		const _Compare& comp = *this;
+		for (const auto& value : values)
 		{
-			Insert(value);
+			size_t index = m_endIndex;
+			while (index > 0 && comp(value.first, m_storage.key(index - 1)))
+				--index;
+			if (kUniqueKeys && index > 0 && !comp(m_storage.key(index - 1), value.first))
+				continue;
+			if (m_endIndex == _MaxMembers)
+				flatmap::detail::throw_range_error(__PRETTY_FUNCTION__);
+			for (size_t i = m_endIndex; i > index; --i)
+				m_storage.copy_element(i - 1, i);
+			m_storage.set(index, value);
+			++m_endIndex;
+			keyFilter().add(value.first);
 		}
 	}
 
+	template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+	StaticFlatMap(InputIt first, InputIt last)
+	{
+		Insert(first, last);
+	}
+
+	// The input is already sorted by key, it is copied as is
+	template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+	StaticFlatMap(flatmap::sorted_equivalent_t, InputIt first, InputIt last)
+	{
+		appendRange(first, last);
+		if constexpr (kUniqueKeys)
+			removeDuplicates();
+		rebuildFilter();
+	}
+
+	StaticFlatMap(flatmap::sorted_equivalent_t, const std::initializer_list<KeyValuePair>& values)
+		: StaticFlatMap(flatmap::sorted_equivalent, values.begin(), values.end()) {}
+
 	constexpr StaticFlatMap() noexcept {}
 
-	iterator Insert(const KeyValuePair& val)
+	// The comparator is stored and used by every lookup, it can carry state
+	explicit StaticFlatMap(const _Compare& comp) noexcept
+		: _Compare(comp) {}
+
+	// Copies and moves only touch the size() elements in use, not the whole capacity (in
+	// constant expressions the rest is zeroed). The elements are trivially copyable, a move
+	// is a copy. Statistics and the hot key cache are not copied, pending inserts come out
+	// merged.
+	constexpr StaticFlatMap(const StaticFlatMap& other) noexcept
+		: _Compare(other), Filter(other), Buffer(other)
+		, m_storage(Storage::create_copy(other.m_storage, other.m_endIndex))
+		, m_endIndex(other.m_endIndex)
+	{
+		flush();
+	}
+
+	constexpr StaticFlatMap(StaticFlatMap&& other) noexcept
+		: StaticFlatMap(static_cast<const StaticFlatMap&>(other)) {}
+
+	StaticFlatMap& operator=(const StaticFlatMap& other) noexcept
+	{
+		if (this != &other)
+		{
+			static_cast<_Compare&>(*this) = other;
+			keyFilter() = other.keyFilter();
+			keyCache().invalidate();
+			insertBuffer() = other.insertBuffer();
+			m_storage.copy_from(other.m_storage, other.m_endIndex);
+			m_endIndex = other.m_endIndex;
+			flush();
+		}
+		return *this;
+	}
+
+	StaticFlatMap& operator=(StaticFlatMap&& other) noexcept
+	{
+		return *this = static_cast<const StaticFlatMap&>(other);
+	}
+
+	// Multimap: goes after the equal keys already there. Unique keys: a key already there is
+	// left as is and {its position, false} is returned. With flatmap::BufferedInsert the
+	// element is appended to the pending inserts, see appendPending().
+	InsertResult Insert(const KeyValuePair& val)
+	{
+		if constexpr (kBuffered)
+		{
+			if constexpr (kUniqueKeys)
+			{
+				size_t index = matchIndex(lowerBound(val.first), val.first);
+				if (index != m_endIndex)
+					return {m_storage.at(index), false};
+				return {m_storage.at(appendPending(val)), true};
+			}
+			else
+			{
+				return m_storage.at(appendPending(val));
+			}
+		}
+		else if constexpr (kUniqueKeys)
+		{
+			size_t index = lowerBound(val.first);
+			if (isKeyAt(index, val.first))
+				return {m_storage.at(index), false};
+			insertByIndex(index, val);
+			return {m_storage.at(index), true};
+		}
+		else
+		{
+			auto position = upperBound(val.first);
+			insertByIndex(position, val);
+			return m_storage.at(position);
+		}
+	}
+
+	// Appends the range, sorts it and merges it with the current elements in place, the
+	// new elements go after existing equal keys (like Insert). With unique keys only the
+	// first of the equal keys is then kept. If the range doesn't fit (duplicates included)
+	// nothing is inserted and std::range_error is thrown.
+	template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+	void Insert(InputIt first, InputIt last)
+	{
+		flush();
+		size_t middle = m_endIndex;
+		appendRange(first, last);
+		mergeAppended<true>(middle);
+	}
+
+	template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+	void Insert(flatmap::sorted_equivalent_t, InputIt first, InputIt last)
+	{
+		flush();
+		size_t middle = m_endIndex;
+		appendRange(first, last);
+		mergeAppended<false>(middle);
+	}
+
+	// Non-throwing Insert(): a full map is reported as InsertStatus::Overflow, with end().
+	// InsertStatus::Exists is only returned with unique keys.
+	std::pair<iterator, flatmap::InsertStatus> try_insert(const KeyValuePair& val) noexcept
+	{
+		if constexpr (kBuffered)
+		{
+			if constexpr (kUniqueKeys)
+			{
+				size_t index = matchIndex(lowerBound(val.first), val.first);
+				if (index != m_endIndex)
+					return {m_storage.at(index), flatmap::InsertStatus::Exists};
+			}
+			if (m_endIndex == _MaxMembers)
+				return {end(), flatmap::InsertStatus::Overflow};
+			return {m_storage.at(appendPendingUnchecked(val)), flatmap::InsertStatus::Inserted};
+		}
+		size_t index = kUniqueKeys ? lowerBound(val.first) : upperBound(val.first);
+		if (kUniqueKeys && isKeyAt(index, val.first))
+			return {m_storage.at(index), flatmap::InsertStatus::Exists};
+		if (m_endIndex == _MaxMembers)
+			return {end(), flatmap::InsertStatus::Overflow};
+		insertByIndexUnchecked(index, val);
+		return {m_storage.at(index), flatmap::InsertStatus::Inserted};
+	}
+
+	// All of the range or, when it doesn't fit, nothing and InsertStatus::Overflow
+	template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+	flatmap::InsertStatus try_insert(InputIt first, InputIt last)
+	{
+		flush();
+		size_t middle = m_endIndex;
+		if (!tryAppendRange(first, last))
+			return flatmap::InsertStatus::Overflow;
+		mergeAppended<true>(middle);
+		return flatmap::InsertStatus::Inserted;
+	}
+
+	// Adds the elements of `other` in one linear pass, backward in place so nothing moves
+	// twice, `other` is left as is. Multimap: they go after the equal keys already there.
+	// Unique keys: a key in both gets resolve(key, this value, other value), see Merge.hpp.
+	// If the result doesn't fit std::range_error is thrown and the map is unchanged. An `other`
+	// with pending inserts is merged from a flushed copy, as are the operands of map_union()
+	// and co.
+	template <class Resolve = flatmap::KeepLeft>
+	void merge(const StaticFlatMap& other, Resolve resolve = Resolve{})
+	{
+		if (&other == this || other.empty())
+			return;
+		if (other.insertBuffer().pending() != 0)
+			return merge(StaticFlatMap{other}, resolve);
+		flush();
+		if (m_endIndex + other.m_endIndex <= _MaxMembers)
+		{
+			mergeBackward(other, resolve);
+		}
+		else if constexpr (kUniqueKeys)
+		{
+			// might still fit once the common keys are folded
+			*this = map_union(*this, other, resolve);
+		}
+		else
+		{
+			flatmap::detail::throw_range_error(__PRETTY_FUNCTION__);
+		}
+	}
+
+	// The keys of either map in one linear pass, keys in both get resolve(key, a value, b value).
+	// Throws std::range_error if the result doesn't fit.
+	template <class Resolve = flatmap::KeepLeft>
+	friend StaticFlatMap map_union(const StaticFlatMap& a, const StaticFlatMap& b, Resolve resolve = Resolve{})
+	{
+		if (a.insertBuffer().pending() != 0 || b.insertBuffer().pending() != 0)
+			return map_union(StaticFlatMap{a}, StaticFlatMap{b}, resolve);
+		StaticFlatMap out{a.key_comp()};
+		flatmap::detail::merge_by_key<true, true, true>(
+			a.begin(), a.end(), b.begin(), b.end(), a.keyCompare(), resolve, out.appender());
+		return out;
+	}
+
+	// The keys of both maps
+	template <class Resolve = flatmap::KeepLeft>
+	friend StaticFlatMap map_intersection(const StaticFlatMap& a, const StaticFlatMap& b, Resolve resolve = Resolve{})
+	{
+		if (a.insertBuffer().pending() != 0 || b.insertBuffer().pending() != 0)
+			return map_intersection(StaticFlatMap{a}, StaticFlatMap{b}, resolve);
+		StaticFlatMap out{a.key_comp()};
+		flatmap::detail::merge_by_key<false, false, true>(
+			a.begin(), a.end(), b.begin(), b.end(), a.keyCompare(), resolve, out.appender());
+		return out;
+	}
+
+	// The keys of `a` that are not in `b`
+	friend StaticFlatMap map_difference(const StaticFlatMap& a, const StaticFlatMap& b)
+	{
+		if (a.insertBuffer().pending() != 0 || b.insertBuffer().pending() != 0)
+			return map_difference(StaticFlatMap{a}, StaticFlatMap{b});
+		StaticFlatMap out{a.key_comp()};
+		flatmap::KeepLeft resolve;
+		flatmap::detail::merge_by_key<true, false, false>(
+			a.begin(), a.end(), b.begin(), b.end(), a.keyCompare(), resolve, out.appender());
+		return out;
+	}
+
+	// Inserts {key, ValueType(args...)} unless the key is already there, in which case
+	// nothing is constructed nor moved.
+	template <class... Args>
+	std::pair<iterator, bool> try_emplace(const KeyType& key, Args&&... args)
+	{
+		if constexpr (kBuffered)
+		{
+			size_t index = matchIndex(lowerBound(key), key);
+			if (index != m_endIndex)
+				return {m_storage.at(index), false};
+			return {m_storage.at(appendPending(KeyValuePair{key, ValueType(std::forward<Args>(args)...)})), true};
+		}
+		size_t index = lowerBound(key);
+		if (isKeyAt(index, key))
+			return {m_storage.at(index), false};
+		insertByIndex(index, KeyValuePair{key, ValueType(std::forward<Args>(args)...)});
+		return {m_storage.at(index), true};
+	}
+
+	// Assigns the (first) element of that key, or inserts one
+	template <class M>
+	std::pair<iterator, bool> insert_or_assign(const KeyType& key, M&& obj)
 	{
-		auto position = std::upper_bound(begin(), end(), val, compareFunction);
-		insertByIterator(position, val);
-		return position;
+		if constexpr (kBuffered)
+		{
+			size_t index = matchIndex(lowerBound(key), key);
+			if (index == m_endIndex)
+				return {m_storage.at(appendPending(KeyValuePair{key, ValueType(std::forward<M>(obj))})), true};
+			m_storage.value(index) = std::forward<M>(obj);
+			return {m_storage.at(index), false};
+		}
+		size_t index = lowerBound(key);
+		if (isKeyAt(index, key))
+		{
+			m_storage.value(index) = std::forward<M>(obj);
+			return {m_storage.at(index), false};
+		}
+		insertByIndex(index, KeyValuePair{key, ValueType(std::forward<M>(obj))});
+		return {m_storage.at(index), true};
 	}
 
-	ValueType& at(const KeyType& key)
+	constexpr ValueType& at(const KeyType& key)
 	{
-		auto elem = Find(key);
-		if (elem == end())
+		size_t index = findIndex(key);
+		if (index == m_endIndex)
 		{
-			throwOutOfRangeError(key, __PRETTY_FUNCTION__);
+			flatmap::detail::throw_out_of_range(__PRETTY_FUNCTION__);
 		}
-		return elem->second;
+		return m_storage.value(index);
+	}
+
+	constexpr const ValueType& at(const KeyType& key) const
+	{
+		size_t index = findIndex(key);
+		if (index == m_endIndex)
+		{
+			flatmap::detail::throw_out_of_range(__PRETTY_FUNCTION__);
+		}
+		return m_storage.value(index);
+	}
+
+	// Non-throwing at(), nullptr when the key isn't there
+	ValueType* try_at(const KeyType& key) noexcept
+	{
+		size_t index = findIndex(key);
+		return index != m_endIndex ? &m_storage.value(index) : nullptr;
+	}
+
+	const ValueType* try_at(const KeyType& key) const noexcept
+	{
+		size_t index = findIndex(key);
+		return index != m_endIndex ? &m_storage.value(index) : nullptr;
+	}
+
+	constexpr iterator Find(const KeyType& key) noexcept
+	{
+		return m_storage.at(findIndex(key));
+	}
+
+	constexpr const_iterator Find(const KeyType& key) const noexcept
+	{
+		return m_storage.at(findIndex(key));
+	}
+
+	// Lookups by any type the comparator orders against KeyType, when it declares is_transparent
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	iterator Find(const K& key) noexcept
+	{
+		return m_storage.at(findIndex(key));
+	}
+
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	const_iterator Find(const K& key) const noexcept
+	{
+		return m_storage.at(findIndex(key));
 	}
 
-	iterator Find(const KeyType& key) noexcept
+	// Looks up every key of [first, last) and writes one iterator per key to out, end() for
+	// the missing ones. The searches run interleaved so their cache misses overlap.
+	template <class KeyIt, class OutIt>
+	OutIt FindBatch(KeyIt first, KeyIt last, OutIt out) noexcept
 	{
-		return const_cast<iterator>(static_cast<const StaticFlatMap&>(*this).Find(key));
+		forEachIndex(first, last, [&](size_t index) { *out++ = m_storage.at(index); });
+		return out;
 	}
 
-	const_iterator Find(const KeyType& key) const noexcept
+	template <class KeyIt, class OutIt>
+	OutIt FindBatch(KeyIt first, KeyIt last, OutIt out) const noexcept
 	{
-		KeyValuePair dummyPair{key, ValueType()};
-		auto it = std::lower_bound(&m_sortedArray[0], &m_sortedArray[m_endIndex],
-				dummyPair, compareFunction);
-		return it != end() && !key_comp()(key, it->first) ? it : end();
+		forEachIndex(first, last, [&](size_t index) { *out++ = m_storage.at(index); });
+		return out;
 	}
 
 	iterator Erase(const_iterator position)
 	{
 		if (position == end() || m_endIndex == 0)
 		{
-			throwRangeError(*position, __PRETTY_FUNCTION__);
+			flatmap::detail::throw_range_error(__PRETTY_FUNCTION__);
 		}
-		auto nonConstIter = (iterator)position;
-		std::copy(nonConstIter + 1, end(), nonConstIter);
-		--m_endIndex;
-		return nonConstIter;
+		return eraseByIndex(indexOf(position), 1);
+	}
+
+	// Removes [first, last) with a single shift of the tail, returns the element after them
+	iterator Erase(const_iterator first, const_iterator last) noexcept
+	{
+		return eraseByIndex(indexOf(first), last - first);
 	}
 
-	iterator Erase(const KeyType& key) { return Erase(Find(key)); }
+	// Removes every element of that key in one shift, returns the element after them
+	iterator Erase(const KeyType& key) noexcept
+	{
+		flush();
+		size_t first = lowerBound(key);
+		return eraseByIndex(first, upperBound(key) - first);
+	}
+
+	// Removes the elements `pred` returns true for, the others are compacted in one stable
+	// pass. Returns how many were removed.
+	template <class Pred>
+	friend size_t erase_if(StaticFlatMap& map, Pred pred)
+	{
+		map.flush();
+		size_t kept = 0;
+		for (size_t i = 0; i != map.m_endIndex; ++i)
+		{
+			if (pred(*map.m_storage.at(i)))
+				continue;
+			if (kept != i)
+				map.m_storage.copy_element(i, kept);
+			++kept;
+		}
+		size_t removed = map.m_endIndex - kept;
+		map.statsCounter().count_moved(kept * kElementSize);
+		map.statsCounter().count_erases(removed);
+		map.m_endIndex = kept;
+		if (removed != 0)
+		{
+			map.rebuildFilter();
+			map.keyCache().invalidate();
+		}
+		return removed;
+	}
 
 	ValueType& operator[](const KeyType& key)
 	{
-		KeyValuePair dummyPair{key, ValueType()};
-		auto range = std::equal_range(begin(), end(), dummyPair, compareFunction);
-		if (range.first == range.second)
+		if constexpr (kBuffered)
+		{
+			size_t index = findIndex(key);
+			if (index == m_endIndex)
+				index = appendPending(KeyValuePair{key, ValueType()});
+			return m_storage.value(index);
+		}
+		if constexpr (kCached)
+		{
+			size_t cached = keyCache().find(key);
+			if (cached != KeyCache::npos)
+			{
+				statsCounter().count_lookup(true, 0);
+				return m_storage.value(cached);
+			}
+		}
+		size_t index = lowerBound(key);
+		statsCounter().count_lookup(isKeyAt(index, key), m_endIndex);
+		if (!isKeyAt(index, key))
 		{
 			// value was not found, inserting it in the right location
-			insertByIterator(range.first, dummyPair);
+			insertByIndex(index, KeyValuePair{key, ValueType()});
 		}
-		return range.first->second;
+		return m_storage.value(index);
 	}
 
 	// std::map compatibility
 	template <class... Params>
 	iterator erase(const_iterator position)    { return Erase(position); }
-	iterator erase(const KeyType& key)         { return Erase(key);      }
-	iterator insert(const KeyValuePair& val)   { return Insert(val);     }
-	iterator find(const KeyType& key) noexcept { return Find(key);       }
-	const_iterator find(const KeyType& key) const noexcept { return Find(key); }
+	iterator erase(const_iterator first, const_iterator last) noexcept { return Erase(first, last); }
+	size_t erase(const KeyType& key)           { size_t n = size(); Erase(key); return n - size(); }
+	InsertResult insert(const KeyValuePair& val) { return Insert(val);   }
+	template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+	void insert(InputIt first, InputIt last)   { Insert(first, last);    }
+	constexpr iterator find(const KeyType& key) noexcept { return Find(key); }
+	constexpr const_iterator find(const KeyType& key) const noexcept { return Find(key); }
+	template <class KeyIt, class OutIt>
+	OutIt find_batch(KeyIt first, KeyIt last, OutIt out) noexcept { return FindBatch(first, last, out); }
+	template <class KeyIt, class OutIt>
+	OutIt find_batch(KeyIt first, KeyIt last, OutIt out) const noexcept { return FindBatch(first, last, out); }
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	iterator find(const K& key) noexcept { return Find(key); }
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	const_iterator find(const K& key) const noexcept { return Find(key); }
+
+	// Equal keys are adjacent, lower_bound() is the first of them and upper_bound() one past the last
+	iterator lower_bound(const KeyType& key) noexcept             { flush(); return m_storage.at(lowerBound(key)); }
+	const_iterator lower_bound(const KeyType& key) const noexcept { assertFlushed(); return m_storage.at(lowerBound(key)); }
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	iterator lower_bound(const K& key) noexcept                   { flush(); return m_storage.at(lowerBound(key)); }
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	const_iterator lower_bound(const K& key) const noexcept       { assertFlushed(); return m_storage.at(lowerBound(key)); }
+
+	iterator upper_bound(const KeyType& key) noexcept             { flush(); return m_storage.at(upperBound(key)); }
+	const_iterator upper_bound(const KeyType& key) const noexcept { assertFlushed(); return m_storage.at(upperBound(key)); }
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	iterator upper_bound(const K& key) noexcept                   { flush(); return m_storage.at(upperBound(key)); }
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	const_iterator upper_bound(const K& key) const noexcept       { assertFlushed(); return m_storage.at(upperBound(key)); }
+
+	std::pair<iterator, iterator> equal_range(const KeyType& key) noexcept
+	{
+		return {lower_bound(key), upper_bound(key)};
+	}
+	std::pair<const_iterator, const_iterator> equal_range(const KeyType& key) const noexcept
+	{
+		return {lower_bound(key), upper_bound(key)};
+	}
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	std::pair<iterator, iterator> equal_range(const K& key) noexcept
+	{
+		return {lower_bound(key), upper_bound(key)};
+	}
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	std::pair<const_iterator, const_iterator> equal_range(const K& key) const noexcept
+	{
+		return {lower_bound(key), upper_bound(key)};
+	}
+
+	size_t count(const KeyType& key) const noexcept { return upperBound(key) - lowerBound(key) + countPending(key); }
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	size_t count(const K& key) const noexcept       { return upperBound(key) - lowerBound(key) + countPending(key); }
 
-	void Clear() noexcept { m_endIndex = 0; }
+	bool contains(const KeyType& key) const noexcept { return findIndex(key) != m_endIndex; }
+	template <class K, class C = _Compare, typename = typename C::is_transparent>
+	bool contains(const K& key) const noexcept       { return findIndex(key) != m_endIndex; }
+
+	void Clear() noexcept
+	{
+		m_endIndex = 0;
+		insertBuffer() = Buffer{};
+		keyFilter().clear();
+		keyCache().invalidate();
+	}
 	void clear() noexcept { Clear(); }
 
-	iterator begin()                 noexcept { return iterator(&m_sortedArray[0]);                  }
-	iterator end()                   noexcept { return iterator(&m_sortedArray[m_endIndex]);         }
-	reverse_iterator rbegin()        noexcept { return reverse_iterator(&m_sortedArray[m_endIndex]); }
-	reverse_iterator rend()          noexcept { return reverse_iterator(&m_sortedArray[0]);          }
+	// Merges the pending inserts of a BufferedInsert map, no-op otherwise
+	constexpr void flush() noexcept
+	{
+		if constexpr (kBuffered)
+		{
+			if (insertBuffer().pending() != 0)
+				flushPending();
+		}
+	}
+
+	// Counters of a map with flatmap::CollectStats, see Stats.hpp
+	flatmap::MapStats stats() const noexcept
+	{
+		static_assert(kCollectStats, "stats() needs the flatmap::CollectStats policy");
+		return statsCounter().snapshot(m_endIndex, _MaxMembers);
+	}
+
+	void reset_stats() noexcept
+	{
+		static_assert(kCollectStats, "reset_stats() needs the flatmap::CollectStats policy");
+		statsCounter().reset(m_endIndex);
+	}
+
+	constexpr iterator begin()                 noexcept { flush(); return m_storage.at(0);         }
+	constexpr iterator end()                   noexcept { return m_storage.at(m_endIndex);         }
+	constexpr reverse_iterator rbegin()        noexcept { flush(); return reverse_iterator(end()); }
+	constexpr reverse_iterator rend()          noexcept { return reverse_iterator(begin());        }
 
-	const_iterator cbegin()          const noexcept { return const_iterator(&m_sortedArray[0]);                  }
-	const_iterator cend()            const noexcept { return const_iterator(&m_sortedArray[m_endIndex]);         }
-	const_reverse_iterator crbegin() const noexcept { return const_reverse_iterator(&m_sortedArray[m_endIndex]); }
-	const_reverse_iterator crend()   const noexcept { return const_reverse_iterator(&m_sortedArray[0]);          }
+	constexpr const_iterator cbegin()          const noexcept { assertFlushed(); return m_storage.at(0);  }
+	constexpr const_iterator cend()            const noexcept { return m_storage.at(m_endIndex);          }
+	constexpr const_reverse_iterator crbegin() const noexcept { return const_reverse_iterator(cend());   }
+	constexpr const_reverse_iterator crend()   const noexcept { return const_reverse_iterator(cbegin()); }
 
-	const_iterator begin()          const noexcept { return const_iterator (&m_sortedArray[0]);                 }
-	const_iterator end()            const noexcept { return const_iterator(&m_sortedArray[m_endIndex]);         }
-	const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(&m_sortedArray[m_endIndex]); }
-	const_reverse_iterator rend()   const noexcept { return const_reverse_iterator(&m_sortedArray[0]);          }
+	constexpr const_iterator begin()          const noexcept { return cbegin();  }
+	constexpr const_iterator end()            const noexcept { return cend();    }
+	constexpr const_reverse_iterator rbegin() const noexcept { return crbegin(); }
+	constexpr const_reverse_iterator rend()   const noexcept { return crend();   }
 
-	bool   empty()    const noexcept { return size() == 0; }
-	size_t size()     const noexcept { return m_endIndex; }
+	constexpr bool   empty()    const noexcept { return size() == 0; }
+	constexpr size_t size()     const noexcept { return m_endIndex; }
 	constexpr size_t max_size() const noexcept { return capacity(); }
 	constexpr size_t capacity() const noexcept { return _MaxMembers; }
-	key_compare key_comp() const noexcept { return *this; }
+	constexpr key_compare key_comp() const noexcept { return *this; }
 	value_compare value_comp() const noexcept { return value_compare{key_comp()}; }
 
 private:
 
-	void insertByIterator(const iterator& position, const KeyValuePair& val)
+	// The index based searches take a KeyType, or anything comparable with one for transparent comparators
+	template <class K>
+	constexpr size_t findIndex(const K& key) const noexcept
+	{
+		constexpr bool cached = kCached && std::is_same<K, KeyType>::value;
+		if constexpr (cached)
+		{
+			if (!FLATMAP_IS_CONSTANT_EVALUATED())
+			{
+				size_t index = keyCache().find(key);
+				if (index != KeyCache::npos)
+				{
+					statsCounter().count_lookup(true, 0);
+					return index;
+				}
+			}
+		}
+		if constexpr (kFiltered && std::is_same<K, KeyType>::value)
+		{
+			if (!keyFilter().may_contain(key))
+			{
+				if (!FLATMAP_IS_CONSTANT_EVALUATED())
+					statsCounter().count_lookup(false, 0);
+				return m_endIndex;
+			}
+		}
+		size_t index = matchIndex(lowerBound(key), key);
+		bool found = index != m_endIndex;
+		if (!FLATMAP_IS_CONSTANT_EVALUATED())
+		{
+			statsCounter().count_lookup(found, sortedSize());
+			if constexpr (cached)
+			{
+				if (found)
+					keyCache().store(key, index);
+			}
+		}
+		return index;
+	}
+
+	// `index` is the lowerBound() of `key`
+	template <class K>
+	constexpr bool isKeyAt(size_t index, const K& key) const noexcept
+	{
+		const _Compare& comp = *this;
+		return index != sortedSize() && !comp(key, m_storage.key(index));
+	}
+
+	// `index` is the lowerBound() of `key`, the pending inserts are searched when it isn't
+	// there. size() when the key is in neither.
+	template <class K>
+	constexpr size_t matchIndex(size_t index, const K& key) const noexcept
+	{
+		if (isKeyAt(index, key))
+			return index;
+		if constexpr (kBuffered)
+			return findPending(key);
+		return m_endIndex;
+	}
+
+	// The pending inserts in insertion order, arithmetic keys are compared several at a time
+	template <class K>
+	constexpr size_t findPending(const K& key) const noexcept
+	{
+		size_t sorted = sortedSize();
+		if constexpr (flatmap::detail::is_simd_searchable_v<KeyType, K, _Compare> && Storage::key_stride == 1)
+		{
+			if (!FLATMAP_IS_CONSTANT_EVALUATED())
+				return sorted + flatmap::detail::find_equal(m_storage.keys() + sorted, m_endIndex - sorted, key);
+		}
+		const _Compare& comp = *this;
+		for (size_t i = sorted; i != m_endIndex; ++i)
+		{
+			if (!comp(key, m_storage.key(i)) && !comp(m_storage.key(i), key))
+				return i;
+		}
+		return m_endIndex;
+	}
+
+	template <class K>
+	size_t countPending(const K& key) const noexcept
+	{
+		const _Compare& comp = *this;
+		size_t n = 0;
+		for (size_t i = sortedSize(); i != m_endIndex; ++i)
+			n += !comp(key, m_storage.key(i)) && !comp(m_storage.key(i), key);
+		return n;
+	}
+
+	// The elements past it are the pending inserts of flatmap::BufferedInsert
+	constexpr size_t sortedSize() const noexcept { return m_endIndex - insertBuffer().pending(); }
+
+	// Of any element, the pending ones included
+	constexpr size_t indexOf(const_iterator position) const noexcept { return position - m_storage.at(0); }
+
+	// The const overloads that need the whole map sorted don't merge, two threads may read
+	// the same map
+	constexpr void assertFlushed() const noexcept
+	{
+		assert(insertBuffer().pending() == 0 && "call flush() first");
+	}
+
+	// Keeps the first of every run of equal keys, in one pass
+	void removeDuplicates() noexcept
+	{
+		if (m_endIndex == 0)
+			return;
+		const _Compare& comp = *this;
+		size_t last = 0;
+		for (size_t i = 1; i != m_endIndex; ++i)
+		{
+			if (comp(m_storage.key(last), m_storage.key(i)) && ++last != i)
+				m_storage.copy_element(i, last);
+		}
+		m_endIndex = last + 1;
+	}
+
+	// Calls emit(index) with the findIndex() of every key of [first, last)
+	template <class KeyIt, class Emit>
+	void forEachIndex(KeyIt first, KeyIt last, Emit&& emit) const noexcept
+	{
+		constexpr size_t keyStride = Storage::key_stride;
+		if constexpr (keyStride != 0)
+		{
+			size_t sorted = sortedSize();
+			flatmap::detail::lower_bound_batch<keyStride>(m_storage.keys(), sorted, first, last, key_comp(),
+				[&](const KeyType& key, size_t index) {
+					index = matchIndex(index, key);
+					statsCounter().count_lookup(index != m_endIndex, sorted);
+					emit(index);
+				});
+		}
+		else
+		{
+			for (; first != last; ++first)
+				emit(findIndex(*first));
+		}
+	}
+
+	template <class K>
+	constexpr size_t lowerBound(const K& key) const noexcept
+	{
+		constexpr size_t keyStride = Storage::key_stride;
+		if (FLATMAP_IS_CONSTANT_EVALUATED())
+		{
+			return lowerBoundConstexpr(key);
+		}
+		// arithmetic keys are compared in place, several at a time
+		if constexpr (flatmap::detail::is_simd_searchable_v<KeyType, K, _Compare> && keyStride != 0)
+		{
+			return flatmap::detail::lower_bound_simd<keyStride>(m_storage.keys(), sortedSize(), key, key_comp());
+		}
+		else if constexpr (keyStride == 1)
+		{
+			return flatmap::detail::lower_bound(m_storage.keys(), sortedSize(), key, key_comp());
+		}
+		else
+		{
+			const _Compare& comp = *this;
+			auto keyBefore = [&comp](const auto& elem, const K& k) { return comp(elem.first, k); };
+			return indexOf(std::lower_bound(m_storage.at(0), m_storage.at(sortedSize()), key, keyBefore));
+		}
+	}
+
+	// plain binary search, usable in constant expressions
+	template <class K>
+	constexpr size_t lowerBoundConstexpr(const K& key) const noexcept
+	{
+		const _Compare& comp = *this;
+		size_t first = 0;
+		size_t count = sortedSize();
+		while (count > 0)
+		{
+			size_t step = count / 2;
+			if (comp(m_storage.key(first + step), key))
+			{
+				first += step + 1;
+				count -= step + 1;
+			}
+			else
+			{
+				count = step;
+			}
+		}
+		return first;
+	}
+
+	template <class K>
+	size_t upperBound(const K& key) const noexcept
+	{
+		const _Compare& comp = *this;
+		if constexpr (Storage::key_stride == 1)
+		{
+			// first key that `key` is ordered before
+			auto notAfter = [&comp](const KeyType& k, const K& x) { return !comp(x, k); };
+			return flatmap::detail::lower_bound(m_storage.keys(), sortedSize(), key, notAfter);
+		}
+		else
+		{
+			auto keyAfter = [&comp](const K& k, const auto& elem) { return comp(k, elem.first); };
+			return indexOf(std::upper_bound(m_storage.at(0), m_storage.at(sortedSize()), key, keyAfter));
+		}
+	}
+
+	// Returns false, and leaves the size as it was, if the range doesn't fit
+	template <class InputIt>
+	bool tryAppendRange(InputIt first, InputIt last) noexcept
+	{
+		size_t oldSize = m_endIndex;
+		for (; first != last; ++first)
+		{
+			if (m_endIndex == _MaxMembers)
+			{
+				m_endIndex = oldSize;
+				return false;
+			}
+			m_storage.set(m_endIndex++, *first);
+		}
+		return true;
+	}
+
+	template <class InputIt>
+	void appendRange(InputIt first, InputIt last)
+	{
+		if (!tryAppendRange(first, last))
+			flatmap::detail::throw_range_error(__PRETTY_FUNCTION__);
+	}
+
+	// Sorts [middle, size()) and merges it with the elements before
+	template <bool Sort>
+	void mergeAppended(size_t middle)
+	{
+		if constexpr (Sort)
+			m_storage.stable_sort(middle, m_endIndex, value_comp());
+		m_storage.inplace_merge(0, middle, m_endIndex, value_comp());
+		statsCounter().count_moved(m_endIndex * kElementSize);
+		if constexpr (kUniqueKeys)
+			removeDuplicates();
+		statsCounter().count_inserts(m_endIndex - std::min(middle, m_endIndex), m_endIndex);
+		rebuildFilter();
+		keyCache().invalidate();
+	}
+
+	const _Compare& keyCompare() const noexcept { return *this; }
+
+	Stats& statsCounter() noexcept { return *this; }
+	constexpr const Stats& statsCounter() const noexcept { return *this; }
+
+	constexpr Filter& keyFilter() noexcept { return *this; }
+	constexpr const Filter& keyFilter() const noexcept { return *this; }
+
+	// Dropped whenever elements move, appending at the end keeps it valid
+	constexpr KeyCache& keyCache() noexcept { return *this; }
+	constexpr const KeyCache& keyCache() const noexcept { return *this; }
+
+	constexpr Buffer& insertBuffer() noexcept { return *this; }
+	constexpr const Buffer& insertBuffer() const noexcept { return *this; }
+
+	// After bulk changes, and once erased keys crowd the filter
+	void rebuildFilter() noexcept
+	{
+		if constexpr (kFiltered)
+		{
+			keyFilter().clear();
+			for (size_t i = 0; i != m_endIndex; ++i)
+				keyFilter().add(m_storage.key(i));
+		}
+	}
+
+	// emit() of merge_by_key, appends in order
+	auto appender() noexcept
+	{
+		return [this](const KeyType& key, const ValueType& value) {
+			if (m_endIndex == _MaxMembers)
+				flatmap::detail::throw_range_error(__PRETTY_FUNCTION__);
+			m_storage.set(m_endIndex++, KeyValuePair{key, value});
+			statsCounter().count_inserts(1, m_endIndex);
+			keyFilter().add(key);
+		};
+	}
+
+	// Fills [0, size() + other.size()) from the back, elements are read before their slot is
+	// written. With unique keys every key in both leaves a hole, closed at the end by moving
+	// the merged part down once.
+	template <class Resolve>
+	void mergeBackward(const StaticFlatMap& other, Resolve& resolve) noexcept
+	{
+		const _Compare& comp = *this;
+		size_t required = m_endIndex + other.m_endIndex;
+		size_t i = m_endIndex, j = other.m_endIndex, out = required;
+		while (j != 0)
+		{
+			const KeyType& key = other.m_storage.key(j - 1);
+			--out;
+			// equal keys: the other map's go last
+			if (i != 0 && comp(key, m_storage.key(i - 1)))
+			{
+				m_storage.copy_element(--i, out);
+			}
+			else if (kUniqueKeys && i != 0 && !comp(m_storage.key(i - 1), key))
+			{
+				--i;
+				--j;
+				ValueType value = resolve(m_storage.key(i), m_storage.value(i), other.m_storage.value(j));
+				m_storage.set(out, KeyValuePair{m_storage.key(i), value});
+			}
+			else
+			{
+				--j;
+				m_storage.set(out, KeyValuePair{key, other.m_storage.value(j)});
+			}
+		}
+		// [0, i) is untouched, the merged elements start at `out`
+		m_storage.shift_left(i, out - i, required);
+		size_t moved = out != i ? 2 * (required - out) : required - out;
+		statsCounter().count_moved(moved * kElementSize);
+		statsCounter().count_inserts(required - (out - i) - m_endIndex, required - (out - i));
+		m_endIndex = required - (out - i);
+		for (size_t k = 0; k != other.m_endIndex; ++k)
+			keyFilter().add(other.m_storage.key(k));
+		keyCache().invalidate();
+	}
+
+	iterator eraseByIndex(size_t index, size_t count) noexcept
+	{
+		if constexpr (kBuffered)
+		{
+			size_t sorted = sortedSize();
+			if (index + count > sorted)
+				insertBuffer()._pending -= index + count - std::max(index, sorted);
+		}
+		if (count != 0)
+			statsCounter().count_moved((m_endIndex - index - count) * kElementSize);
+		statsCounter().count_erases(count);
+		m_storage.shift_left(index, count, m_endIndex);
+		m_endIndex -= count;
+		if (keyFilter().erased(count, m_endIndex))
+			rebuildFilter();
+		if (count != 0)
+			keyCache().invalidate();
+		return m_storage.at(index);
+	}
+
+	void insertByIndex(size_t index, const KeyValuePair& val)
 	{
 		if (size() == _MaxMembers)
-			throwRangeError(val, __PRETTY_FUNCTION__);
-		std::copy_backward(position, end(), end() + 1);
-		*position = val;
+			flatmap::detail::throw_range_error(__PRETTY_FUNCTION__);
+		insertByIndexUnchecked(index, val);
+	}
+
+	void insertByIndexUnchecked(size_t index, const KeyValuePair& val) noexcept
+	{
+		statsCounter().count_moved((m_endIndex - index) * kElementSize);
+		m_storage.shift_right(index, m_endIndex);
+		m_storage.set(index, val);
 		++m_endIndex;
+		statsCounter().count_inserts(1, m_endIndex);
+		keyFilter().add(val.first);
+		keyCache().invalidate();
 	}
 
-	void throwRangeError(const KeyValuePair& val, const char* throwingFunction)
+	size_t appendPending(const KeyValuePair& val)
 	{
-		std::stringstream errorMessage;
-		errorMessage << throwingFunction << " : Out of range! key = " << val.first << " value = " << val.second;
-		throw std::range_error(errorMessage.str().c_str());
+		if (m_endIndex == _MaxMembers)
+			flatmap::detail::throw_range_error(__PRETTY_FUNCTION__);
+		return appendPendingUnchecked(val);
 	}
 
-	void throwOutOfRangeError(const KeyType& key, const char* throwingFunction)
+	// Appends to the pending inserts, they are merged once kMaxPending of them wait. Returns
+	// where the element is. The elements before it don't move, cached positions stay valid.
+	size_t appendPendingUnchecked(const KeyValuePair& val) noexcept
 	{
-		std::stringstream errorMessage;
-		errorMessage << throwingFunction << " : Could not find object in map! key = " << key;
-		throw std::out_of_range(errorMessage.str().c_str());
+		m_storage.set(m_endIndex++, val);
+		statsCounter().count_inserts(1, m_endIndex);
+		keyFilter().add(val.first);
+		if (++insertBuffer()._pending < kMaxPending)
+			return m_endIndex - 1;
+		flushPending();
+		// the last of the equal keys of a multimap
+		return kUniqueKeys ? lowerBound(val.first) : upperBound(val.first) - 1;
 	}
 
-	static bool compareFunction(const KeyValuePair& first, const KeyValuePair& second) noexcept
+	// Sorts the pending inserts aside, on the stack, and merges them with the sorted part from
+	// the back. Equal keys keep their insertion order, the pending ones go after the others.
+	void flushPending() noexcept
 	{
-		static _Compare less;
-		return less(first.first, second.first);
+		size_t n = insertBuffer().pending();
+		size_t sorted = m_endIndex - n;
+		alignas(KeyType) unsigned char keyBytes[sizeof(KeyType) * kMaxPending];
+		alignas(ValueType) unsigned char valueBytes[sizeof(ValueType) * kMaxPending];
+		KeyType* keys = reinterpret_cast<KeyType*>(keyBytes);
+		ValueType* values = reinterpret_cast<ValueType*>(valueBytes);
+		for (size_t k = 0; k != n; ++k)
+		{
+			std::memcpy(static_cast<void*>(keys + k), &m_storage.key(sorted + k), sizeof(KeyType));
+			std::memcpy(static_cast<void*>(values + k), &m_storage.value(sorted + k), sizeof(ValueType));
+		}
+
+		const _Compare& comp = *this;
+		unsigned short order[kMaxPending];
+		for (size_t k = 0; k != n; ++k)
+			order[k] = static_cast<unsigned short>(k);
+		std::sort(order, order + n, [&](unsigned short a, unsigned short b) {
+			return comp(keys[a], keys[b]) || (!comp(keys[b], keys[a]) && a < b);
+		});
+
+		size_t i = sorted, j = n, out = m_endIndex;
+		while (j != 0)
+		{
+			--out;
+			size_t k = order[j - 1];
+			if (i != 0 && comp(keys[k], m_storage.key(i - 1)))
+			{
+				m_storage.copy_element(--i, out);
+			}
+			else
+			{
+				--j;
+				m_storage.set(out, KeyValuePair{keys[k], values[k]});
+			}
+		}
+		insertBuffer()._pending = 0;
+		statsCounter().count_moved((m_endIndex - i) * kElementSize);
+		keyCache().invalidate();
 	}
 
-	ContainerType m_sortedArray;
-	size_t        m_endIndex = 0;
+	Storage m_storage = Storage::create();
+	size_t  m_endIndex = 0;
 };
 
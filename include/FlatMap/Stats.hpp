@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Usage statistics of the maps built with flatmap::CollectStats (see
+// Policies.hpp), read with stats():
+//
+//     FlatMap<int, int, std::less<int>, flatmap::CollectStats> map;
+//     ...
+//     flatmap::MapStats s = map.stats();
+//     log(s.hit_ratio(), s.probes_per_lookup(), s.bytes_moved, s.peak_size);
+namespace flatmap {
+
+struct MapStats {
+    std::uint64_t lookups = 0;       // find(), contains(), at(), erase(key), ...
+    std::uint64_t hits = 0;          // lookups that found the key
+    std::uint64_t probes = 0;        // binary search steps of those lookups
+    std::uint64_t inserts = 0;       // elements added, single or in bulk
+    std::uint64_t erases = 0;        // elements removed
+    std::uint64_t bytes_moved = 0;   // shifted by inserts and erases, copied by growth and merges
+    std::size_t   peak_size = 0;     // largest size() seen
+    std::size_t   size = 0;          // at the time of the snapshot
+    std::size_t   capacity = 0;
+
+    std::uint64_t misses() const noexcept
+    {
+        return lookups - hits;
+    }
+
+    double hit_ratio() const noexcept
+    {
+        return lookups != 0 ? static_cast<double>(hits) / lookups : 0.0;
+    }
+
+    double probes_per_lookup() const noexcept
+    {
+        return lookups != 0 ? static_cast<double>(probes) / lookups : 0.0;
+    }
+};
+
+namespace detail {
+
+// Base class of the maps holding their counters. The counters are plain
+// integers, updated by const lookups too: a map with stats is not safe to
+// read from several threads at once.
+template <bool _Enabled>
+struct StatsCounter {
+    constexpr void count_lookup(bool, std::size_t) const noexcept {}
+    constexpr void count_moved(std::size_t) noexcept {}
+    constexpr void count_inserts(std::size_t, std::size_t) noexcept {}
+    constexpr void count_erases(std::size_t) noexcept {}
+};
+
+template <>
+struct StatsCounter<true> {
+    // One lookup among `n` sorted keys.
+    constexpr void count_lookup(bool hit, std::size_t n) const noexcept
+    {
+        ++_stats.lookups;
+        _stats.hits += hit;
+        _stats.probes += search_steps(n);
+    }
+
+    constexpr void count_moved(std::size_t bytes) noexcept
+    {
+        _stats.bytes_moved += bytes;
+    }
+
+    // `count` elements added, `size` now.
+    constexpr void count_inserts(std::size_t count, std::size_t size) noexcept
+    {
+        _stats.inserts += count;
+        if (size > _stats.peak_size)
+            _stats.peak_size = size;
+    }
+
+    constexpr void count_erases(std::size_t count) noexcept
+    {
+        _stats.erases += count;
+    }
+
+    // Copies and assignments bring elements in without counting them, the
+    // peak is at least the current size.
+    MapStats snapshot(std::size_t size, std::size_t capacity) const noexcept
+    {
+        MapStats s = _stats;
+        if (size > s.peak_size)
+            s.peak_size = size;
+        s.size = size;
+        s.capacity = capacity;
+        return s;
+    }
+
+    // Keeps the current size as the peak.
+    void reset(std::size_t size) noexcept
+    {
+        _stats = MapStats{};
+        _stats.peak_size = size;
+    }
+
+    // ceil(log2(n + 1)), the halvings of a binary search over n keys
+    static constexpr std::uint64_t search_steps(std::size_t n) noexcept
+    {
+        return n != 0 ? 64 - __builtin_clzll(static_cast<unsigned long long>(n)) : 0;
+    }
+
+    mutable MapStats _stats;
+};
+
+} // ~detail
+
+} // ~flatmap
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <iterator>
+#include <type_traits>
+
+
+namespace flatmap {
+
+// Construction / insertion tags telling the map that the input range is
+// already sorted by the map's comparator, so no sort is needed.
+
+// sorted, and no two keys are equivalent
+struct sorted_unique_t { explicit sorted_unique_t() = default; };
+inline constexpr sorted_unique_t sorted_unique{};
+
+// sorted, equivalent keys are allowed (kept in their input order)
+struct sorted_equivalent_t { explicit sorted_equivalent_t() = default; };
+inline constexpr sorted_equivalent_t sorted_equivalent{};
+
+// constant expression construction (StaticFlatMap): the elements are insertion
+// sorted into a zeroed array, quadratic, for the small tables built at compile time
+struct constant_init_t { explicit constant_init_t() = default; };
+inline constexpr constant_init_t constant_init{};
+
+// Outcome of the non-throwing insertions (StaticFlatMap::try_insert)
+enum class InsertStatus : unsigned char {
+    Inserted,
+    Exists,     // unique keys only, the element with that key was left as is
+    Overflow,   // the map is full, nothing was inserted
+};
+
+namespace detail {
+
+template <class _It, class = void>
+struct is_iterator : std::false_type {};
+
+template <class _It>
+struct is_iterator<_It, std::void_t<typename std::iterator_traits<_It>::iterator_category>>
+    : std::true_type {};
+
+template <class _It>
+using enable_if_iterator_t = std::enable_if_t<is_iterator<_It>::value>;
+
+} // ~detail
+
+} // ~flatmap
@@ -0,0 +1,606 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Merge.hpp"
+#include "Tags.hpp"
+#include "detail/Config.hpp"
+#include "detail/Search.hpp"
+#include "detail/SplitIterator.hpp"
+
+
+// Sorted map for the sizes where a single flat array gets too costly to
+// insert into: the elements live in fixed capacity sorted blocks of
+// `_BlockSize` elements (split layout, like FlatMap), and a flat routing index
+// holds the smallest key of every block. A B+-tree of height two, in effect.
+//
+// A lookup searches the routing index, then one block. An insert moves at
+// most one block worth of elements, a full block is split in two halves first
+// and the index gets one more entry. An erase empties or merges blocks the
+// same way. Iteration walks the blocks in order and stays sequential within
+// one. Keys are unique.
+//
+// Any insert or erase invalidates iterators.
+template <
+    typename _Key,
+    typename _T,
+    typename _Compare = std::less<_Key>,
+    std::size_t _BlockSize = 256
+>
+class TieredFlatMap
+    : private _Compare
+{
+    static_assert(std::is_trivially_copyable<_Key>::value,
+            "TieredFlatMap key type must be Trivially Copyable");
+    static_assert(std::is_trivially_copyable<_T>::value,
+            "TieredFlatMap mapped type must be Trivially Copyable");
+    static_assert(_BlockSize >= 4, "TieredFlatMap blocks need room for at least 4 elements");
+
+    struct Block;
+    template <bool _Const> class Iterator;
+
+public:
+    using key_compare = _Compare;
+    using key_type = _Key;
+    using mapped_type = _T;
+    using value_type = std::pair<key_type, mapped_type>;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    using reference = typename iterator::reference;
+    using const_reference = typename const_iterator::reference;
+    using pointer = typename iterator::pointer;
+    using const_pointer = typename const_iterator::pointer;
+
+    static constexpr size_type block_size = _BlockSize;
+
+    TieredFlatMap(const key_compare& comp = key_compare()) noexcept
+        : _Compare{comp} {}
+
+    template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+    TieredFlatMap(InputIt first, InputIt last, const key_compare& comp = key_compare())
+        : _Compare{comp}
+    {
+        insert(first, last);
+    }
+
+    TieredFlatMap(std::initializer_list<value_type> values, const key_compare& comp = key_compare())
+        : TieredFlatMap(values.begin(), values.end(), comp) {}
+
+    TieredFlatMap(const TieredFlatMap& other)
+        : _Compare{other.key_comp()}, _mins{other._mins}, _size{other._size}
+    {
+        _blocks.reserve(other._blocks.size());
+        for (const auto& block : other._blocks) {
+            _blocks.push_back(_new_block());
+            _blocks.back()->copy_from(*block, 0, block->size, 0);
+            _blocks.back()->size = block->size;
+        }
+    }
+
+    TieredFlatMap(TieredFlatMap&& other) noexcept
+        : _Compare{other.key_comp()}
+    {
+        swap(other);
+    }
+
+    TieredFlatMap& operator=(const TieredFlatMap& other)
+    {
+        if (this != &other) {
+            TieredFlatMap tmp{other};
+            swap(tmp);
+        }
+        return *this;
+    }
+
+    TieredFlatMap& operator=(TieredFlatMap&& other) noexcept
+    {
+        TieredFlatMap tmp{std::move(other)};
+        swap(tmp);
+        return *this;
+    }
+
+    iterator begin() noexcept
+    {
+        return iterator{_blocks.data(), 0};
+    }
+
+    const_iterator begin() const noexcept
+    {
+        return const_iterator{_blocks.data(), 0};
+    }
+
+    const_iterator cbegin() const noexcept
+    {
+        return begin();
+    }
+
+    iterator end() noexcept
+    {
+        return iterator{_blocks.data() + _blocks.size(), 0};
+    }
+
+    const_iterator end() const noexcept
+    {
+        return const_iterator{_blocks.data() + _blocks.size(), 0};
+    }
+
+    const_iterator cend() const noexcept
+    {
+        return end();
+    }
+
+    constexpr bool empty() const noexcept
+    {
+        return _size == 0u;
+    }
+
+    constexpr size_type size() const noexcept
+    {
+        return _size;
+    }
+
+    // Number of blocks in use, at least size() / block_size.
+    size_type block_count() const noexcept
+    {
+        return _blocks.size();
+    }
+
+    void clear() noexcept
+    {
+        _blocks.clear();
+        _mins.clear();
+        _size = 0;
+    }
+
+    std::pair<iterator, bool> insert(const value_type& x)
+    {
+        if (_blocks.empty()) {
+            _mins.reserve(1);
+            _blocks.push_back(_new_block());
+            _mins.push_back(x.first);
+        }
+
+        size_type b = _route(x.first);
+        size_type pos = _block_lower_bound(*_blocks[b], x.first);
+        if (pos != _blocks[b]->size && !_comp()(x.first, _blocks[b]->keys()[pos]))
+            return std::make_pair(_make_iterator(b, pos), false);
+
+        if (_blocks[b]->size == _BlockSize) {
+            _split(b);
+            // on the boundary, append to the first half: the second keeps its min
+            if (pos > _half) {
+                ++b;
+                pos -= _half;
+            }
+        }
+        Block& block = *_blocks[b];
+        block.open(pos);
+        block.keys()[pos] = x.first;
+        block.vals()[pos] = x.second;
+        if (pos == 0)
+            _mins[b] = x.first;
+        ++_size;
+        return std::make_pair(_make_iterator(b, pos), true);
+    }
+
+    // Sorts the new elements and drops the duplicates first, keys already in
+    // the map keep their value. Many of them at once are merged with the
+    // current contents and the blocks rebuilt, full, in one pass.
+    template <class InputIt, typename = flatmap::detail::enable_if_iterator_t<InputIt>>
+    void insert(InputIt first, InputIt last)
+    {
+        std::vector<value_type> buf(first, last);
+        const key_compare& comp = _comp();
+        auto less = [&](const value_type& a, const value_type& b) { return comp(a.first, b.first); };
+        auto same = [&](const value_type& a, const value_type& b) { return !comp(a.first, b.first); };
+        std::stable_sort(buf.begin(), buf.end(), less);
+        buf.erase(std::unique(buf.begin(), buf.end(), same), buf.end());
+
+        if (buf.size() * _BlockSize < _size) {
+            for (const auto& kv : buf)
+                insert(kv);
+            return;
+        }
+        if (_size != 0) {
+            std::vector<value_type> merged;
+            merged.reserve(_size + buf.size());
+            flatmap::KeepLeft resolve;
+            flatmap::detail::merge_by_key<true, true, true>(begin(), end(), buf.begin(), buf.end(),
+                comp, resolve, [&](const key_type& key, const mapped_type& val) {
+                    merged.emplace_back(key, val);
+                });
+            buf.swap(merged);
+        }
+        _build(buf);
+    }
+
+    void insert(std::initializer_list<value_type> values)
+    {
+        insert(values.begin(), values.end());
+    }
+
+    iterator find(const key_type& key) noexcept
+    {
+        auto at = _find(key);
+        return _make_iterator(at.first, at.second);
+    }
+
+    const_iterator find(const key_type& key) const noexcept
+    {
+        auto at = _find(key);
+        return _make_iterator(at.first, at.second);
+    }
+
+    size_type count(const key_type& key) const noexcept
+    {
+        return contains(key) ? 1 : 0;
+    }
+
+    bool contains(const key_type& key) const noexcept
+    {
+        return _find(key).first != _blocks.size();
+    }
+
+    iterator lower_bound(const key_type& key) noexcept
+    {
+        auto at = _lower_bound(key);
+        return _make_iterator(at.first, at.second);
+    }
+
+    const_iterator lower_bound(const key_type& key) const noexcept
+    {
+        auto at = _lower_bound(key);
+        return _make_iterator(at.first, at.second);
+    }
+
+    iterator upper_bound(const key_type& key) noexcept
+    {
+        auto at = _upper_bound(key);
+        return _make_iterator(at.first, at.second);
+    }
+
+    const_iterator upper_bound(const key_type& key) const noexcept
+    {
+        auto at = _upper_bound(key);
+        return _make_iterator(at.first, at.second);
+    }
+
+    std::pair<iterator, iterator> equal_range(const key_type& key) noexcept
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const key_type& key) const noexcept
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    iterator erase(const_iterator pos) noexcept
+    {
+        return _erase(static_cast<size_type>(pos._slot - _blocks.data()), pos._pos);
+    }
+
+    iterator erase(iterator pos) noexcept
+    {
+        return erase(const_iterator{pos});
+    }
+
+    size_type erase(const key_type& key) noexcept
+    {
+        auto at = _find(key);
+        if (at.first == _blocks.size())
+            return 0;
+        _erase(at.first, at.second);
+        return 1;
+    }
+
+    void swap(TieredFlatMap& other) noexcept(std::is_nothrow_swappable<_Compare>::value)
+    {
+        _blocks.swap(other._blocks);
+        _mins.swap(other._mins);
+        std::swap(_size, other._size);
+        std::swap(static_cast<_Compare&>(*this), static_cast<_Compare&>(other));
+    }
+
+    constexpr key_compare key_comp() const noexcept { return *this; }
+
+private:
+    static constexpr size_type _half = _BlockSize / 2;
+
+    // Split layout within the block too, a block search only reads keys.
+    // Elements [0, size) are in use.
+    struct alignas(FLATMAP_CACHELINE_SIZE) Block {
+        alignas(key_type)    unsigned char key_bytes[sizeof(key_type) * _BlockSize];
+        alignas(mapped_type) unsigned char val_bytes[sizeof(mapped_type) * _BlockSize];
+        size_type size = 0;
+
+        key_type*    keys() noexcept { return reinterpret_cast<key_type*>(key_bytes); }
+        mapped_type* vals() noexcept { return reinterpret_cast<mapped_type*>(val_bytes); }
+        const key_type*    keys() const noexcept { return reinterpret_cast<const key_type*>(key_bytes); }
+        const mapped_type* vals() const noexcept { return reinterpret_cast<const mapped_type*>(val_bytes); }
+
+        // Shifts [pos, size) up by one, size grows.
+        void open(size_type pos) noexcept
+        {
+            std::memmove(keys() + pos + 1, keys() + pos, sizeof(key_type) * (size - pos));
+            std::memmove(vals() + pos + 1, vals() + pos, sizeof(mapped_type) * (size - pos));
+            ++size;
+        }
+
+        // Shifts (pos, size) down by one, size shrinks.
+        void close(size_type pos) noexcept
+        {
+            std::memmove(keys() + pos, keys() + pos + 1, sizeof(key_type) * (size - pos - 1));
+            std::memmove(vals() + pos, vals() + pos + 1, sizeof(mapped_type) * (size - pos - 1));
+            --size;
+        }
+
+        void copy_from(const Block& other, size_type from, size_type count, size_type to) noexcept
+        {
+            std::memcpy(keys() + to, other.keys() + from, sizeof(key_type) * count);
+            std::memcpy(vals() + to, other.vals() + from, sizeof(mapped_type) * count);
+        }
+    };
+
+    using block_ptr = std::unique_ptr<Block>;
+
+    // Default initialized, the element arrays are left as they are.
+    static block_ptr _new_block()
+    {
+        return block_ptr{new Block};
+    }
+
+    // Last block whose min is not after `key`, the first one for keys
+    // before them all.
+    size_type _route(const key_type& key) const noexcept
+    {
+        // a lower bound with the comparator itself keeps the SIMD search
+        size_type n = flatmap::detail::lower_bound(_mins.data(), _mins.size(), key, _comp());
+        if (n != _mins.size() && !_comp()(key, _mins[n]))
+            return n;
+        return n == 0 ? 0 : n - 1;
+    }
+
+    size_type _block_lower_bound(const Block& block, const key_type& key) const noexcept
+    {
+        return flatmap::detail::lower_bound(block.keys(), block.size, key, _comp());
+    }
+
+    // (block, position), (block_count, 0) when past the end.
+    std::pair<size_type, size_type> _lower_bound(const key_type& key) const noexcept
+    {
+        if (_blocks.empty())
+            return {0, 0};
+        size_type b = _route(key);
+        return _normalize(b, _block_lower_bound(*_blocks[b], key));
+    }
+
+    std::pair<size_type, size_type> _upper_bound(const key_type& key) const noexcept
+    {
+        auto at = _lower_bound(key);
+        if (at.first != _blocks.size() && !_comp()(key, _blocks[at.first]->keys()[at.second]))
+            return _normalize(at.first, at.second + 1);
+        return at;
+    }
+
+    std::pair<size_type, size_type> _find(const key_type& key) const noexcept
+    {
+        if (_blocks.empty())
+            return {0, 0};
+        size_type b = _route(key);
+        const Block& block = *_blocks[b];
+        size_type pos = _block_lower_bound(block, key);
+        if (pos != block.size && !_comp()(key, block.keys()[pos]))
+            return {b, pos};
+        return {_blocks.size(), 0};
+    }
+
+    std::pair<size_type, size_type> _normalize(size_type b, size_type pos) const noexcept
+    {
+        if (b < _blocks.size() && pos == _blocks[b]->size)
+            return {b + 1, 0};
+        return {b, pos};
+    }
+
+    // The upper half of block `b` moves to a new block right after it.
+    void _split(size_type b)
+    {
+        block_ptr next = _new_block();
+        _blocks.reserve(_blocks.size() + 1);
+        _mins.reserve(_mins.size() + 1);
+
+        Block& block = *_blocks[b];
+        next->copy_from(block, _half, _BlockSize - _half, 0);
+        next->size = _BlockSize - _half;
+        block.size = _half;
+        _mins.insert(_mins.begin() + b + 1, next->keys()[0]);
+        _blocks.insert(_blocks.begin() + b + 1, std::move(next));
+    }
+
+    // Drops an emptied block, folds a block into its neighbour once both fit
+    // in half a block, so blocks stay at least a quarter full on average.
+    iterator _erase(size_type b, size_type pos) noexcept
+    {
+        Block& block = *_blocks[b];
+        block.close(pos);
+        --_size;
+
+        if (block.size == 0) {
+            _remove_block(b);
+        } else {
+            if (pos == 0)
+                _mins[b] = block.keys()[0];
+            if (b + 1 < _blocks.size() && block.size + _blocks[b + 1]->size <= _half) {
+                _absorb_next(b);
+            } else if (b != 0 && _blocks[b - 1]->size + block.size <= _half) {
+                pos += _blocks[b - 1]->size;
+                --b;
+                _absorb_next(b);
+            }
+        }
+        auto at = _normalize(b, pos);
+        return _make_iterator(at.first, at.second);
+    }
+
+    void _absorb_next(size_type b) noexcept
+    {
+        Block& block = *_blocks[b];
+        const Block& next = *_blocks[b + 1];
+        block.copy_from(next, 0, next.size, block.size);
+        block.size += next.size;
+        _remove_block(b + 1);
+    }
+
+    void _remove_block(size_type b) noexcept
+    {
+        _blocks.erase(_blocks.begin() + b);
+        _mins.erase(_mins.begin() + b);
+    }
+
+    // Full blocks out of sorted, unique elements.
+    void _build(const std::vector<value_type>& sorted)
+    {
+        std::vector<block_ptr> blocks;
+        std::vector<key_type> mins;
+        size_type count = (sorted.size() + _BlockSize - 1) / _BlockSize;
+        blocks.reserve(count);
+        mins.reserve(count);
+        for (size_type i = 0; i < sorted.size(); i += _BlockSize) {
+            blocks.push_back(_new_block());
+            Block& block = *blocks.back();
+            block.size = std::min(_BlockSize, sorted.size() - i);
+            for (size_type j = 0; j < block.size; ++j) {
+                block.keys()[j] = sorted[i + j].first;
+                block.vals()[j] = sorted[i + j].second;
+            }
+            mins.push_back(block.keys()[0]);
+        }
+        _blocks.swap(blocks);
+        _mins.swap(mins);
+        _size = sorted.size();
+    }
+
+    const key_compare& _comp() const noexcept { return *this; }
+
+    iterator _make_iterator(size_type b, size_type pos) noexcept
+    {
+        return iterator{_blocks.data() + b, pos};
+    }
+
+    const_iterator _make_iterator(size_type b, size_type pos) const noexcept
+    {
+        return const_iterator{_blocks.data() + b, pos};
+    }
+
+    std::vector<block_ptr> _blocks;
+    std::vector<key_type>  _mins;   // routing index, _mins[i] is the first key of block i
+    size_type              _size = 0;
+};
+
+// Bidirectional, a block slot and a position in the block. end() is one slot
+// past the last block.
+template <typename Key, typename T, typename Compare, std::size_t BlockSize>
+template <bool _Const>
+class TieredFlatMap<Key, T, Compare, BlockSize>::Iterator {
+    using slot_pointer = const std::unique_ptr<Block>*;
+
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = TieredFlatMap::value_type;
+    using difference_type = TieredFlatMap::difference_type;
+    using reference = std::pair<const Key&, std::conditional_t<_Const, const T&, T&>>;
+    using pointer = flatmap::detail::PairPtr<reference>;
+
+    Iterator() noexcept = default;
+
+    // iterator -> const_iterator
+    template <bool C = _Const, typename = std::enable_if_t<C>>
+    Iterator(const Iterator<false>& other) noexcept
+        : _slot{other._slot}, _pos{other._pos}
+    {}
+
+    reference operator*() const noexcept
+    {
+        return reference{(*_slot)->keys()[_pos], (*_slot)->vals()[_pos]};
+    }
+
+    pointer operator->() const noexcept
+    {
+        return pointer{**this};
+    }
+
+    Iterator& operator++() noexcept
+    {
+        if (++_pos == (*_slot)->size) {
+            ++_slot;
+            _pos = 0;
+        }
+        return *this;
+    }
+
+    Iterator operator++(int) noexcept
+    {
+        Iterator tmp{*this};
+        ++(*this);
+        return tmp;
+    }
+
+    Iterator& operator--() noexcept
+    {
+        if (_pos == 0) {
+            --_slot;
+            _pos = (*_slot)->size;
+        }
+        --_pos;
+        return *this;
+    }
+
+    Iterator operator--(int) noexcept
+    {
+        Iterator tmp{*this};
+        --(*this);
+        return tmp;
+    }
+
+    friend bool operator==(const Iterator& a, const Iterator& b) noexcept
+    {
+        return a._slot == b._slot && a._pos == b._pos;
+    }
+
+    friend bool operator!=(const Iterator& a, const Iterator& b) noexcept
+    {
+        return !(a == b);
+    }
+
+private:
+    friend class TieredFlatMap;
+    template <bool> friend class Iterator;
+
+    Iterator(slot_pointer slot, size_type pos) noexcept
+        : _slot{slot}, _pos{pos}
+    {}
+
+    slot_pointer _slot = nullptr;
+    size_type    _pos = 0;
+};
+
+namespace std {
+
+template <class Key, class T, class Compare, std::size_t BlockSize>
+void swap(TieredFlatMap<Key, T, Compare, BlockSize>& x, TieredFlatMap<Key, T, Compare, BlockSize>& y) noexcept
+{
+    x.swap(y);
+}
+
+} // ~std
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace flatmap::detail {
+
+// Filter of the default policy, lets every key through.
+struct NoKeyFilter {
+    template <class _Key>
+    constexpr bool may_contain(const _Key&) const noexcept { return true; }
+
+    template <class _Key>
+    constexpr void add(const _Key&) noexcept {}
+
+    constexpr bool erased(std::size_t, std::size_t) noexcept { return false; }
+
+    constexpr void clear() noexcept {}
+};
+
+// Blocked Bloom filter over the integral keys of a map holding at most
+// `_Capacity` of them, `_BitsPerKey` bits each. A key sets 4 bits of one
+// 64 byte block, so a lookup costs a multiply and a single cache line: a
+// key that was never added is rejected there with a probability of about
+// 97% at 8 bits per key (full map), 99.8% at 16.
+//
+// Keys cannot be taken out. Erased keys keep their bits, erased() counts
+// them and asks for a rebuild once they outnumber the live keys.
+template <std::size_t _Capacity, std::size_t _BitsPerKey>
+class BlockedBloomFilter {
+public:
+    static constexpr std::size_t block_bits = 512;
+    static constexpr std::size_t blocks =
+        (_Capacity * _BitsPerKey + block_bits - 1) / block_bits != 0
+            ? (_Capacity * _BitsPerKey + block_bits - 1) / block_bits : 1;
+
+    template <class _Key>
+    constexpr bool may_contain(const _Key& key) const noexcept
+    {
+        std::uint64_t h = _hash(key);
+        const std::uint64_t* block = _words + _block(h) * 8;
+        for (int i = 0; i < 4; ++i, h >>= 9) {
+            if ((block[(h >> 6) & 7] & (std::uint64_t{1} << (h & 63))) == 0)
+                return false;
+        }
+        return true;
+    }
+
+    template <class _Key>
+    constexpr void add(const _Key& key) noexcept
+    {
+        std::uint64_t h = _hash(key);
+        std::uint64_t* block = _words + _block(h) * 8;
+        for (int i = 0; i < 4; ++i, h >>= 9)
+            block[(h >> 6) & 7] |= std::uint64_t{1} << (h & 63);
+    }
+
+    // `count` keys were erased, `size` are left. True when the filter should
+    // be cleared and the live keys added again.
+    constexpr bool erased(std::size_t count, std::size_t size) noexcept
+    {
+        _stale += count;
+        return _stale > size;
+    }
+
+    constexpr void clear() noexcept
+    {
+        for (auto& word : _words)
+            word = 0;
+        _stale = 0;
+    }
+
+private:
+    // Fibonacci hashing, the block comes from the high half, the bits from
+    // the low 36.
+    template <class _Key>
+    static constexpr std::uint64_t _hash(const _Key& key) noexcept
+    {
+        std::uint64_t h = static_cast<std::uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+        return h ^ (h >> 29);
+    }
+
+    static constexpr std::size_t _block(std::uint64_t h) noexcept
+    {
+        return static_cast<std::size_t>(((h >> 32) * blocks) >> 32);
+    }
+
+    std::uint64_t _words[blocks * 8] = {};
+    std::size_t   _stale = 0;
+};
+
+} // ~flatmap::detail
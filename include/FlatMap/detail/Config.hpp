@@ -0,0 +1,42 @@
+#pragma once
+
+
+// FLATMAP_IS_CONSTANT_EVALUATED() tells a constexpr function whether it runs
+// at compile time, so it can stay off the SIMD / library code paths that are
+// not usable in constant expressions. The builtin exists since GCC 9 and
+// Clang 9 (std::is_constant_evaluated is C++20 only).
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define FLATMAP_HAS_IS_CONSTANT_EVALUATED 1
+#endif
+#endif
+
+#if !defined(FLATMAP_HAS_IS_CONSTANT_EVALUATED) && \
+    defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 9
+#define FLATMAP_HAS_IS_CONSTANT_EVALUATED 1
+#endif
+
+#ifdef FLATMAP_HAS_IS_CONSTANT_EVALUATED
+#define FLATMAP_IS_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#else
+#define FLATMAP_IS_CONSTANT_EVALUATED() false
+#endif
+
+// Builds with -fno-exceptions report errors through std::abort().
+#if !defined(FLATMAP_NO_EXCEPTIONS) && !defined(__cpp_exceptions) && !defined(__EXCEPTIONS)
+#define FLATMAP_NO_EXCEPTIONS 1
+#endif
+
+// Error paths are kept out of line and away from the hot code.
+#if defined(__GNUC__) || defined(__clang__)
+#define FLATMAP_COLD __attribute__((cold, noinline))
+#else
+#define FLATMAP_COLD
+#endif
+
+// Alignment that keeps data written by different threads on different cache
+// lines (std::hardware_destructive_interference_size isn't stable across
+// compiler flags, so it's not used in headers).
+#ifndef FLATMAP_CACHELINE_SIZE
+#define FLATMAP_CACHELINE_SIZE 64
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include "Config.hpp"
+
+
+namespace flatmap::detail {
+
+// `function` is the __PRETTY_FUNCTION__ of the caller. Without exceptions
+// the message goes to stderr and the program aborts.
+[[noreturn]] FLATMAP_COLD inline void throw_range_error(const char* function)
+{
+#ifdef FLATMAP_NO_EXCEPTIONS
+    std::fprintf(stderr, "%s : Out of range!\n", function);
+    std::abort();
+#else
+    throw std::range_error(std::string(function) + " : Out of range!");
+#endif
+}
+
+[[noreturn]] FLATMAP_COLD inline void throw_out_of_range(const char* function)
+{
+#ifdef FLATMAP_NO_EXCEPTIONS
+    std::fprintf(stderr, "%s : Could not find object in map!\n", function);
+    std::abort();
+#else
+    throw std::out_of_range(std::string(function) + " : Could not find object in map!");
+#endif
+}
+
+// Everything else: i/o, malformed input files, ...
+[[noreturn]] FLATMAP_COLD inline void throw_runtime_error(const char* function, const std::string& what)
+{
+#ifdef FLATMAP_NO_EXCEPTIONS
+    std::fprintf(stderr, "%s : %s\n", function, what.c_str());
+    std::abort();
+#else
+    throw std::runtime_error(std::string(function) + " : " + what);
+#endif
+}
+
+} // ~flatmap::detail
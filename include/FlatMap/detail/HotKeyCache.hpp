@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+
+namespace flatmap::detail {
+
+// Cache of the default policy, remembers nothing.
+struct NoKeyCache {
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    template <class _Key>
+    constexpr std::size_t find(const _Key&) const noexcept { return npos; }
+
+    template <class _Key>
+    constexpr void store(const _Key&, std::size_t) const noexcept {}
+
+    constexpr void invalidate() noexcept {}
+};
+
+// Positions of recently found integral keys, in `_Sets` sets of 2 entries. A
+// key hashes to one set and is stored in its second entry, a second hit there
+// moves it to the first one. Keys found once (the long tail of a skewed
+// distribution) replace each other in the second entry, the popular ones stay
+// in the first and are answered with one compare.
+//
+// Entries carry the generation they were stored at. invalidate() starts a new
+// generation, which drops all of them without touching them; the map calls it
+// whenever elements move. Lookups store entries (mutable): a map with a cache
+// is not safe to read from several threads at once.
+template <class _Key, std::size_t _Sets>
+class KeyPositionCache {
+public:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    std::size_t find(const _Key& key) const noexcept
+    {
+        Entry* set = _set(key);
+        if (set[0].key == key && set[0].generation == _generation)
+            return set[0].index;
+        if (set[1].key == key && set[1].generation == _generation) {
+            std::swap(set[0], set[1]);
+            return set[0].index;
+        }
+        return npos;
+    }
+
+    void store(const _Key& key, std::size_t index) const noexcept
+    {
+        _set(key)[1] = Entry{key, _generation, static_cast<std::uint32_t>(index)};
+    }
+
+    void invalidate() noexcept
+    {
+        if (++_generation != 0)
+            return;
+        // wrapped around, entries of generation 0 must not come back
+        for (auto& entry : _entries)
+            entry.generation = 0;
+        _generation = 1;
+    }
+
+private:
+    struct Entry {
+        _Key          key;
+        std::uint32_t generation;
+        std::uint32_t index;
+    };
+
+    // Fibonacci hashing, the set comes from the high half
+    Entry* _set(const _Key& key) const noexcept
+    {
+        std::uint64_t h = static_cast<std::uint64_t>(key) * 0x9E3779B97F4A7C15ull;
+        return _entries + 2 * static_cast<std::size_t>(((h >> 32) * _Sets) >> 32);
+    }
+
+    mutable Entry _entries[2 * _Sets] = {};
+    std::uint32_t _generation = 1;
+};
+
+} // ~flatmap::detail
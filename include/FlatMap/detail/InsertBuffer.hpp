@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+
+
+namespace flatmap::detail {
+
+// Number of elements waiting, unsorted, at the end of a map with buffered
+// inserts. Always zero otherwise, and takes no room as an empty base.
+template <bool _Buffered>
+struct InsertBuffer {
+    static constexpr std::size_t pending() noexcept { return 0; }
+};
+
+template <>
+struct InsertBuffer<true> {
+    constexpr std::size_t pending() const noexcept { return _pending; }
+
+    std::size_t _pending = 0;
+};
+
+} // ~flatmap::detail
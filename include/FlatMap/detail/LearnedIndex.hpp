@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "Search.hpp"
+
+
+// Average number of keys per linear segment of the learned index.
+#ifndef FLATMAP_LEARNED_LEAF_KEYS
+#define FLATMAP_LEARNED_LEAF_KEYS 64
+#endif
+
+// Smaller maps are searched as usual: while the keys fit in L2 the binary
+// search is as fast as the model.
+#ifndef FLATMAP_LEARNED_SEARCH_MIN
+#define FLATMAP_LEARNED_SEARCH_MIN 65536
+#endif
+
+namespace flatmap::detail {
+
+// Search index of the default policy, nothing to maintain.
+struct NoIndex {
+    constexpr bool drift(std::size_t) noexcept { return false; }
+
+    template <class _Key>
+    void refit(const _Key*, std::size_t) noexcept {}
+
+    template <class _Key>
+    void refit_in_place(const _Key*, std::size_t) noexcept {}
+};
+
+// Two level learned index (recursive model index) over a sorted array of
+// arithmetic keys. A root linear model maps a key to one of about
+// n / FLATMAP_LEARNED_LEAF_KEYS leaves, each leaf is a linear model of the
+// positions of the keys routed to it plus the largest error it makes on
+// them. A lookup is then two multiply-adds and a search of the few keys
+// around the prediction, instead of log2(n) dependent probes over the whole
+// array.
+//
+// The result is always exact: when the key lies outside the predicted window
+// (eg. it was inserted after the fit) the search goes on in the remaining
+// part of the array. Inserts and erases shift positions by one, drift()
+// widens every window by that much and asks for a refit once the drift gets
+// larger than a leaf.
+template <class _Key>
+class LearnedIndex {
+public:
+    static constexpr std::size_t leaf_keys = FLATMAP_LEARNED_LEAF_KEYS;
+
+    // `moved` elements were inserted or erased somewhere since the last fit,
+    // true when it is time to refit.
+    bool drift(std::size_t moved) noexcept
+    {
+        _slack += moved;
+        return _slack > leaf_keys;
+    }
+
+    // O(n), one pass to route the keys and one to measure the errors.
+    void refit(const _Key* keys, std::size_t n)
+    {
+        if (n >= FLATMAP_LEARNED_SEARCH_MIN)
+            _leaves.reserve(n / leaf_keys);
+        _fit(keys, n);
+    }
+
+    // Never allocates, makes do with the leaves there already (none at all
+    // falls back to the plain search). For the noexcept paths.
+    void refit_in_place(const _Key* keys, std::size_t n) noexcept
+    {
+        _fit(keys, n);
+    }
+
+    // Lower bound of `key` in the `n` keys the index was fitted on, give or
+    // take the slips since.
+    template <class _Compare>
+    std::size_t search(const _Key* keys, std::size_t n, _Key key,
+            const _Compare& comp) const noexcept
+    {
+        if (_leaves.empty())
+            return lower_bound(keys, n, key, comp);
+
+        const Leaf& leaf = _leaves[_route(key)];
+        std::size_t pred = leaf.predict(key);
+        std::size_t err = leaf.err + _slack;
+        std::size_t lo = std::max(_sub(pred, err), _sub(leaf.first, _slack));
+        std::size_t hi = std::min(pred + err + 1, leaf.last + _slack);
+        lo = std::min(lo, n);
+        hi = std::max(std::min(hi, n), lo);
+
+        if (lo != 0 && !comp(keys[lo - 1], key))
+            return lower_bound(keys, lo, key, comp);
+        std::size_t pos = lo + lower_bound(keys + lo, hi - lo, key, comp);
+        if (pos == hi && hi != n && comp(keys[hi], key))
+            return hi + 1 + lower_bound(keys + hi + 1, n - hi - 1, key, comp);
+        return pos;
+    }
+
+private:
+    void _fit(const _Key* keys, std::size_t n) noexcept
+    {
+        _slack = 0;
+        _leaves.clear();
+        if (n < FLATMAP_LEARNED_SEARCH_MIN)
+            return;
+
+        std::size_t count = std::min(std::max<std::size_t>(1, n / leaf_keys), _leaves.capacity());
+        if (count == 0)
+            return;
+        _leaves.resize(count);
+        _min = static_cast<double>(keys[0]);
+        double span = static_cast<double>(keys[n - 1]) - _min;
+        _scale = span > 0 ? static_cast<double>(count) / span : 0.0;
+        _last = count - 1;
+
+        std::size_t i = 0;
+        for (std::size_t j = 0; j < count; ++j) {
+            Leaf& leaf = _leaves[j];
+            leaf.first = i;
+            while (i < n && _route(keys[i]) <= j)
+                ++i;
+            leaf.last = i;
+
+            std::size_t size = leaf.last - leaf.first;
+            leaf.base = size != 0 ? static_cast<double>(keys[leaf.first]) : 0.0;
+            double dx = size > 1 ? static_cast<double>(keys[leaf.last - 1]) - leaf.base : 0.0;
+            leaf.slope = dx > 0 ? static_cast<double>(size - 1) / dx : 0.0;
+
+            std::size_t err = 0;
+            for (std::size_t k = leaf.first; k < leaf.last; ++k) {
+                std::size_t p = leaf.predict(keys[k]);
+                err = std::max(err, p > k ? p - k : k - p);
+            }
+            // a missing key falls in between two neighbours, one more
+            leaf.err = err + 1;
+        }
+    }
+
+    struct Leaf {
+        double      base = 0;    // smallest key of the leaf
+        double      slope = 0;   // positions per key unit
+        std::size_t first = 0;   // [first, last) routed here at fit time
+        std::size_t last = 0;
+        std::size_t err = 0;
+
+        std::size_t predict(_Key key) const noexcept
+        {
+            double p = static_cast<double>(first) + slope * (static_cast<double>(key) - base);
+            if (!(p > static_cast<double>(first)))
+                return first;
+            return p < static_cast<double>(last) ? static_cast<std::size_t>(p) : last;
+        }
+    };
+
+    static std::size_t _sub(std::size_t a, std::size_t b) noexcept
+    {
+        return a > b ? a - b : 0;
+    }
+
+    // Monotonic in the key, so each leaf gets a contiguous run of the array.
+    std::size_t _route(_Key key) const noexcept
+    {
+        double x = (static_cast<double>(key) - _min) * _scale;
+        if (!(x > 0))
+            return 0;
+        return x < static_cast<double>(_last) ? static_cast<std::size_t>(x) : _last;
+    }
+
+    std::vector<Leaf> _leaves;
+    double            _min = 0;
+    double            _scale = 0;
+    std::size_t       _last = 0;
+    std::size_t       _slack = 0;
+};
+
+} // ~flatmap::detail
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+
+#include "Simd.hpp"
+
+
+// Crossover points of the size dispatched search, in number of keys.
+// Up to FLATMAP_LINEAR_SEARCH_MAX keys a full linear scan is used, it has no
+// data dependent branches and vectorizes. From FLATMAP_PREFETCH_SEARCH_MIN keys
+// on the binary search also prefetches both possible next probes, the array no
+// longer fits in L1 at that point. In between a branchless binary search runs.
+#ifndef FLATMAP_LINEAR_SEARCH_MAX
+#define FLATMAP_LINEAR_SEARCH_MAX 32
+#endif
+
+#ifndef FLATMAP_PREFETCH_SEARCH_MIN
+#define FLATMAP_PREFETCH_SEARCH_MIN 2048
+#endif
+
+// Number of searches a batched lookup runs interleaved.
+#ifndef FLATMAP_BATCH_GROUP
+#define FLATMAP_BATCH_GROUP 16
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FLATMAP_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define FLATMAP_PREFETCH(addr) ((void)(addr))
+#endif
+
+namespace flatmap::detail {
+
+// All searches return the lower bound as an index into `keys`, ie. the number
+// of keys that compare less than `key`.
+
+template <class _Key, class _K, class _Compare>
+std::size_t lower_bound_linear(const _Key* keys, std::size_t n, const _K& key,
+        const _Compare& comp) noexcept
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        count += comp(keys[i], key) ? 1 : 0;
+    return count;
+}
+
+template <class _Key, class _K, class _Compare>
+std::size_t lower_bound_branchless(const _Key* keys, std::size_t n, const _K& key,
+        const _Compare& comp) noexcept
+{
+    if (n == 0)
+        return 0;
+    const _Key* base = keys;
+    while (n > 1) {
+        std::size_t half = n / 2;
+        base = comp(base[half], key) ? base + half : base;
+        n -= half;
+    }
+    return (base - keys) + (comp(*base, key) ? 1 : 0);
+}
+
+template <class _Key, class _K, class _Compare>
+std::size_t lower_bound_prefetch(const _Key* keys, std::size_t n, const _K& key,
+        const _Compare& comp) noexcept
+{
+    if (n == 0)
+        return 0;
+    const _Key* base = keys;
+    while (n > 1) {
+        std::size_t half = n / 2;
+        n -= half;
+        FLATMAP_PREFETCH(base + n / 2);
+        FLATMAP_PREFETCH(base + half + n / 2);
+        base = comp(base[half], key) ? base + half : base;
+    }
+    return (base - keys) + (comp(*base, key) ? 1 : 0);
+}
+
+// Arithmetic keys with the standard comparators narrow the range with the
+// binary search down to FLATMAP_SIMD_SCAN_MAX keys and count the rest with a
+// SIMD compare. `_Stride` is the distance between two keys in units of
+// `_Key`, for keys stored in between values (array of pairs).
+template <std::size_t _Stride, class _Key, class _Compare>
+std::size_t lower_bound_simd(const _Key* keys, std::size_t n, _Key key,
+        const _Compare& comp) noexcept
+{
+    const _Key* base = keys;
+    while (n >= FLATMAP_PREFETCH_SEARCH_MIN) {
+        std::size_t half = n / 2;
+        n -= half;
+        FLATMAP_PREFETCH(base + (n / 2) * _Stride);
+        FLATMAP_PREFETCH(base + (half + n / 2) * _Stride);
+        base = comp(base[half * _Stride], key) ? base + half * _Stride : base;
+    }
+    while (n > FLATMAP_SIMD_SCAN_MAX) {
+        std::size_t half = n / 2;
+        base = comp(base[half * _Stride], key) ? base + half * _Stride : base;
+        n -= half;
+    }
+    return (base - keys) / _Stride + count_before<_Stride, _Compare>(base, n, key);
+}
+
+template <class _Key, class _K, class _Compare>
+std::size_t lower_bound(const _Key* keys, std::size_t n, const _K& key,
+        const _Compare& comp) noexcept
+{
+    if constexpr (is_simd_searchable_v<_Key, _K, _Compare>)
+        return lower_bound_simd<1>(keys, n, key, comp);
+    if (n <= FLATMAP_LINEAR_SEARCH_MAX)
+        return lower_bound_linear(keys, n, key, comp);
+    if (n < FLATMAP_PREFETCH_SEARCH_MIN)
+        return lower_bound_branchless(keys, n, key, comp);
+    return lower_bound_prefetch(keys, n, key, comp);
+}
+
+// Group prefetching: the binary searches of FLATMAP_BATCH_GROUP needles
+// advance in lockstep (they all have the same remaining length), and the next
+// probe of each is prefetched as soon as it is known, so the cache misses of
+// the whole group overlap instead of being paid one after the other.
+// `emit(needle, index)` is called with the lower bound of every needle, in
+// input order.
+template <std::size_t _Stride = 1, class _Key, class _KeyIt, class _Compare, class _Emit>
+void lower_bound_batch(const _Key* keys, std::size_t n, _KeyIt first, _KeyIt last,
+        const _Compare& comp, _Emit&& emit)
+{
+    constexpr std::size_t group = FLATMAP_BATCH_GROUP;
+    _Key needles[group];
+    const _Key* base[group];
+
+    while (first != last) {
+        std::size_t count = 0;
+        for (; count < group && first != last; ++count, ++first) {
+            needles[count] = *first;
+            base[count] = keys;
+        }
+
+        if (n == 0) {
+            for (std::size_t i = 0; i < count; ++i)
+                emit(needles[i], std::size_t{0});
+            continue;
+        }
+
+        std::size_t len = n;
+        while (len > 1) {
+            std::size_t half = len / 2;
+            len -= half;
+            for (std::size_t i = 0; i < count; ++i) {
+                base[i] = comp(base[i][half * _Stride], needles[i]) ? base[i] + half * _Stride : base[i];
+                FLATMAP_PREFETCH(base[i] + (len / 2) * _Stride);
+            }
+        }
+        for (std::size_t i = 0; i < count; ++i) {
+            std::size_t index = (base[i] - keys) / _Stride + (comp(*base[i], needles[i]) ? 1 : 0);
+            emit(needles[i], index);
+        }
+    }
+}
+
+} // ~flatmap::detail
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#if !defined(FLATMAP_DISABLE_SIMD) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FLATMAP_SIMD_X86 1
+// Without -mavx2 the AVX2 kernels are still compiled (target attribute) and
+// picked at runtime when the cpu has them.
+#if !defined(__AVX2__) && (defined(__GNUC__) || defined(__clang__))
+#define FLATMAP_SIMD_DISPATCH 1
+#define FLATMAP_TARGET_AVX2   __attribute__((target("avx2")))
+#define FLATMAP_TARGET_SSE42  __attribute__((target("sse4.2")))
+#else
+#define FLATMAP_TARGET_AVX2
+#define FLATMAP_TARGET_SSE42
+#endif
+#endif
+
+// Size of the window, in keys, that the SIMD scan finishes a search on. Bigger
+// ranges are first narrowed down by a branchless binary search.
+#ifndef FLATMAP_SIMD_SCAN_MAX
+#define FLATMAP_SIMD_SCAN_MAX 16
+#endif
+
+namespace flatmap::detail {
+
+template <class _Compare, class _Key>
+constexpr bool is_less_v =
+    std::is_same<_Compare, std::less<_Key>>::value ||
+    std::is_same<_Compare, std::less<>>::value;
+
+template <class _Compare, class _Key>
+constexpr bool is_greater_v =
+    std::is_same<_Compare, std::greater<_Key>>::value ||
+    std::is_same<_Compare, std::greater<>>::value;
+
+// Keys the SIMD kernels know how to compare: 32/64 bit integers and floating
+// points, ordered by std::less / std::greater, looked up by the key type itself.
+template <class _Key, class _K, class _Compare>
+constexpr bool is_simd_searchable_v =
+    std::is_arithmetic<_Key>::value &&
+    !std::is_same<_Key, bool>::value &&
+    (sizeof(_Key) == 4 || sizeof(_Key) == 8) &&
+    std::is_same<std::decay_t<_K>, _Key>::value &&
+    (is_less_v<_Compare, _Key> || is_greater_v<_Compare, _Key>);
+
+// Counts the keys in `keys[0], keys[_Stride], ... keys[(n-1)*_Stride]` that are
+// ordered before `key`. `_Stride > 1` is used when the keys are interleaved
+// with values, lanes holding values are masked out after the compare.
+template <std::size_t _Stride, bool _Greater, class _Key>
+std::size_t count_before_scalar(const _Key* keys, std::size_t n, _Key key) noexcept
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        const _Key k = keys[i * _Stride];
+        count += (_Greater ? key < k : k < key) ? 1 : 0;
+    }
+    return count;
+}
+
+// Position of the first key equal to `key` in an unsorted run of `n` keys,
+// `n` when there is none.
+template <class _Key>
+std::size_t find_equal_scalar(const _Key* keys, std::size_t n, _Key key) noexcept
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        if (keys[i] == key)
+            return i;
+    }
+    return n;
+}
+
+#ifdef FLATMAP_SIMD_X86
+
+// Movemask bits that belong to keys when every `_Stride`th lane is a key.
+template <std::size_t _Lanes, std::size_t _Stride>
+constexpr int lane_pattern() noexcept
+{
+    int pattern = 0;
+    for (std::size_t i = 0; i < _Lanes; i += _Stride)
+        pattern |= 1 << i;
+    return pattern;
+}
+
+template <std::size_t _Lanes, std::size_t _Stride>
+constexpr bool has_kernel_v = _Stride <= _Lanes / 2 && _Lanes % _Stride == 0;
+
+inline int popcount(int mask) noexcept
+{
+    return __builtin_popcount(static_cast<unsigned>(mask));
+}
+
+// Integers are compared signed, unsigned keys get their sign bit flipped.
+template <class _Key>
+constexpr std::int64_t sign_bias() noexcept
+{
+    return std::is_signed<_Key>::value ? 0 :
+        sizeof(_Key) == 4 ? std::int64_t{INT32_MIN} : INT64_MIN;
+}
+
+template <std::size_t _Stride, bool _Greater, class _Key>
+FLATMAP_TARGET_AVX2
+std::size_t count_before_avx2(const _Key* keys, std::size_t n, _Key key) noexcept
+{
+    constexpr std::size_t lanes = 32 / sizeof(_Key);
+    constexpr std::size_t step  = lanes / _Stride;
+    constexpr int pattern = lane_pattern<lanes, _Stride>();
+
+    std::size_t count = 0;
+    std::size_t i = 0;
+    if constexpr (std::is_same<_Key, float>::value) {
+        const __m256 k = _mm256_set1_ps(key);
+        for (; i + step <= n; i += step) {
+            __m256 v = _mm256_loadu_ps(keys + i * _Stride);
+            __m256 m = _Greater ? _mm256_cmp_ps(k, v, _CMP_LT_OQ) : _mm256_cmp_ps(v, k, _CMP_LT_OQ);
+            count += popcount(_mm256_movemask_ps(m) & pattern);
+        }
+    } else if constexpr (std::is_same<_Key, double>::value) {
+        const __m256d k = _mm256_set1_pd(key);
+        for (; i + step <= n; i += step) {
+            __m256d v = _mm256_loadu_pd(keys + i * _Stride);
+            __m256d m = _Greater ? _mm256_cmp_pd(k, v, _CMP_LT_OQ) : _mm256_cmp_pd(v, k, _CMP_LT_OQ);
+            count += popcount(_mm256_movemask_pd(m) & pattern);
+        }
+    } else if constexpr (sizeof(_Key) == 4) {
+        const __m256i bias = _mm256_set1_epi32(static_cast<std::int32_t>(sign_bias<_Key>()));
+        const __m256i k = _mm256_xor_si256(_mm256_set1_epi32(static_cast<std::int32_t>(key)), bias);
+        for (; i + step <= n; i += step) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i * _Stride));
+            v = _mm256_xor_si256(v, bias);
+            __m256i m = _Greater ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+            count += popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)) & pattern);
+        }
+    } else {
+        const __m256i bias = _mm256_set1_epi64x(sign_bias<_Key>());
+        const __m256i k = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<std::int64_t>(key)), bias);
+        for (; i + step <= n; i += step) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i * _Stride));
+            v = _mm256_xor_si256(v, bias);
+            __m256i m = _Greater ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v);
+            count += popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)) & pattern);
+        }
+    }
+    return count + count_before_scalar<_Stride, _Greater>(keys + i * _Stride, n - i, key);
+}
+
+// 128 bit version, SSE2 is enough for everything but 64 bit integers.
+template <std::size_t _Stride, bool _Greater, class _Key>
+FLATMAP_TARGET_SSE42
+std::size_t count_before_sse(const _Key* keys, std::size_t n, _Key key) noexcept
+{
+    constexpr std::size_t lanes = 16 / sizeof(_Key);
+    constexpr std::size_t step  = lanes / _Stride;
+    constexpr int pattern = lane_pattern<lanes, _Stride>();
+
+    std::size_t count = 0;
+    std::size_t i = 0;
+    if constexpr (std::is_same<_Key, float>::value) {
+        const __m128 k = _mm_set1_ps(key);
+        for (; i + step <= n; i += step) {
+            __m128 v = _mm_loadu_ps(keys + i * _Stride);
+            __m128 m = _Greater ? _mm_cmplt_ps(k, v) : _mm_cmplt_ps(v, k);
+            count += popcount(_mm_movemask_ps(m) & pattern);
+        }
+    } else if constexpr (std::is_same<_Key, double>::value) {
+        const __m128d k = _mm_set1_pd(key);
+        for (; i + step <= n; i += step) {
+            __m128d v = _mm_loadu_pd(keys + i * _Stride);
+            __m128d m = _Greater ? _mm_cmplt_pd(k, v) : _mm_cmplt_pd(v, k);
+            count += popcount(_mm_movemask_pd(m) & pattern);
+        }
+    } else if constexpr (sizeof(_Key) == 4) {
+        const __m128i bias = _mm_set1_epi32(static_cast<std::int32_t>(sign_bias<_Key>()));
+        const __m128i k = _mm_xor_si128(_mm_set1_epi32(static_cast<std::int32_t>(key)), bias);
+        for (; i + step <= n; i += step) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i * _Stride));
+            v = _mm_xor_si128(v, bias);
+            __m128i m = _Greater ? _mm_cmpgt_epi32(v, k) : _mm_cmpgt_epi32(k, v);
+            count += popcount(_mm_movemask_ps(_mm_castsi128_ps(m)) & pattern);
+        }
+    } else {
+        const __m128i bias = _mm_set1_epi64x(sign_bias<_Key>());
+        const __m128i k = _mm_xor_si128(_mm_set1_epi64x(static_cast<std::int64_t>(key)), bias);
+        for (; i + step <= n; i += step) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i * _Stride));
+            v = _mm_xor_si128(v, bias);
+            __m128i m = _Greater ? _mm_cmpgt_epi64(v, k) : _mm_cmpgt_epi64(k, v);
+            count += popcount(_mm_movemask_pd(_mm_castsi128_pd(m)) & pattern);
+        }
+    }
+    return count + count_before_scalar<_Stride, _Greater>(keys + i * _Stride, n - i, key);
+}
+
+inline int lowest_bit(int mask) noexcept
+{
+    return __builtin_ctz(static_cast<unsigned>(mask));
+}
+
+template <class _Key>
+FLATMAP_TARGET_AVX2
+std::size_t find_equal_avx2(const _Key* keys, std::size_t n, _Key key) noexcept
+{
+    constexpr std::size_t lanes = 32 / sizeof(_Key);
+    std::size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        int mask;
+        if constexpr (std::is_same<_Key, float>::value) {
+            mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(keys + i), _mm256_set1_ps(key), _CMP_EQ_OQ));
+        } else if constexpr (std::is_same<_Key, double>::value) {
+            mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(keys + i), _mm256_set1_pd(key), _CMP_EQ_OQ));
+        } else if constexpr (sizeof(_Key) == 4) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+            __m256i m = _mm256_cmpeq_epi32(v, _mm256_set1_epi32(static_cast<std::int32_t>(key)));
+            mask = _mm256_movemask_ps(_mm256_castsi256_ps(m));
+        } else {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+            __m256i m = _mm256_cmpeq_epi64(v, _mm256_set1_epi64x(static_cast<std::int64_t>(key)));
+            mask = _mm256_movemask_pd(_mm256_castsi256_pd(m));
+        }
+        if (mask != 0)
+            return i + lowest_bit(mask);
+    }
+    return i + find_equal_scalar(keys + i, n - i, key);
+}
+
+template <class _Key>
+FLATMAP_TARGET_SSE42
+std::size_t find_equal_sse(const _Key* keys, std::size_t n, _Key key) noexcept
+{
+    constexpr std::size_t lanes = 16 / sizeof(_Key);
+    std::size_t i = 0;
+    for (; i + lanes <= n; i += lanes) {
+        int mask;
+        if constexpr (std::is_same<_Key, float>::value) {
+            mask = _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(keys + i), _mm_set1_ps(key)));
+        } else if constexpr (std::is_same<_Key, double>::value) {
+            mask = _mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(keys + i), _mm_set1_pd(key)));
+        } else if constexpr (sizeof(_Key) == 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            __m128i m = _mm_cmpeq_epi32(v, _mm_set1_epi32(static_cast<std::int32_t>(key)));
+            mask = _mm_movemask_ps(_mm_castsi128_ps(m));
+        } else {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+            __m128i m = _mm_cmpeq_epi64(v, _mm_set1_epi64x(static_cast<std::int64_t>(key)));
+            mask = _mm_movemask_pd(_mm_castsi128_pd(m));
+        }
+        if (mask != 0)
+            return i + lowest_bit(mask);
+    }
+    return i + find_equal_scalar(keys + i, n - i, key);
+}
+
+inline bool cpu_has_avx2() noexcept
+{
+#ifdef FLATMAP_SIMD_DISPATCH
+    static const bool has = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+    }();
+    return has;
+#else
+    return true;
+#endif
+}
+
+inline bool cpu_has_sse42() noexcept
+{
+#if defined(FLATMAP_SIMD_DISPATCH) && !defined(__SSE4_2__)
+    static const bool has = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2") != 0;
+    }();
+    return has;
+#else
+    return true;
+#endif
+}
+
+#endif // FLATMAP_SIMD_X86
+
+// Picks the widest kernel available, at compile time when the target already
+// has AVX2 and at runtime otherwise.
+template <std::size_t _Stride, class _Compare, class _Key>
+std::size_t count_before(const _Key* keys, std::size_t n, _Key key) noexcept
+{
+    constexpr bool greater = is_greater_v<_Compare, _Key>;
+#ifdef FLATMAP_SIMD_X86
+    constexpr std::size_t lanes = 16 / sizeof(_Key);
+    if constexpr (has_kernel_v<2 * lanes, _Stride>) {
+        if (cpu_has_avx2())
+            return count_before_avx2<_Stride, greater>(keys, n, key);
+    }
+    if constexpr (has_kernel_v<lanes, _Stride>) {
+        if (sizeof(_Key) == 4 || std::is_floating_point<_Key>::value || cpu_has_sse42())
+            return count_before_sse<_Stride, greater>(keys, n, key);
+    }
+#endif
+    return count_before_scalar<_Stride, greater>(keys, n, key);
+}
+
+template <class _Key>
+std::size_t find_equal(const _Key* keys, std::size_t n, _Key key) noexcept
+{
+#ifdef FLATMAP_SIMD_X86
+    if (cpu_has_avx2())
+        return find_equal_avx2(keys, n, key);
+    if (sizeof(_Key) == 4 || std::is_floating_point<_Key>::value || cpu_has_sse42())
+        return find_equal_sse(keys, n, key);
+#endif
+    return find_equal_scalar(keys, n, key);
+}
+
+} // ~flatmap::detail
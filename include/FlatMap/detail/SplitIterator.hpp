@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+
+namespace flatmap::detail {
+
+// Result of operator-> on a proxy iterator, holds the pair of references.
+template <class _Ref>
+struct PairPtr : _Ref {
+    constexpr PairPtr(_Ref ref) noexcept
+        : _Ref{ref} {}
+
+    constexpr const _Ref* operator->() const noexcept
+    {
+        return this;
+    }
+};
+
+// Random access iterator over a key array and a parallel value array,
+// dereferences to a pair of references.
+template <class _Key, class _T, bool _Const>
+struct SplitIterator {
+    using key_pointer   = const _Key*;
+    using value_pointer = std::conditional_t<_Const, const _T*, _T*>;
+
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = std::pair<_Key, _T>;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::pair<const _Key&, std::conditional_t<_Const, const _T&, _T&>>;
+    using pointer = PairPtr<reference>;
+
+    constexpr SplitIterator() noexcept = default;
+    constexpr SplitIterator(key_pointer key, value_pointer val) noexcept
+        : _key{key}, _val{val}
+    {}
+
+    // iterator -> const_iterator
+    template <bool C = _Const, typename = std::enable_if_t<C>>
+    constexpr SplitIterator(const SplitIterator<_Key, _T, false>& other) noexcept
+        : _key{other.key_ptr()}, _val{other.value_ptr()}
+    {}
+
+    constexpr key_pointer   key_ptr()   const noexcept { return _key; }
+    constexpr value_pointer value_ptr() const noexcept { return _val; }
+
+    constexpr reference operator*() const noexcept
+    {
+        return reference{*_key, *_val};
+    }
+
+    constexpr pointer operator->() const noexcept
+    {
+        return pointer{**this};
+    }
+
+    constexpr reference operator[](difference_type n) const noexcept
+    {
+        return reference{_key[n], _val[n]};
+    }
+
+    constexpr SplitIterator& operator++() noexcept
+    {
+        ++_key; ++_val;
+        return *this;
+    }
+
+    constexpr SplitIterator operator++(int) noexcept
+    {
+        SplitIterator tmp{*this};
+        ++(*this);
+        return tmp;
+    }
+
+    constexpr SplitIterator& operator--() noexcept
+    {
+        --_key; --_val;
+        return *this;
+    }
+
+    constexpr SplitIterator operator--(int) noexcept
+    {
+        SplitIterator tmp{*this};
+        --(*this);
+        return tmp;
+    }
+
+    constexpr SplitIterator& operator+=(difference_type n) noexcept
+    {
+        _key += n;
+        _val += n;
+        return *this;
+    }
+
+    constexpr SplitIterator& operator-=(difference_type n) noexcept
+    {
+        _key -= n;
+        _val -= n;
+        return *this;
+    }
+
+    constexpr SplitIterator operator+(difference_type n) const noexcept
+    {
+        SplitIterator tmp{*this};
+        return tmp += n;
+    }
+
+    friend constexpr SplitIterator operator+(difference_type n, SplitIterator it) noexcept
+    {
+        return it += n;
+    }
+
+    constexpr SplitIterator operator-(difference_type n) const noexcept
+    {
+        SplitIterator tmp{*this};
+        return tmp -= n;
+    }
+
+    constexpr difference_type operator-(SplitIterator other) const noexcept
+    {
+        return _key - other._key;
+    }
+
+    friend constexpr bool operator==(SplitIterator a, SplitIterator b) noexcept
+    {
+        return a._key == b._key;
+    }
+
+    friend constexpr bool operator!=(SplitIterator a, SplitIterator b) noexcept
+    {
+        return a._key != b._key;
+    }
+
+    friend constexpr bool operator<(SplitIterator a, SplitIterator b) noexcept
+    {
+        return a._key < b._key;
+    }
+
+    friend constexpr bool operator>(SplitIterator a, SplitIterator b) noexcept
+    {
+        return a._key > b._key;
+    }
+
+    friend constexpr bool operator<=(SplitIterator a, SplitIterator b) noexcept
+    {
+        return a._key <= b._key;
+    }
+
+    friend constexpr bool operator>=(SplitIterator a, SplitIterator b) noexcept
+    {
+        return a._key >= b._key;
+    }
+
+private:
+    key_pointer   _key = nullptr;
+    value_pointer _val = nullptr;
+};
+
+} // ~flatmap::detail
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "../Policies.hpp"
+#include "Config.hpp"
+#include "SplitIterator.hpp"
+
+
+namespace flatmap::detail {
+
+// Fixed capacity element storage of StaticFlatMap, one specialization per
+// layout policy. The storage doesn't track its size, the map passes it in.
+//
+// At run time the storage is left uninitialized, only the slots in use are
+// ever written: create() and create_copy() cost nothing past size(). C++17
+// constant expressions don't allow uninitialized members, there both zero the
+// whole array first (as does value initialization, StaticStorage{}).
+template <class _Key, class _Value, std::size_t _N, class _Layout>
+class StaticStorage;
+
+template <class _Key, class _Value, std::size_t _N>
+class StaticStorage<_Key, _Value, _N, PairLayout> {
+public:
+    using value_type = std::pair<_Key, _Value>;
+    using ContainerType = std::array<value_type, _N>;
+    using iterator = typename ContainerType::iterator;
+    using const_iterator = typename ContainerType::const_iterator;
+
+    // Distance between two keys in units of _Key, 0 when they can't be
+    // addressed as a strided key array.
+    static constexpr std::size_t key_stride =
+        sizeof(value_type) % sizeof(_Key) == 0 ? sizeof(value_type) / sizeof(_Key) : 0;
+
+    constexpr StaticStorage() noexcept : m_array{} {}
+
+    static constexpr StaticStorage create() noexcept
+    {
+        if (FLATMAP_IS_CONSTANT_EVALUATED())
+            return StaticStorage();
+        return StaticStorage(Uninitialized{});
+    }
+
+    // The first `size` elements of `other`
+    static constexpr StaticStorage create_copy(const StaticStorage& other, std::size_t size) noexcept
+    {
+        if (FLATMAP_IS_CONSTANT_EVALUATED())
+            return StaticStorage(other, size);
+        return StaticStorage(Uninitialized{}, other, size);
+    }
+
+    constexpr iterator       at(std::size_t i)       noexcept { return iterator(m_array.data() + i);       }
+    constexpr const_iterator at(std::size_t i) const noexcept { return const_iterator(m_array.data() + i); }
+
+    const _Key* keys() const noexcept { return &m_array.data()->first; }
+
+    constexpr const _Key&   key(std::size_t i)   const noexcept { return m_array[i].first;  }
+    constexpr _Value&       value(std::size_t i)       noexcept { return m_array[i].second; }
+    constexpr const _Value& value(std::size_t i) const noexcept { return m_array[i].second; }
+
+    // member wise, std::pair assignment isn't constexpr before C++20
+    constexpr void set(std::size_t i, const value_type& val) noexcept
+    {
+        m_array[i].first = val.first;
+        m_array[i].second = val.second;
+    }
+
+    constexpr void copy_element(std::size_t from, std::size_t to) noexcept
+    {
+        m_array[to].first = m_array[from].first;
+        m_array[to].second = m_array[from].second;
+    }
+
+    // [pos, size) -> [pos + 1, size + 1)
+    void shift_right(std::size_t pos, std::size_t size) noexcept
+    {
+        std::copy_backward(at(pos), at(size), at(size + 1));
+    }
+
+    // [pos + count, size) -> [pos, size - count), std::copy doesn't allow count 0
+    void shift_left(std::size_t pos, std::size_t count, std::size_t size) noexcept
+    {
+        if (count == 0)
+            return;
+        std::copy(at(pos + count), at(size), at(pos));
+    }
+
+    // Only the first `size` elements, the slack past them is left alone. Key and value
+    // are trivially copyable, std::pair isn't only because of its assignment operator.
+    void copy_from(const StaticStorage& other, std::size_t size) noexcept
+    {
+        std::memcpy(static_cast<void*>(m_array.data()), other.m_array.data(), sizeof(value_type) * size);
+    }
+
+    template <class _ValueCompare>
+    void stable_sort(std::size_t first, std::size_t last, _ValueCompare comp)
+    {
+        std::stable_sort(at(first), at(last), comp);
+    }
+
+    template <class _ValueCompare>
+    void inplace_merge(std::size_t first, std::size_t middle, std::size_t last, _ValueCompare comp)
+    {
+        std::inplace_merge(at(first), at(middle), at(last), comp);
+    }
+
+private:
+    struct Uninitialized {};
+
+    StaticStorage(Uninitialized) noexcept {}
+
+    StaticStorage(Uninitialized, const StaticStorage& other, std::size_t size) noexcept
+    {
+        copy_from(other, size);
+    }
+
+    constexpr StaticStorage(const StaticStorage& other, std::size_t size) noexcept
+        : m_array{}
+    {
+        for (std::size_t i = 0; i != size; ++i)
+            set(i, other.m_array[i]);
+    }
+
+    // std::pair's default constructor would zero every slot, the union leaves
+    // them alone until they are written
+    union {
+        ContainerType m_array;
+    };
+};
+
+template <class _Key, class _Value, std::size_t _N>
+class StaticStorage<_Key, _Value, _N, SplitLayout> {
+public:
+    using value_type = std::pair<_Key, _Value>;
+    using ContainerType = StaticStorage;
+    using iterator = SplitIterator<_Key, _Value, false>;
+    using const_iterator = SplitIterator<_Key, _Value, true>;
+
+    static constexpr std::size_t key_stride = 1;
+
+    constexpr StaticStorage() noexcept : m_keys{}, m_values{} {}
+
+    static constexpr StaticStorage create() noexcept
+    {
+        if (FLATMAP_IS_CONSTANT_EVALUATED())
+            return StaticStorage();
+        return StaticStorage(Uninitialized{});
+    }
+
+    static constexpr StaticStorage create_copy(const StaticStorage& other, std::size_t size) noexcept
+    {
+        if (FLATMAP_IS_CONSTANT_EVALUATED())
+            return StaticStorage(other, size);
+        return StaticStorage(Uninitialized{}, other, size);
+    }
+
+    constexpr iterator       at(std::size_t i)       noexcept { return iterator(m_keys.data() + i, m_values.data() + i);       }
+    constexpr const_iterator at(std::size_t i) const noexcept { return const_iterator(m_keys.data() + i, m_values.data() + i); }
+
+    constexpr const _Key* keys() const noexcept { return m_keys.data(); }
+
+    constexpr const _Key&   key(std::size_t i)   const noexcept { return m_keys[i];   }
+    constexpr _Value&       value(std::size_t i)       noexcept { return m_values[i]; }
+    constexpr const _Value& value(std::size_t i) const noexcept { return m_values[i]; }
+
+    constexpr void set(std::size_t i, const value_type& val) noexcept
+    {
+        m_keys[i] = val.first;
+        m_values[i] = val.second;
+    }
+
+    constexpr void copy_element(std::size_t from, std::size_t to) noexcept
+    {
+        m_keys[to] = m_keys[from];
+        m_values[to] = m_values[from];
+    }
+
+    void shift_right(std::size_t pos, std::size_t size) noexcept
+    {
+        std::copy_backward(m_keys.data() + pos, m_keys.data() + size, m_keys.data() + size + 1);
+        std::copy_backward(m_values.data() + pos, m_values.data() + size, m_values.data() + size + 1);
+    }
+
+    void shift_left(std::size_t pos, std::size_t count, std::size_t size) noexcept
+    {
+        if (count == 0)
+            return;
+        std::copy(m_keys.data() + pos + count, m_keys.data() + size, m_keys.data() + pos);
+        std::copy(m_values.data() + pos + count, m_values.data() + size, m_values.data() + pos);
+    }
+
+    void copy_from(const StaticStorage& other, std::size_t size) noexcept
+    {
+        std::memcpy(m_keys.data(), other.m_keys.data(), sizeof(_Key) * size);
+        std::memcpy(m_values.data(), other.m_values.data(), sizeof(_Value) * size);
+    }
+
+    // The standard algorithms can't permute two arrays in lockstep, the range
+    // is sorted as pairs in a scratch buffer and scattered back.
+    template <class _ValueCompare>
+    void stable_sort(std::size_t first, std::size_t last, _ValueCompare comp)
+    {
+        std::vector<value_type> buf = gather(first, last);
+        std::stable_sort(buf.begin(), buf.end(), comp);
+        scatter(first, buf);
+    }
+
+    template <class _ValueCompare>
+    void inplace_merge(std::size_t first, std::size_t middle, std::size_t last, _ValueCompare comp)
+    {
+        if (first == middle || middle == last)
+            return;
+        std::vector<value_type> buf = gather(first, last);
+        std::inplace_merge(buf.begin(), buf.begin() + (middle - first), buf.end(), comp);
+        scatter(first, buf);
+    }
+
+private:
+    struct Uninitialized {};
+
+    StaticStorage(Uninitialized) noexcept {}
+
+    StaticStorage(Uninitialized, const StaticStorage& other, std::size_t size) noexcept
+    {
+        copy_from(other, size);
+    }
+
+    constexpr StaticStorage(const StaticStorage& other, std::size_t size) noexcept
+        : m_keys{}, m_values{}
+    {
+        for (std::size_t i = 0; i != size; ++i) {
+            m_keys[i] = other.m_keys[i];
+            m_values[i] = other.m_values[i];
+        }
+    }
+
+    std::vector<value_type> gather(std::size_t first, std::size_t last) const
+    {
+        std::vector<value_type> buf;
+        buf.reserve(last - first);
+        for (std::size_t i = first; i != last; ++i)
+            buf.emplace_back(m_keys[i], m_values[i]);
+        return buf;
+    }
+
+    void scatter(std::size_t first, const std::vector<value_type>& buf) noexcept
+    {
+        for (const auto& kv : buf)
+            set(first++, kv);
+    }
+
+    std::array<_Key, _N>   m_keys;
+    std::array<_Value, _N> m_values;
+};
+
+} // ~flatmap::detail
@@ -1,5 +1,12 @@
 #include <catch2/catch.hpp>
 #include <FlatMap/FlatMap.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <random>
+#include <vector>
 
 TEST_CASE("FM empty", "[FlatMap]")
 {
@@ -28,3 +35,743 @@ TEST_CASE("FM lower_bound", "[FlatMap]")
     using std::swap;
     swap(m, m2);
 }
+
+TEMPLATE_TEST_CASE("FM lower_bound all sizes", "[FlatMap]",
+        std::less<int>, std::greater<int>)
+{
+    // sizes straddle the linear / branchless / prefetch crossovers
+    for (int n : {0, 1, 2, 3, 31, 32, 33, 100, 2047, 2048, 5000}) {
+        FlatMap<int, int, TestType> m;
+        std::vector<int> keys;
+        for (int i = 0; i < n; ++i) {
+            m.insert(std::make_pair(2 * i, i));
+            keys.push_back(2 * i);
+        }
+        std::sort(keys.begin(), keys.end(), TestType{});
+
+        for (int k = -1; k <= 2 * n; ++k) {
+            auto expected = std::lower_bound(keys.begin(), keys.end(), k, TestType{}) - keys.begin();
+            auto it = m.lower_bound(k);
+            REQUIRE(it - m.begin() == expected);
+            REQUIRE((m.find(k) != m.end()) == (k >= 0 && k < 2 * n && k % 2 == 0));
+        }
+    }
+}
+
+TEST_CASE("FM insert grows", "[FlatMap]")
+{
+    constexpr int kCount = 1000;
+    FlatMap<int, int> m;
+    REQUIRE(m.capacity() == 0u);
+
+    // insert in an order that hits front, back and middle positions
+    for (int i = 0; i < kCount; ++i) {
+        int key = (i * 7919) % kCount;
+        auto res = m.insert(std::make_pair(key, key + 1));
+        REQUIRE(res.second == true);
+        REQUIRE(res.first->first  == key);
+        REQUIRE(res.first->second == key + 1);
+        REQUIRE(m.size() == static_cast<size_t>(i + 1));
+        REQUIRE(m.capacity() >= m.size());
+    }
+
+    SECTION("sorted contents") {
+        int expected = 0;
+        for (auto it = m.begin(); it != m.end(); ++it, ++expected) {
+            REQUIRE(it->first  == expected);
+            REQUIRE(it->second == expected + 1);
+        }
+        REQUIRE(expected == kCount);
+    }
+
+    SECTION("duplicate insert") {
+        auto res = m.insert(std::make_pair(5, 42));
+        REQUIRE(res.second == false);
+        REQUIRE(res.first->second == 6);
+        REQUIRE(m.size() == static_cast<size_t>(kCount));
+    }
+
+    SECTION("lookups") {
+        for (int i = 0; i < kCount; ++i) {
+            auto it = m.find(i);
+            REQUIRE(it != m.end());
+            REQUIRE(it->second == i + 1);
+        }
+        REQUIRE(m.find(kCount) == m.end());
+        REQUIRE(m.find(-1) == m.end());
+    }
+}
+
+TEST_CASE("FM capacity", "[FlatMap]")
+{
+    FlatMap<int, double> m;
+
+    m.reserve(100);
+    REQUIRE(m.capacity() == 100u);
+    REQUIRE(m.size() == 0u);
+
+    for (int i = 0; i < 100; ++i) {
+        m.insert(std::make_pair(i, i * 0.5));
+    }
+    REQUIRE(m.capacity() == 100u);
+
+    // geometric growth
+    m.insert(std::make_pair(100, 50.0));
+    REQUIRE(m.capacity() == 200u);
+
+    m.shrink_to_fit();
+    REQUIRE(m.capacity() == 101u);
+    for (int i = 0; i <= 100; ++i) {
+        auto it = m.find(i);
+        REQUIRE(it != m.end());
+        REQUIRE(it->second == i * 0.5);
+    }
+
+    m.clear();
+    REQUIRE(m.empty() == true);
+    REQUIRE(m.capacity() == 101u);
+    m.shrink_to_fit();
+    REQUIRE(m.capacity() == 0u);
+    REQUIRE(m.begin() == m.end());
+}
+
+TEST_CASE("FM copy and move", "[FlatMap]")
+{
+    FlatMap<int, int> m1;
+    for (int i = 0; i < 100; ++i) {
+        m1.insert(std::make_pair(i, -i));
+    }
+
+    FlatMap<int, int> m2 = m1;
+    REQUIRE(m2.size() == m1.size());
+    REQUIRE(m2.capacity() == m1.size());
+    m2.begin()->second = 42;
+    REQUIRE(m1.begin()->second == 0);
+
+    FlatMap<int, int> m3 = std::move(m2);
+    REQUIRE(m3.size() == 100u);
+    REQUIRE(m2.size() == 0u);
+    REQUIRE(m3.find(0)->second == 42);
+
+    m2 = m3;
+    REQUIRE(m2.size() == 100u);
+    m3 = std::move(m1);
+    REQUIRE(m3.find(0)->second == 0);
+
+    const auto& cm = m3;
+    int i = 0;
+    for (auto it = cm.begin(); it != cm.end(); ++it, ++i) {
+        REQUIRE(it->first  == i);
+        REQUIRE(it->second == -i);
+    }
+}
+
+TEST_CASE("FM bulk construction", "[FlatMap]")
+{
+    SECTION("initializer list keeps the first duplicate") {
+        FlatMap<int, int> m{{5, 0}, {1, 1}, {3, 2}, {1, 3}, {4, 4}, {1, 5}};
+        REQUIRE(m.size() == 4u);
+        REQUIRE(m.capacity() == FlatMap<int, int>::min_capacity);
+        REQUIRE(m.find(1)->second == 1);
+        std::vector<int> keys;
+        for (auto kv : m) {
+            keys.push_back(kv.first);
+        }
+        REQUIRE(keys == std::vector<int>{1, 3, 4, 5});
+    }
+
+    SECTION("iterator range") {
+        std::vector<std::pair<int, int>> src;
+        for (int i = 0; i < 1000; ++i) {
+            src.emplace_back((i * 7919) % 500, i);
+        }
+        FlatMap<int, int, std::greater<int>> m(src.begin(), src.end());
+        REQUIRE(m.size() == 500u);
+        REQUIRE(m.capacity() == 500u);
+        int expected = 499;
+        for (auto kv : m) {
+            REQUIRE(kv.first == expected);
+            --expected;
+        }
+        // first occurrence in the input wins
+        for (int i = 0; i < 500; ++i) {
+            REQUIRE(m.find((i * 7919) % 500)->second == i);
+        }
+    }
+
+    SECTION("sorted unique tag") {
+        std::vector<std::pair<int, int>> src{{1, 0}, {2, 1}, {7, 3}};
+        FlatMap<int, int> m(flatmap::sorted_unique, src.begin(), src.end());
+        REQUIRE(m.size() == 3u);
+        REQUIRE(m.find(7)->second == 3);
+        FlatMap<int, int> m2(flatmap::sorted_unique, {{1, 0}, {2, 1}});
+        REQUIRE(m2.size() == 2u);
+    }
+
+    SECTION("range insert keeps existing values") {
+        FlatMap<int, int> m{{2, 0}, {4, 0}, {6, 0}};
+        m.insert({{5, 1}, {4, 1}, {1, 1}, {6, 1}, {4, 2}, {9, 1}});
+        std::vector<std::pair<int, int>> expected{{1, 1}, {2, 0}, {4, 0}, {5, 1}, {6, 0}, {9, 1}};
+        REQUIRE(std::equal(m.begin(), m.end(), expected.begin(), expected.end(),
+            [](auto a, auto b) { return a.first == b.first && a.second == b.second; }));
+        m.insert(flatmap::sorted_unique, expected.begin(), expected.begin());
+        REQUIRE(m.size() == 6u);
+    }
+}
+
+TEST_CASE("FM find_batch", "[FlatMap]")
+{
+    for (int n : {0, 1, 2, 17, 1000, 5000}) {
+        FlatMap<int, int> m;
+        for (int i = 0; i < n; ++i) {
+            m.insert(std::make_pair(2 * i, i));
+        }
+
+        // 37 keys: not a multiple of the group size
+        std::vector<int> keys;
+        for (int i = 0; i < 37; ++i) {
+            keys.push_back((i * 7919) % (2 * n + 3) - 1);
+        }
+
+        std::vector<FlatMap<int, int>::iterator> found;
+        m.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+        REQUIRE(found.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            REQUIRE(found[i] == m.find(keys[i]));
+        }
+
+        const auto& cm = m;
+        std::vector<FlatMap<int, int>::const_iterator> cfound(keys.size());
+        auto end = cm.find_batch(keys.begin(), keys.end(), cfound.begin());
+        REQUIRE(end == cfound.end());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            REQUIRE(cfound[i] == cm.find(keys[i]));
+        }
+    }
+}
+
+namespace {
+
+// Keys carry a generation next to the id, lookups only know the id
+struct Handle {
+    int id;
+    int generation;
+};
+
+struct HandleLess {
+    using is_transparent = void;
+    bool operator()(const Handle& a, const Handle& b) const { return a.id < b.id; }
+    bool operator()(const Handle& a, int id) const { return a.id < id; }
+    bool operator()(int id, const Handle& b) const { return id < b.id; }
+};
+
+// Tens compare equal: a transparent lookup by decade matches a range of keys
+struct Decade {
+    int value;
+};
+
+struct DecadeLess {
+    using is_transparent = void;
+    bool operator()(int a, int b) const { return a < b; }
+    bool operator()(int a, Decade d) const { return a / 10 < d.value; }
+    bool operator()(Decade d, int b) const { return d.value < b / 10; }
+};
+
+} // ~namespace
+
+TEST_CASE("FM transparent lookup", "[FlatMap]")
+{
+    FlatMap<Handle, int, HandleLess> m;
+    for (int i = 0; i < 100; ++i) {
+        m.insert(std::make_pair(Handle{2 * i, 7}, i));
+    }
+
+    REQUIRE(m.find(10)->second == 5);
+    REQUIRE(m.find(11) == m.end());
+    REQUIRE(m.contains(198));
+    REQUIRE_FALSE(m.contains(199));
+    REQUIRE(m.count(42) == 1u);
+    REQUIRE(m.lower_bound(11)->first.id == 12);
+    REQUIRE(m.upper_bound(12)->first.id == 14);
+    REQUIRE(m.find(Handle{10, 0})->first.generation == 7);
+
+    const auto& cm = m;
+    auto range = cm.equal_range(20);
+    REQUIRE(range.second - range.first == 1);
+    REQUIRE(range.first->second == 10);
+}
+
+TEST_CASE("FM lookup by equivalence class", "[FlatMap]")
+{
+    FlatMap<int, int, DecadeLess> m;
+    for (int i = 0; i < 100; i += 3) {
+        m.insert(std::make_pair(i, i));
+    }
+
+    // 30, 33, 36, 39
+    REQUIRE(m.count(Decade{3}) == 4u);
+    auto range = m.equal_range(Decade{3});
+    REQUIRE(range.first->first == 30);
+    REQUIRE(range.second->first == 42);
+    REQUIRE(m.lower_bound(Decade{5})->first == 51);
+    REQUIRE(m.upper_bound(Decade{5})->first == 60);
+    REQUIRE(m.contains(Decade{9}));
+    REQUIRE(m.count(Decade{10}) == 0u);
+
+    REQUIRE(m.count(33) == 1u);
+    REQUIRE(m.count(34) == 0u);
+    REQUIRE(m.equal_range(34).first == m.equal_range(34).second);
+}
+
+TEST_CASE("FM lookup by equivalence class, pending inserts", "[FlatMap]")
+{
+    FlatMap<int, int, DecadeLess, flatmap::BufferedInsert<8>> m;
+    for (int i = 0; i < 30; i += 3) {
+        m.insert(std::make_pair(i, i));
+    }
+    // 3 of the 4 keys of decade 3 are pending
+    m.insert(std::make_pair(30, 30));
+    m.flush();
+    m.insert(std::make_pair(39, 39));
+    m.insert(std::make_pair(33, 33));
+    m.insert(std::make_pair(36, 36));
+
+    const auto& cm = m;
+    REQUIRE(cm.count(Decade{3}) == 4u);
+    REQUIRE(cm.count(Decade{2}) == 3u);
+    REQUIRE(cm.count(Decade{4}) == 0u);
+    REQUIRE(cm.find(Decade{3}) != cm.end());
+    REQUIRE(cm.find(Decade{3})->first / 10 == 3);
+    REQUIRE(cm.contains(Decade{0}));
+    REQUIRE_FALSE(cm.contains(Decade{5}));
+
+    auto range = m.equal_range(Decade{3});
+    REQUIRE(range.second - range.first == 4);
+    REQUIRE(range.first->first == 30);
+}
+
+TEST_CASE("FM erase", "[FlatMap]")
+{
+    FlatMap<int, int> m;
+    for (int i = 0; i < 100; ++i) {
+        m.insert(std::make_pair(i, -i));
+    }
+
+    SECTION("by key") {
+        REQUIRE(m.erase(10) == 1u);
+        REQUIRE(m.erase(10) == 0u);
+        REQUIRE(m.erase(1000) == 0u);
+        REQUIRE(m.size() == 99u);
+        REQUIRE(m.find(10) == m.end());
+        REQUIRE(m.find(11)->second == -11);
+    }
+
+    SECTION("by position") {
+        auto it = m.erase(m.find(50));
+        REQUIRE(it->first == 51);
+        it = m.erase(FlatMap<int, int>::const_iterator{m.find(99)});
+        REQUIRE(it == m.end());
+        REQUIRE(m.size() == 98u);
+    }
+
+    SECTION("range") {
+        auto it = m.erase(m.lower_bound(20), m.lower_bound(70));
+        REQUIRE(it->first == 70);
+        REQUIRE(m.size() == 50u);
+        REQUIRE(m.lower_bound(20)->first == 70);
+        it = m.erase(m.begin(), m.begin());
+        REQUIRE(it == m.begin());
+        it = m.erase(m.begin(), m.end());
+        REQUIRE(it == m.end());
+        REQUIRE(m.empty());
+    }
+
+    SECTION("erase_if") {
+        REQUIRE(erase_if(m, [](const auto& kv) { return kv.first % 3 != 0; }) == 66u);
+        REQUIRE(m.size() == 34u);
+        int expected = 0;
+        for (const auto& kv : m) {
+            REQUIRE(kv.first == expected);
+            REQUIRE(kv.second == -expected);
+            expected += 3;
+        }
+        REQUIRE(erase_if(m, [](const auto&) { return false; }) == 0u);
+        REQUIRE(m.size() == 34u);
+        REQUIRE(m.find(42)->second == -42);
+    }
+}
+
+TEST_CASE("FM merge and set operations", "[FlatMap]")
+{
+    // base: 0, 2, 4 ... 98, overlay: 0, 3, 6 ... 99
+    FlatMap<int, int> base;
+    FlatMap<int, int> overlay;
+    for (int i = 0; i < 100; ++i) {
+        if (i % 2 == 0)
+            base.insert(std::make_pair(i, i));
+        if (i % 3 == 0)
+            overlay.insert(std::make_pair(i, -i));
+    }
+
+    auto check = [](const FlatMap<int, int>& m, auto has_key, auto value_of) {
+        size_t n = 0;
+        for (int i = 0; i < 100; ++i) {
+            if (!has_key(i)) {
+                REQUIRE(m.find(i) == m.end());
+                continue;
+            }
+            ++n;
+            REQUIRE(m.find(i) != m.end());
+            REQUIRE(m.find(i)->second == value_of(i));
+        }
+        REQUIRE(m.size() == n);
+        REQUIRE(std::is_sorted(m.begin(), m.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; }));
+    };
+    auto in_base = [](int i) { return i % 2 == 0; };
+    auto in_overlay = [](int i) { return i % 3 == 0; };
+
+    SECTION("union") {
+        check(map_union(base, overlay), [&](int i) { return in_base(i) || in_overlay(i); },
+              [&](int i) { return in_base(i) ? i : -i; });
+        check(map_union(base, overlay, flatmap::KeepRight{}),
+              [&](int i) { return in_base(i) || in_overlay(i); },
+              [&](int i) { return in_overlay(i) ? -i : i; });
+    }
+
+    SECTION("intersection") {
+        auto sum = [](int, int a, int b) { return a + b + 1000; };
+        check(map_intersection(base, overlay, sum), [&](int i) { return in_base(i) && in_overlay(i); },
+              [](int) { return 1000; });
+    }
+
+    SECTION("difference") {
+        check(map_difference(base, overlay), [&](int i) { return in_base(i) && !in_overlay(i); },
+              [](int i) { return i; });
+        REQUIRE(map_difference(base, base).empty());
+    }
+
+    SECTION("merge into a new block") {
+        base.shrink_to_fit();
+        base.merge(overlay, flatmap::KeepRight{});
+        check(base, [&](int i) { return in_base(i) || in_overlay(i); },
+              [&](int i) { return in_overlay(i) ? -i : i; });
+    }
+
+    SECTION("merge in place") {
+        base.reserve(base.size() + overlay.size());
+        auto keys = base.begin().key_ptr();
+        base.merge(overlay);
+        REQUIRE(base.begin().key_ptr() == keys);
+        check(base, [&](int i) { return in_base(i) || in_overlay(i); },
+              [&](int i) { return in_base(i) ? i : -i; });
+        base.merge(base);
+        REQUIRE(base.size() == 67u);
+    }
+
+    SECTION("empty maps") {
+        FlatMap<int, int> empty;
+        REQUIRE(map_union(empty, base).size() == base.size());
+        REQUIRE(map_intersection(base, empty).empty());
+        empty.merge(overlay);
+        REQUIRE(empty.size() == overlay.size());
+    }
+}
+
+TEMPLATE_TEST_CASE("FM learned search", "[FlatMap]", int, std::uint64_t, double)
+{
+    using Learned = FlatMap<TestType, int, std::less<TestType>, flatmap::LearnedSearch>;
+    REQUIRE(sizeof(FlatMap<TestType, int>) == sizeof(FlatMap<TestType, int, std::less<TestType>, flatmap::BinarySearch>));
+
+    std::mt19937_64 gen(7);
+    std::vector<std::pair<TestType, int>> data;
+    // evenly spread keys, a dense cluster and a few outliers
+    for (int i = 0; i < 80000; ++i)
+        data.emplace_back(static_cast<TestType>(gen() % 1000000), i);
+    for (int i = 0; i < 2000; ++i)
+        data.emplace_back(static_cast<TestType>(500000 + i % 50), i);
+    data.emplace_back(static_cast<TestType>(std::is_signed<TestType>::value ? -1 : 2000000000), 0);
+    data.emplace_back(static_cast<TestType>(1500000000), 0);
+
+    Learned map{data.begin(), data.end()};
+    FlatMap<TestType, int> ref{data.begin(), data.end()};
+    REQUIRE(map.size() == ref.size());
+
+    auto check = [&] {
+        for (TestType key : {TestType(0), TestType(1), TestType(499999), TestType(500025), TestType(999999),
+                 TestType(1000000), TestType(1500000000), TestType(1600000000)}) {
+            REQUIRE((map.lower_bound(key) - map.begin()) == (ref.lower_bound(key) - ref.begin()));
+            REQUIRE((map.upper_bound(key) - map.begin()) == (ref.upper_bound(key) - ref.begin()));
+        }
+        for (int i = 0; i < 2000; ++i) {
+            TestType key = static_cast<TestType>(gen() % 1100000);
+            REQUIRE((map.lower_bound(key) - map.begin()) == (ref.lower_bound(key) - ref.begin()));
+            REQUIRE(map.contains(key) == ref.contains(key));
+        }
+        for (auto it = ref.begin(); it < ref.end(); it += 7)
+            REQUIRE(map.find(it->first)->second == it->second);
+    };
+    check();
+
+    SECTION("single inserts and erases drift, then refit")
+    {
+        for (int i = 0; i < 300; ++i) {
+            auto kv = std::make_pair(static_cast<TestType>(gen() % 1000000), -i);
+            REQUIRE(map.insert(kv).second == ref.insert(kv).second);
+            TestType gone = static_cast<TestType>(gen() % 1000000);
+            REQUIRE(map.erase(gone) == ref.erase(gone));
+            if (i % 50 == 0)
+                check();
+        }
+        map.erase(map.begin(), map.begin() + 1000);
+        ref.erase(ref.begin(), ref.begin() + 1000);
+        check();
+        // shrinks under the minimum, back to the plain search
+        map.erase(map.begin() + 10, map.end());
+        ref.erase(ref.begin() + 10, ref.end());
+        check();
+    }
+
+    SECTION("grown from empty")
+    {
+        Learned grown;
+        for (const auto& kv : ref)
+            grown.insert(kv);
+        for (auto it = ref.begin(); it < ref.end(); it += 7)
+            REQUIRE(grown.find(it->first)->second == it->second);
+        REQUIRE(grown.find(static_cast<TestType>(1000001)) == grown.end());
+        grown.clear();
+        REQUIRE(grown.find(static_cast<TestType>(0)) == grown.end());
+    }
+}
+
+TEMPLATE_TEST_CASE("FM buffered insert", "[FlatMap]",
+        (FlatMap<int, int, std::less<int>, flatmap::BufferedInsert<16>>),
+        (FlatMap<double, int, std::less<double>, flatmap::BufferedInsert<>>),
+        (FlatMap<int, int, std::greater<int>, flatmap::BufferedInsert<8>>),
+        (FlatMap<std::uint64_t, int, std::less<std::uint64_t>, flatmap::BufferedInsert<32>, flatmap::LearnedSearch>))
+{
+    using Key = typename TestType::key_type;
+    using Compare = typename TestType::key_compare;
+    REQUIRE(sizeof(FlatMap<Key, int, Compare>) == sizeof(FlatMap<Key, int, Compare, flatmap::DirectInsert>));
+
+    std::mt19937 gen(11);
+    TestType map;
+    std::map<Key, int, Compare> ref;
+    auto key = [&] { return static_cast<Key>(gen() % 5000); };
+
+    auto same = [&] {
+        REQUIRE(map.size() == ref.size());
+        REQUIRE(std::equal(map.begin(), map.end(), ref.begin(), ref.end(),
+                [](const auto& a, const auto& b) { return a.first == b.first && a.second == b.second; }));
+    };
+
+    SECTION("lookups see the pending inserts")
+    {
+        for (int i = 0; i < 70000; ++i) {
+            auto kv = std::make_pair(key(), i);
+            auto res = map.insert(kv);
+            REQUIRE(res.second == ref.insert(kv).second);
+            REQUIRE(res.first->first == kv.first);
+            REQUIRE(res.first->second == ref[kv.first]);
+            Key probe = key();
+            REQUIRE(map.contains(probe) == (ref.count(probe) == 1));
+            auto it = map.find(probe);
+            if (it != map.end())
+                REQUIRE(it->second == ref[probe]);
+        }
+        same();
+    }
+
+    SECTION("ordered access merges first")
+    {
+        for (int i = 0; i < 5; ++i) {
+            auto kv = std::make_pair(key(), i);
+            map.insert(kv);
+            ref.insert(kv);
+        }
+        Key k = ref.begin()->first;
+        REQUIRE(map.lower_bound(k)->first == k);
+        REQUIRE(map.upper_bound(k) - map.begin() == 1);
+        same();
+
+        map.insert(std::make_pair(Key(6000), 1));
+        ref.insert(std::make_pair(Key(6000), 1));
+        map.flush();
+        same();
+    }
+
+    SECTION("const reads leave the pending inserts alone")
+    {
+        Key last{};
+        for (int i = 0; i < 5; ++i) {
+            auto kv = std::make_pair(key(), i);
+            if (map.insert(kv).second)
+                last = kv.first;
+            ref.insert(kv);
+        }
+        const TestType& cmap = map;
+        auto tail = map.end() - 1;
+        std::vector<Key> keys;
+        for (const auto& kv : ref)
+            keys.push_back(kv.first);
+        keys.push_back(Key(6000));
+        std::vector<typename TestType::const_iterator> found;
+        cmap.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+        for (std::size_t i = 0; i != keys.size(); ++i) {
+            REQUIRE(cmap.contains(keys[i]) == (i + 1 != keys.size()));
+            REQUIRE(cmap.count(keys[i]) == (i + 1 != keys.size() ? 1u : 0u));
+            REQUIRE(found[i] == cmap.find(keys[i]));
+        }
+        // nothing moved, the last insert is still at the back
+        REQUIRE(map.end() - 1 == tail);
+        REQUIRE(tail->first == last);
+
+        TestType merged;
+        merged.merge(cmap);
+        REQUIRE(std::equal(merged.begin(), merged.end(), ref.begin(), ref.end(),
+                [](const auto& a, const auto& b) { return a.first == b.first; }));
+        REQUIRE(map_union(cmap, merged).size() == ref.size());
+        REQUIRE(map.end() - 1 == tail);
+
+        map.flush();
+        REQUIRE(cmap.lower_bound(keys[0])->first == keys[0]);
+        same();
+    }
+
+    SECTION("erase from the pending tail")
+    {
+        for (int i = 0; i < 3000; ++i) {
+            auto kv = std::make_pair(key(), i);
+            map.insert(kv);
+            ref.insert(kv);
+            Key gone = key();
+            REQUIRE(map.erase(gone) == ref.erase(gone));
+            if (i % 7 == 0) {
+                auto it = map.find(kv.first);
+                if (it != map.end()) {
+                    map.erase(it);
+                    ref.erase(kv.first);
+                }
+            }
+        }
+        same();
+    }
+
+    SECTION("bulk operations, copies and swap")
+    {
+        for (int i = 0; i < 10; ++i) {
+            auto kv = std::make_pair(key(), i);
+            map.insert(kv);
+            ref.insert(kv);
+        }
+        TestType copy{map};
+        auto first = *ref.begin();
+        // copies come out merged, without waiting for begin()
+        const TestType frozen = map;
+        const TestType moved = std::move(copy);
+        copy = frozen;
+        for (const TestType* c : {&frozen, &moved, static_cast<const TestType*>(&copy)}) {
+            auto from_end = c->end() - c->size();
+            REQUIRE(std::is_sorted(from_end, c->end(),
+                    [&](const auto& a, const auto& b) { return c->key_comp()(a.first, b.first); }));
+        }
+        std::vector<std::pair<Key, int>> more;
+        for (int i = 0; i < 100; ++i)
+            more.emplace_back(key(), -i);
+        map.insert(more.begin(), more.end());
+        ref.insert(more.begin(), more.end());
+        same();
+
+        TestType other;
+        other.insert(std::make_pair(Key(1), 1));
+        copy.swap(other);
+        REQUIRE(copy.size() == 1u);
+        REQUIRE(other.size() == 10u);
+        REQUIRE(other.begin()->first == first.first);
+        REQUIRE(other.begin()->second == first.second);
+        REQUIRE(erase_if(other, [](const auto&) { return true; }) == 10u);
+
+        map.clear();
+        ref.clear();
+        map.insert(std::make_pair(Key(3), 3));
+        ref.insert(std::make_pair(Key(3), 3));
+        same();
+    }
+}
+
+TEST_CASE("FM flush without buffered inserts", "[FlatMap]")
+{
+    FlatMap<int, int> map{{2, 2}, {1, 1}};
+    map.flush();
+    REQUIRE(map.begin()->first == 1);
+}
+
+TEST_CASE("FM stats", "[FlatMap]")
+{
+    using Map = FlatMap<int, int, std::less<int>, flatmap::CollectStats>;
+    REQUIRE(sizeof(FlatMap<int, int>) == sizeof(FlatMap<int, int, std::less<int>, flatmap::NoStats>));
+    constexpr std::size_t element = sizeof(int) + sizeof(int);
+
+    Map map;
+    for (int i = 0; i < 100; ++i)
+        map.insert({2 * i, i});
+    flatmap::MapStats s = map.stats();
+    REQUIRE(s.inserts == 100u);
+    REQUIRE(s.peak_size == 100u);
+    REQUIRE(s.size == 100u);
+    REQUIRE(s.capacity == map.capacity());
+    REQUIRE(s.lookups == 0u);
+    // appends only, what moved is the growth from 8 to 16, 32, 64 and 128
+    REQUIRE(s.bytes_moved == (8 + 16 + 32 + 64) * element);
+
+    map.reset_stats();
+    map.insert({1, 0});
+    REQUIRE(map.stats().bytes_moved == 99 * element);
+
+    REQUIRE(map.contains(4));
+    REQUIRE(map.find(6) != map.end());
+    REQUIRE_FALSE(map.contains(5));
+    std::vector<int> keys{0, 3};
+    std::vector<Map::iterator> found;
+    map.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+    s = map.stats();
+    REQUIRE(s.lookups == 5u);
+    REQUIRE(s.hits == 3u);
+    REQUIRE(s.misses() == 2u);
+    REQUIRE(s.probes == 5 * 7u);   // 101 keys, 7 halvings
+    REQUIRE(s.probes_per_lookup() == Approx(7.0));
+
+    map.reset_stats();
+    REQUIRE(map.erase(4) == 1u);
+    REQUIRE(map.erase(5) == 0u);
+    s = map.stats();
+    REQUIRE(s.erases == 1u);
+    REQUIRE(s.lookups == 2u);
+    REQUIRE(s.bytes_moved == 97 * element);
+
+    Map other{map};
+    REQUIRE(other.stats().peak_size == other.size());
+    other.insert({-1, 0});
+    map.merge(other);
+    REQUIRE(map.stats().inserts == 1u);
+    REQUIRE(map.stats().peak_size == 101u);
+    REQUIRE(other.stats().inserts == 1u);
+    REQUIRE(erase_if(map, [](const auto& kv) { return kv.first < 0; }) == 1u);
+    REQUIRE(map.stats().erases == 2u);
+
+    map.clear();
+    REQUIRE(map.stats().size == 0u);
+    REQUIRE(map.stats().peak_size == 101u);
+
+    SECTION("buffered inserts")
+    {
+        FlatMap<int, int, std::less<int>, flatmap::BufferedInsert<8>, flatmap::CollectStats> buffered;
+        for (int i = 20; i > 0; --i)
+            buffered.insert({i, i});
+        REQUIRE(buffered.contains(3));
+        REQUIRE(buffered.stats().inserts == 20u);
+        REQUIRE(buffered.stats().hits == 1u);
+        REQUIRE(buffered.stats().bytes_moved > 0u);
+    }
+}
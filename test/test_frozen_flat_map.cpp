@@ -0,0 +1,117 @@
+#include <catch2/catch.hpp>
+#include <FlatMap/FrozenFlatMap.hpp>
+#include <FlatMap/FlatMap.hpp>
+#include <FlatMap/StaticFlatMap.hpp>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+TEST_CASE("FFM empty", "[FrozenFlatMap]")
+{
+    FrozenFlatMap<int, int> m;
+    REQUIRE(m.empty() == true);
+    REQUIRE(m.size() == 0u);
+    REQUIRE(m.begin() == m.end());
+    REQUIRE(m.find(1) == m.end());
+    REQUIRE(m.lower_bound(1) == m.end());
+
+    FlatMap<int, int> fm;
+    auto m2 = freeze(fm);
+    REQUIRE(m2.empty() == true);
+}
+
+TEMPLATE_TEST_CASE("FFM lookups all sizes", "[FrozenFlatMap]",
+        std::less<int>, std::greater<int>)
+{
+    for (int n : {1, 2, 3, 7, 8, 15, 16, 17, 100, 255, 256, 1000, 4097}) {
+        FlatMap<int, int, TestType> src;
+        std::vector<int> keys;
+        for (int i = 0; i < n; ++i) {
+            src.insert(std::make_pair(3 * i, i));
+            keys.push_back(3 * i);
+        }
+        std::sort(keys.begin(), keys.end(), TestType{});
+
+        auto m = freeze(src);
+        REQUIRE(m.size() == static_cast<size_t>(n));
+
+        for (int k = -2; k <= 3 * n + 1; ++k) {
+            auto lb = std::lower_bound(keys.begin(), keys.end(), k, TestType{});
+            auto ub = std::upper_bound(keys.begin(), keys.end(), k, TestType{});
+
+            auto it = m.lower_bound(k);
+            if (lb == keys.end()) {
+                REQUIRE(it == m.end());
+            } else {
+                REQUIRE(it->first == *lb);
+            }
+
+            auto it2 = m.upper_bound(k);
+            if (ub == keys.end()) {
+                REQUIRE(it2 == m.end());
+            } else {
+                REQUIRE(it2->first == *ub);
+            }
+
+            bool present = k >= 0 && k % 3 == 0 && k < 3 * n;
+            REQUIRE(m.contains(k) == present);
+            if (present) {
+                REQUIRE(m.find(k)->second == k / 3);
+            }
+        }
+    }
+}
+
+TEST_CASE("FFM sorted iteration", "[FrozenFlatMap]")
+{
+    for (int n : {1, 2, 5, 31, 32, 33, 300}) {
+        FlatMap<int, int> src;
+        for (int i = 0; i < n; ++i) {
+            src.insert(std::make_pair(i, -i));
+        }
+        const auto m = freeze(src);
+
+        int i = 0;
+        for (auto kv : m) {
+            REQUIRE(kv.first  == i);
+            REQUIRE(kv.second == -i);
+            ++i;
+        }
+        REQUIRE(i == n);
+
+        auto it = m.end();
+        while (it != m.begin()) {
+            --it;
+            --i;
+            REQUIRE(it->first == i);
+        }
+        REQUIRE(i == 0);
+        REQUIRE(std::distance(m.begin(), m.end()) == n);
+    }
+}
+
+TEST_CASE("FFM from StaticFlatMap with duplicates", "[FrozenFlatMap]")
+{
+    StaticFlatMap<int, int, 64> src;
+    for (int i = 0; i < 20; ++i) {
+        src.Insert(std::make_pair(i % 5, i));
+    }
+
+    auto m = freeze(src);
+    REQUIRE(m.size() == 20u);
+    for (int k = 0; k < 5; ++k) {
+        REQUIRE(m.count(k) == 4u);
+        // first inserted duplicate is found first
+        REQUIRE(m.find(k)->second == k);
+    }
+    REQUIRE(m.count(5) == 0u);
+
+    auto m2 = m;
+    REQUIRE(m2.size() == 20u);
+    FrozenFlatMap<int, int> m3;
+    m3 = std::move(m2);
+    REQUIRE(m3.find(4)->second == 4);
+    REQUIRE(std::equal(m.begin(), m.end(), m3.begin(),
+        [](auto a, auto b) { return a.first == b.first && a.second == b.second; }));
+}
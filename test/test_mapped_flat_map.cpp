@@ -0,0 +1,158 @@
+#include <catch2/catch.hpp>
+#include <FlatMap/MappedFlatMap.hpp>
+#include <FlatMap/FlatMap.hpp>
+#include <FlatMap/StaticFlatMap.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Removes the file when the test is done.
+struct TempFile {
+    std::string path;
+
+    explicit TempFile(const char* name)
+        : path{std::string("flatmap_test_") + name + ".fm"} {}
+
+    ~TempFile() { std::remove(path.c_str()); }
+};
+
+struct Route {
+    std::uint32_t next_hop;
+    std::uint16_t port;
+    std::uint16_t metric;
+};
+
+} // namespace
+
+TEST_CASE("Save and map a FlatMap", "[MappedFlatMap]")
+{
+    TempFile file{"flat"};
+    FlatMap<int, Route> map;
+    for (int i = 0; i < 1000; ++i)
+        map.insert({i * 3, Route{std::uint32_t(i), std::uint16_t(i % 7), 1}});
+    flatmap::save(map, file.path);
+
+    MappedFlatMap<int, Route> mapped{file.path};
+    REQUIRE(mapped.size() == map.size());
+    REQUIRE(mapped.find(300)->second.next_hop == 100u);
+    REQUIRE(mapped.find(301) == mapped.end());
+    REQUIRE(mapped.lower_bound(301)->first == 303);
+    REQUIRE(mapped.upper_bound(303)->first == 306);
+    REQUIRE(mapped.count(303) == 1u);
+    REQUIRE_FALSE(mapped.contains(-1));
+
+    auto it = mapped.begin();
+    for (const auto& kv : map) {
+        REQUIRE(it->first == kv.first);
+        REQUIRE(it->second.port == kv.second.port);
+        ++it;
+    }
+    REQUIRE(it == mapped.end());
+
+    MappedFlatMap<int, Route> moved{std::move(mapped)};
+    REQUIRE(mapped.empty());
+    REQUIRE(moved.contains(2997));
+}
+
+TEST_CASE("Save other maps", "[MappedFlatMap]")
+{
+    SECTION("StaticFlatMap")
+    {
+        TempFile file{"static"};
+        StaticFlatMap<std::uint64_t, double, 8> map{{5, 0.5}, {1, 0.1}, {3, 0.3}};
+        flatmap::save(map, file.path);
+        MappedFlatMap<std::uint64_t, double> mapped{file.path};
+        REQUIRE(mapped.size() == 3u);
+        REQUIRE(mapped.begin()->first == 1u);
+        REQUIRE(mapped.find(3)->second == 0.3);
+    }
+
+    SECTION("std::map, descending")
+    {
+        TempFile file{"std"};
+        std::map<int, char, std::greater<int>> map{{1, 'a'}, {2, 'b'}, {3, 'c'}};
+        flatmap::save(map, file.path);
+        MappedFlatMap<int, char, std::greater<int>> mapped{file.path};
+        REQUIRE(mapped.begin()->second == 'c');
+        REQUIRE(mapped.find(2)->second == 'b');
+        REQUIRE(mapped.lower_bound(0) == mapped.end());
+    }
+
+    SECTION("empty")
+    {
+        TempFile file{"empty"};
+        flatmap::save(FlatMap<int, int>{}, file.path);
+        MappedFlatMap<int, int> mapped{file.path};
+        REQUIRE(mapped.empty());
+        REQUIRE(mapped.find(1) == mapped.end());
+    }
+}
+
+TEST_CASE("Reject mismatching files", "[MappedFlatMap]")
+{
+    TempFile file{"bad"};
+    flatmap::save(FlatMap<int, int>{{1, 1}}, file.path);
+
+    REQUIRE_THROWS_AS((MappedFlatMap<std::int64_t, int>{file.path}), std::runtime_error);
+    REQUIRE_THROWS_AS((MappedFlatMap<int, std::int64_t>{file.path}), std::runtime_error);
+    REQUIRE_THROWS_AS((MappedFlatMap<int, int>{"flatmap_test_missing.fm"}), std::runtime_error);
+
+    std::FILE* f = std::fopen(file.path.c_str(), "r+b");
+    std::fputc('X', f);
+    std::fclose(f);
+    REQUIRE_THROWS_AS((MappedFlatMap<int, int>{file.path}), std::runtime_error);
+
+    // offsets that wrap around: keys before the mapping, values overlapping them
+    auto patch = [&](std::uint64_t keys_offset, std::uint64_t values_offset, std::uint64_t count) {
+        flatmap::save(FlatMap<int, int>{{1, 1}, {2, 2}}, file.path);
+        std::FILE* p = std::fopen(file.path.c_str(), "r+b");
+        std::fseek(p, 16, SEEK_SET);
+        std::fwrite(&count, sizeof(count), 1, p);
+        std::fseek(p, 32, SEEK_SET);
+        std::fwrite(&keys_offset, sizeof(keys_offset), 1, p);
+        std::fwrite(&values_offset, sizeof(values_offset), 1, p);
+        std::fclose(p);
+    };
+    patch(~std::uint64_t{63}, 0, 16);
+    REQUIRE_THROWS_AS((MappedFlatMap<int, int>{file.path}), std::runtime_error);
+    patch(64, 64, 2);
+    REQUIRE_THROWS_AS((MappedFlatMap<int, int>{file.path}), std::runtime_error);
+    patch(64, ~std::uint64_t{63}, 2);
+    REQUIRE_THROWS_AS((MappedFlatMap<int, int>{file.path}), std::runtime_error);
+    patch(64, 128, 2);
+    REQUIRE(MappedFlatMap<int, int>{file.path}.find(2)->second == 2);
+
+    f = std::fopen(file.path.c_str(), "wb");
+    std::fputs("FLATMAP", f);
+    std::fclose(f);
+    REQUIRE_THROWS_AS((MappedFlatMap<int, int>{file.path}), std::runtime_error);
+}
+
+TEST_CASE("Save over a mapped file", "[MappedFlatMap]")
+{
+    TempFile file{"replace"};
+    FlatMap<int, int> map;
+    for (int i = 0; i < 5000; ++i)
+        map.insert({i, i});
+    flatmap::save(map, file.path);
+    MappedFlatMap<int, int> old_view{file.path};
+
+    // the old file is replaced, not rewritten: its readers keep their pages
+    flatmap::save(FlatMap<int, int>{{7, 70}}, file.path);
+    REQUIRE(old_view.size() == 5000u);
+    REQUIRE(old_view.find(4999)->second == 4999);
+    MappedFlatMap<int, int> new_view{file.path};
+    REQUIRE(new_view.size() == 1u);
+    REQUIRE(new_view.find(7)->second == 70);
+    REQUIRE(std::fopen((file.path + ".tmp").c_str(), "rb") == nullptr);
+
+    // a failed save leaves nothing behind
+    REQUIRE_THROWS_AS(flatmap::save(map, "flatmap_test_missing_dir/map.fm"), std::runtime_error);
+    REQUIRE(std::fopen("flatmap_test_missing_dir/map.fm.tmp", "rb") == nullptr);
+    REQUIRE_THROWS_AS(flatmap::save(map, "."), std::runtime_error);   // renamed over a directory
+    REQUIRE(std::fopen("..tmp", "rb") == nullptr);
+}
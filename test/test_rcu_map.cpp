@@ -0,0 +1,113 @@
+#include <catch2/catch.hpp>
+#include <FlatMap/RcuMap.hpp>
+#include <FlatMap/FlatMap.hpp>
+#include <FlatMap/FrozenFlatMap.hpp>
+#include <FlatMap/StaticFlatMap.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST_CASE("RCU read and update", "[RcuMap]")
+{
+    RcuMap<FlatMap<int, int>> map{FlatMap<int, int>{{1, 10}, {2, 20}}};
+    auto reader = map.reader();
+    REQUIRE(reader.get(1) == 10);
+    REQUIRE(reader.get(3) == std::nullopt);
+    REQUIRE(reader.contains(2));
+
+    map.update([](FlatMap<int, int>& m) {
+        m.insert({3, 30});
+        m.erase(1);
+    });
+    REQUIRE(reader.get(1) == std::nullopt);
+    REQUIRE(reader.get(3) == 30);
+    REQUIRE(reader.read([](const FlatMap<int, int>& m) { return m.size(); }) == 2u);
+    REQUIRE(map.load().size() == 2u);
+}
+
+TEST_CASE("RCU snapshot outlives updates", "[RcuMap]")
+{
+    RcuMap<StaticFlatMap<int, int, 8>> map;
+    auto reader = map.reader();
+    map.store(StaticFlatMap<int, int, 8>{{1, 1}});
+    {
+        auto snapshot = reader.lock();
+        map.update([](StaticFlatMap<int, int, 8>& m) { m[1] = 2; });
+        map.update([](StaticFlatMap<int, int, 8>& m) { m[1] = 3; });
+        // still readable, not reclaimed yet
+        REQUIRE(snapshot->at(1) == 1);
+        REQUIRE(map.retired() >= 1u);
+    }
+    REQUIRE(reader.get(1) == 3);
+    // the next publish frees everything nobody reads anymore
+    map.update([](StaticFlatMap<int, int, 8>&) {});
+    REQUIRE(map.retired() == 0u);
+}
+
+TEST_CASE("RCU reader handles", "[RcuMap]")
+{
+    RcuMap<FrozenFlatMap<int, int>, 2> map;
+    FlatMap<int, int> src{{5, 50}};
+    map.store(freeze(src));
+    {
+        auto r1 = map.reader();
+        auto r2 = map.reader();
+        REQUIRE_THROWS_AS(map.reader(), std::range_error);
+        REQUIRE(r2.get(5) == 50);
+    }
+    auto r3 = map.reader();
+    REQUIRE(r3.get(5) == 50);
+}
+
+TEST_CASE("RCU concurrent readers see whole snapshots", "[RcuMap]")
+{
+    // every snapshot maps 0..kKeys-1 to the same version number
+    constexpr int kKeys = 64;
+    constexpr int kVersions = 300;
+    using Map = FlatMap<int, int>;
+    Map first;
+    for (int k = 0; k < kKeys; ++k) {
+        first.insert({k, 0});
+    }
+    RcuMap<Map> map{first};
+
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&] {
+            auto reader = map.reader();
+            int last = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                reader.read([&](const Map& m) {
+                    int version = m.find(0)->second;
+                    for (int k = 1; k < kKeys; ++k) {
+                        if (m.find(k)->second != version)
+                            ++torn;
+                    }
+                    // versions only go forward
+                    if (version < last)
+                        ++torn;
+                    last = version;
+                });
+            }
+        });
+    }
+
+    for (int v = 1; v <= kVersions; ++v) {
+        map.update([v](Map& m) {
+            for (auto kv : m) {
+                kv.second = v;
+            }
+        });
+    }
+    done = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+
+    REQUIRE(torn == 0);
+    REQUIRE(map.reader().get(kKeys - 1) == kVersions);
+    map.update([](Map&) {});
+    REQUIRE(map.retired() == 0u);
+}
@@ -0,0 +1,111 @@
+#include <catch2/catch.hpp>
+#include <FlatMap/ShardedFlatMap.hpp>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Sharded insert, lookup and erase", "[ShardedFlatMap]")
+{
+    ShardedFlatMap<int, int, 4> map;
+    REQUIRE(map.empty());
+    REQUIRE(map.insert({1, 10}));
+    REQUIRE(map.insert({2, 20}));
+    REQUIRE_FALSE(map.insert({1, 11}));
+    REQUIRE(map.get(1) == 10);
+    REQUIRE(map.get(3) == std::nullopt);
+
+    REQUIRE_FALSE(map.insert_or_assign(1, 12));
+    REQUIRE(map.insert_or_assign(3, 30));
+    REQUIRE(map.get(1) == 12);
+    REQUIRE(map.contains(3));
+    REQUIRE(map.size() == 3u);
+
+    REQUIRE(map.erase(2) == 1u);
+    REQUIRE(map.erase(2) == 0u);
+    REQUIRE_FALSE(map.contains(2));
+
+    int doubled = map.with_shard(3, [](FlatMap<int, int>& shard) {
+        return shard.find(3)->second *= 2;
+    });
+    REQUIRE(doubled == 60);
+    REQUIRE(map.get(3) == 60);
+
+    map.clear();
+    REQUIRE(map.empty());
+}
+
+TEST_CASE("Sharded ordered iteration", "[ShardedFlatMap]")
+{
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(-10000, 10000);
+    std::vector<std::pair<int, int>> data;
+    std::map<int, int> ref;
+    for (int i = 0; i < 5000; ++i) {
+        int key = dist(gen);
+        data.emplace_back(key, i);
+        ref.emplace(key, i);
+    }
+    auto same = [](const auto& a, const auto& b) { return a.first == b.first && a.second == b.second; };
+
+    SECTION("hash partition")
+    {
+        ShardedFlatMap<int, int, 8> map;
+        map.insert(data.begin(), data.end());
+        REQUIRE(map.size() == ref.size());
+
+        std::vector<std::pair<int, int>> seen;
+        map.for_each([&](int key, int value) { seen.emplace_back(key, value); });
+        REQUIRE(std::equal(seen.begin(), seen.end(), ref.begin(), ref.end(), same));
+
+        FlatMap<int, int> merged = map.to_flat_map();
+        REQUIRE(std::equal(merged.begin(), merged.end(), ref.begin(), ref.end(), same));
+    }
+
+    SECTION("range partition")
+    {
+        using Map = ShardedFlatMap<int, int, 3, std::less<int>, flatmap::RangePartition<int>>;
+        Map map{flatmap::RangePartition<int>{{0, 5000}}};
+        REQUIRE(map.shard_of(-1) == 0u);
+        REQUIRE(map.shard_of(0) == 1u);
+        REQUIRE(map.shard_of(4999) == 1u);
+        REQUIRE(map.shard_of(9000) == 2u);
+
+        map.insert(data.begin(), data.end(), 2);
+        auto view = map.ordered();
+        REQUIRE(std::equal(view.begin(), view.end(), ref.begin(), ref.end(), same));
+    }
+
+    SECTION("empty")
+    {
+        ShardedFlatMap<int, int, 4> map;
+        auto view = map.ordered();
+        REQUIRE(view.begin() == view.end());
+    }
+}
+
+TEST_CASE("Sharded concurrent writers", "[ShardedFlatMap]")
+{
+    ShardedFlatMap<int, int, 16> map;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t) {
+        writers.emplace_back([&map, t] {
+            for (int i = 0; i < 1000; ++i)
+                map.insert({t * 1000 + i, i});
+            for (int i = 0; i < 1000; i += 2)
+                map.erase(t * 1000 + i);
+        });
+    }
+    for (auto& w : writers)
+        w.join();
+
+    REQUIRE(map.size() == 2000u);
+    int expected = 1;
+    bool ordered = true;
+    map.for_each([&](int key, int) {
+        ordered = ordered && key == expected;
+        expected += 2;
+    });
+    REQUIRE(ordered);
+}
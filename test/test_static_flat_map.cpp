@@ -1,10 +1,18 @@
 #include <catch2/catch.hpp>
 #include <FlatMap/StaticFlatMap.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
 
 // TODO: add emplace()
 // TODO: add static_assert on TriviallyCopyable
 // TODO: add capacity() function (I guess same as max_size()) for consistency
-// TODO: add erase(const key_type& key)
 // TODO: maxMembers should be exposed constexpr:
 //           probably both make max_size() constexpr, and
 //           add static constexpr member
@@ -82,16 +90,35 @@ TEST_CASE("SFM erase", "[StaticFlatMap]")
 		REQUIRE(m.size() == static_cast<size_t>(kCount / 2));
 	}
 
-	// TODO: Erase(const KeyType& key) doesn't work like std::m::erase()
-	//       which returns number of elements removed.
-	// SECTION("unsuccessful erase by key") {
-	//     REQUIRE(m.size() == 100u);
-	//     for (int i = 100; i < 200; ++i) {
-	//         auto it = m.Erase(i);
-	//         REQUIRE(it == m.end());
-	//     }
-	//     REQUIRE(m.size() == 100u);
-	// }
+	SECTION("unsuccessful erase by key") {
+		REQUIRE(m.size() == 100u);
+		for (int i = 100; i < 200; ++i) {
+			auto it = m.Erase(i);
+			REQUIRE(it == m.end());
+			REQUIRE(m.erase(i) == 0u);
+		}
+		REQUIRE(m.size() == 100u);
+	}
+
+	SECTION("erase removes every duplicate") {
+		// make room for the duplicates
+		for (int i = 90; i < 95; ++i) {
+			m.Erase(i);
+		}
+		for (int i = 0; i < 3; ++i) {
+			m.Insert(std::make_pair(50, -i));
+		}
+		REQUIRE(m.count(50) == 4u);
+		auto it = m.Erase(50);
+		REQUIRE(it->first == 51);
+		REQUIRE(m.count(50) == 0u);
+		REQUIRE(m.size() == static_cast<size_t>(kCount - 6));
+
+		m.Insert(std::make_pair(10, 0));
+		REQUIRE(m.erase(10) == 2u);
+		REQUIRE(m.Find(10) == m.end());
+		REQUIRE(m.Find(11)->second == 12);
+	}
 }
 
 TEST_CASE("SFM lookup after erase and insert", "[StaticFlatMap]")
@@ -174,3 +201,998 @@ TEST_CASE("SFM copy", "[StaticFlatMap]")
 	REQUIRE(it2 == m2.end());
 	REQUIRE(it3 == m3.end());
 }
+
+TEMPLATE_TEST_CASE("SFM copy and move only the contents", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, int, 256, std::greater<int>, TestType>;
+	Map m1;
+	for (int i = 0; i < 20; ++i) {
+		m1.Insert(std::make_pair(i, -i));
+	}
+
+	Map m2 = m1;
+	REQUIRE(std::equal(m1.begin(), m1.end(), m2.begin(), m2.end()));
+	REQUIRE(m2.begin()->first == 19);
+
+	// copy construction writes the 20 elements, the rest keeps whatever was there
+	if constexpr (std::is_same<TestType, flatmap::PairLayout>::value) {
+		alignas(Map) unsigned char buffer[sizeof(Map)];
+		volatile unsigned char* fill = buffer;   // kept, though the copy is constructed over it
+		for (size_t i = 0; i != sizeof(buffer); ++i)
+			fill[i] = 0xAB;
+		Map* copy = new (buffer) Map(m1);
+		REQUIRE(std::equal(m1.begin(), m1.end(), copy->begin(), copy->end()));
+		const auto* first = std::addressof(*copy->begin());
+		const auto* slack = reinterpret_cast<const unsigned char*>(first + copy->size());
+		const auto* limit = reinterpret_cast<const unsigned char*>(first + copy->capacity());
+		REQUIRE(std::all_of(slack, limit, [](unsigned char b) { return b == 0xAB; }));
+		copy->~Map();
+	}
+
+	// a bigger map shrinks to the assigned contents
+	Map m3;
+	for (int i = 0; i < 100; ++i) {
+		m3.Insert(std::make_pair(1000 + i, i));
+	}
+	m3 = m2;
+	REQUIRE(m3.size() == 20u);
+	REQUIRE(std::equal(m1.begin(), m1.end(), m3.begin(), m3.end()));
+	REQUIRE(m3.find(1050) == m3.end());
+
+	Map& self = m3;
+	m3 = self;
+	REQUIRE(std::equal(m1.begin(), m1.end(), m3.begin(), m3.end()));
+
+	Map m4 = std::move(m3);
+	REQUIRE(std::equal(m1.begin(), m1.end(), m4.begin(), m4.end()));
+	Map m5;
+	m5 = std::move(m4);
+	REQUIRE(std::equal(m1.begin(), m1.end(), m5.begin(), m5.end()));
+	REQUIRE(m5.at(7) == -7);
+
+	Map empty;
+	m5 = empty;
+	REQUIRE(m5.empty());
+}
+
+template <class K, class V, class C>
+struct SfmKeyCase {
+	using Key = K;
+	using Value = V;
+	using Compare = C;
+};
+
+// key / value combinations giving every key stride the SIMD scan handles
+using SfmIntInt       = SfmKeyCase<int, int, std::less<int>>;
+using SfmIntIntGt     = SfmKeyCase<int, int, std::greater<int>>;
+using SfmUintChar     = SfmKeyCase<uint32_t, char, std::less<uint32_t>>;
+using SfmIntDouble    = SfmKeyCase<int, double, std::less<>>;
+using SfmInt64Int64   = SfmKeyCase<int64_t, int64_t, std::less<int64_t>>;
+using SfmUint64Int    = SfmKeyCase<uint64_t, int, std::greater<uint64_t>>;
+using SfmFloatFloat   = SfmKeyCase<float, float, std::less<float>>;
+using SfmDoubleDouble = SfmKeyCase<double, double, std::greater<double>>;
+using SfmShortInt     = SfmKeyCase<short, int, std::less<short>>;
+
+TEMPLATE_TEST_CASE("SFM arithmetic key lookup", "[StaticFlatMap]",
+		SfmIntInt, SfmIntIntGt, SfmUintChar, SfmIntDouble, SfmInt64Int64,
+		SfmUint64Int, SfmFloatFloat, SfmDoubleDouble, SfmShortInt)
+{
+	using Key = typename TestType::Key;
+	using Value = typename TestType::Value;
+	using Compare = typename TestType::Compare;
+
+	for (int n : {0, 1, 7, 31, 32, 33, 64, 100, 255, 256}) {
+		StaticFlatMap<Key, Value, 256, Compare> m;
+		std::vector<Key> keys;
+		// negative keys exercise the sign handling of unsigned keys too
+		for (int i = 0; i < n; ++i) {
+			Key k = static_cast<Key>(3 * (i - n / 2));
+			m.Insert(std::make_pair(k, static_cast<Value>(i)));
+			keys.push_back(k);
+		}
+		std::sort(keys.begin(), keys.end(), Compare{});
+
+		for (int i = -2 * n - 2; i <= 2 * n + 2; ++i) {
+			Key k = static_cast<Key>(i);
+			bool present = std::binary_search(keys.begin(), keys.end(), k, Compare{});
+			auto it = m.Find(k);
+			REQUIRE((it != m.end()) == present);
+			if (present) {
+				REQUIRE(it->first == k);
+			}
+		}
+	}
+}
+
+struct Payload64 {
+	int id;
+	char bytes[60];
+};
+
+struct PointKey {
+	int x, y;
+	bool operator<(const PointKey& o) const { return x < o.x || (x == o.x && y < o.y); }
+};
+
+TEMPLATE_TEST_CASE("SFM split layout", "[StaticFlatMap]", int, double, PointKey)
+{
+	using Map = StaticFlatMap<TestType, Payload64, 128, std::less<TestType>, flatmap::SplitLayout>;
+	auto key = [](int i) {
+		if constexpr (std::is_same<TestType, PointKey>::value)
+			return PointKey{i / 10, i % 10};
+		else
+			return static_cast<TestType>(i);
+	};
+	constexpr int kCount = 100;
+
+	Map m;
+	for (int i = kCount - 1; i >= 0; i -= 2) {
+		m.Insert(std::make_pair(key(i), Payload64{i, {}}));
+	}
+	for (int i = 0; i < kCount; i += 2) {
+		auto it = m.Insert(std::make_pair(key(i), Payload64{i, {}}));
+		REQUIRE(it->second.id == i);
+	}
+	REQUIRE(m.size() == static_cast<size_t>(kCount));
+
+	SECTION("iteration yields sorted pairs") {
+		int i = 0;
+		for (auto kv : m) {
+			REQUIRE(!(kv.first < key(i)));
+			REQUIRE(!(key(i) < kv.first));
+			REQUIRE(kv.second.id == i);
+			++i;
+		}
+		REQUIRE(i == kCount);
+
+		for (auto it = m.rbegin(); it != m.rend(); ++it) {
+			--i;
+			REQUIRE(it->second.id == i);
+		}
+		REQUIRE(i == 0);
+	}
+
+	SECTION("lookups and updates") {
+		for (int i = 0; i < kCount; ++i) {
+			auto it = m.Find(key(i));
+			REQUIRE(it != m.end());
+			it->second.id = -i;
+		}
+		const Map& cm = m;
+		for (int i = 0; i < kCount; ++i) {
+			REQUIRE(cm.Find(key(i))->second.id == -i);
+			REQUIRE(m[key(i)].id == -i);
+		}
+		REQUIRE(m.Find(key(kCount)) == m.end());
+		m[key(kCount)].id = 7;
+		REQUIRE(m.size() == static_cast<size_t>(kCount + 1));
+		REQUIRE(m.Find(key(kCount))->second.id == 7);
+	}
+
+	SECTION("erase") {
+		for (int i = 0; i < kCount; i += 2) {
+			m.Erase(key(i));
+		}
+		REQUIRE(m.size() == static_cast<size_t>(kCount / 2));
+		for (int i = 0; i < kCount; ++i) {
+			REQUIRE((m.Find(key(i)) == m.end()) == (i % 2 == 0));
+		}
+	}
+
+	SECTION("duplicates keep insertion order") {
+		m.Insert(std::make_pair(key(10), Payload64{1000, {}}));
+		auto it = m.Find(key(10));
+		REQUIRE(it->second.id == 10);
+		++it;
+		REQUIRE(it->second.id == 1000);
+	}
+}
+
+TEMPLATE_TEST_CASE("SFM bulk construction", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, int, 64, std::less<int>, TestType>;
+
+	SECTION("initializer list") {
+		Map m{{5, 0}, {1, 1}, {3, 2}, {1, 3}, {4, 4}, {1, 5}};
+		REQUIRE(m.size() == 6u);
+		std::vector<std::pair<int, int>> expected{{1, 1}, {1, 3}, {1, 5}, {3, 2}, {4, 4}, {5, 0}};
+		REQUIRE(std::equal(m.begin(), m.end(), expected.begin(), expected.end(),
+			[](auto a, auto b) { return a.first == b.first && a.second == b.second; }));
+	}
+
+	SECTION("iterator range") {
+		std::vector<std::pair<int, int>> src;
+		for (int i = 0; i < 64; ++i) {
+			src.emplace_back((i * 37) % 64, i);
+		}
+		Map m(src.begin(), src.end());
+		REQUIRE(m.size() == 64u);
+		for (int i = 0; i < 64; ++i) {
+			REQUIRE(m.Find(i) != m.end());
+			REQUIRE(m.begin()[i].first == i);
+		}
+	}
+
+	SECTION("sorted tag") {
+		std::vector<std::pair<int, int>> src{{1, 0}, {2, 1}, {2, 2}, {7, 3}};
+		Map m(flatmap::sorted_equivalent, src.begin(), src.end());
+		REQUIRE(m.size() == 4u);
+		REQUIRE(m.Find(2)->second == 1);
+		REQUIRE(m.Find(7)->second == 3);
+	}
+
+	SECTION("range insert merges after equal keys") {
+		Map m{{2, 0}, {4, 0}, {6, 0}};
+		std::vector<std::pair<int, int>> src{{5, 1}, {4, 1}, {1, 1}, {6, 1}, {4, 2}};
+		m.insert(src.begin(), src.end());
+		std::vector<std::pair<int, int>> expected{{1, 1}, {2, 0}, {4, 0}, {4, 1}, {4, 2}, {5, 1}, {6, 0}, {6, 1}};
+		REQUIRE(std::equal(m.begin(), m.end(), expected.begin(), expected.end(),
+			[](auto a, auto b) { return a.first == b.first && a.second == b.second; }));
+	}
+
+	SECTION("overflow leaves the map untouched") {
+		Map m{{1, 1}, {2, 2}};
+		std::vector<std::pair<int, int>> src(63, std::make_pair(0, 0));
+		REQUIRE_THROWS_AS(m.insert(src.begin(), src.end()), std::range_error);
+		REQUIRE(m.size() == 2u);
+		REQUIRE(m.begin()->first == 1);
+	}
+}
+
+TEMPLATE_TEST_CASE("SFM find_batch", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, Payload64, 256, std::less<int>, TestType>;
+	for (int n : {0, 1, 16, 200, 256}) {
+		Map m;
+		for (int i = 0; i < n; ++i) {
+			m.Insert(std::make_pair(3 * i, Payload64{i, {}}));
+		}
+
+		std::vector<int> keys;
+		for (int i = -5; i < 3 * n + 5; ++i) {
+			keys.push_back(i);
+		}
+
+		std::vector<typename Map::iterator> found;
+		m.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+		REQUIRE(found.size() == keys.size());
+		for (size_t i = 0; i < keys.size(); ++i) {
+			REQUIRE(found[i] == m.Find(keys[i]));
+		}
+
+		const Map& cm = m;
+		std::vector<typename Map::const_iterator> cfound;
+		cm.FindBatch(keys.begin(), keys.end(), std::back_inserter(cfound));
+		for (size_t i = 0; i < keys.size(); ++i) {
+			REQUIRE(cfound[i] == cm.Find(keys[i]));
+		}
+	}
+}
+
+// 16 byte pairs of a 12 byte key: the keys can't be walked as a strided array
+struct Key3 {
+	int a, b, c;
+	bool operator<(const Key3& o) const { return a < o.a; }
+};
+
+TEST_CASE("SFM find_batch without key stride", "[StaticFlatMap]")
+{
+	StaticFlatMap<Key3, int, 16> m;
+	for (int i = 0; i < 10; ++i) {
+		m.Insert(std::make_pair(Key3{i, 0, 0}, i));
+	}
+	std::vector<Key3> keys{{3, 0, 0}, {11, 0, 0}, {0, 0, 0}};
+	std::vector<StaticFlatMap<Key3, int, 16>::iterator> found;
+	m.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+	REQUIRE(found[0]->second == 3);
+	REQUIRE(found[1] == m.end());
+	REQUIRE(found[2]->second == 0);
+}
+
+namespace {
+
+enum class Color { Red, Green, Blue };
+
+constexpr StaticFlatMap<int, int, 8> kSquares{flatmap::constant_init, {{3, 9}, {1, 1}, {2, 4}, {0, 0}}};
+constexpr StaticFlatMap<Color, const char*, 4, std::less<Color>, flatmap::SplitLayout> kColorNames{
+	flatmap::constant_init, {{Color::Blue, "blue"}, {Color::Red, "red"}, {Color::Green, "green"}}};
+
+static_assert(kSquares.size() == 4, "built at compile time");
+static_assert(kSquares.begin()->first == 0, "sorted at compile time");
+static_assert((kSquares.end() - 1)->second == 9, "sorted at compile time");
+#ifdef FLATMAP_HAS_IS_CONSTANT_EVALUATED
+static_assert(kSquares.at(2) == 4, "constexpr at");
+static_assert(kSquares.find(4) == kSquares.end(), "constexpr find miss");
+static_assert(kColorNames.at(Color::Green)[0] == 'g', "constexpr split layout");
+
+template <class Layout>
+constexpr StaticFlatMap<int, int, 8, std::less<int>, Layout> copyTable()
+{
+	StaticFlatMap<int, int, 8, std::less<int>, Layout> table(flatmap::constant_init, {{3, 30}, {1, 10}});
+	auto copy = table;
+	return copy;
+}
+static_assert(copyTable<flatmap::PairLayout>().at(3) == 30, "constexpr copy and move");
+static_assert(copyTable<flatmap::SplitLayout>().at(1) == 10, "constexpr copy and move");
+
+constexpr StaticFlatMap<int, int, 4, std::less<int>, flatmap::BufferedInsert<2>> kBufferedTable{
+	flatmap::constant_init, {{2, 20}, {1, 10}}};
+static_assert(kBufferedTable.at(2) == 20 && kBufferedTable.find(3) == kBufferedTable.end(), "constexpr lookup, nothing pending");
+#endif
+
+} // ~namespace
+
+TEST_CASE("SFM constexpr construction", "[StaticFlatMap]")
+{
+	StaticFlatMap<int, int, 8> runtime{{3, 9}, {1, 1}, {2, 4}, {0, 0}};
+	REQUIRE(std::equal(runtime.begin(), runtime.end(), kSquares.begin(), kSquares.end()));
+	StaticFlatMap<int, int, 8> tagged{flatmap::constant_init, {{3, 9}, {1, 1}, {2, 4}, {0, 0}}};
+	REQUIRE(std::equal(tagged.begin(), tagged.end(), kSquares.begin(), kSquares.end()));
+	REQUIRE(kSquares.at(3) == 9);
+	REQUIRE_THROWS_AS(kSquares.at(7), std::out_of_range);
+	REQUIRE(std::string(kColorNames.at(Color::Red)) == "red");
+	REQUIRE(kColorNames.find(Color::Blue)->second == std::string("blue"));
+
+	// equal keys keep their input order, as with the runtime bulk path
+	constexpr StaticFlatMap<int, int, 4> dups{flatmap::constant_init, {{1, 1}, {0, 0}, {1, 2}}};
+	StaticFlatMap<int, int, 4> runtimeDups{{1, 1}, {0, 0}, {1, 2}};
+	REQUIRE(std::equal(runtimeDups.begin(), runtimeDups.end(), dups.begin(), dups.end()));
+	static_assert(dups.size() == 3, "duplicates are kept");
+	static_assert((dups.begin() + 1)->second == 1 && (dups.begin() + 2)->second == 2,
+		"insertion sort is stable");
+}
+
+namespace {
+
+// Keys carry a generation next to the id, lookups only know the id
+struct Handle {
+	int id;
+	int generation;
+};
+
+struct HandleLess {
+	using is_transparent = void;
+	bool operator()(const Handle& a, const Handle& b) const { return a.id < b.id; }
+	bool operator()(const Handle& a, int id) const { return a.id < id; }
+	bool operator()(int id, const Handle& b) const { return id < b.id; }
+};
+
+// Ordering picked at runtime, only usable when the map keeps the instance it was given
+struct Direction {
+	bool descending = false;
+	bool operator()(int a, int b) const { return descending ? b < a : a < b; }
+};
+
+} // ~namespace
+
+TEMPLATE_TEST_CASE("SFM transparent lookup", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<Handle, int, 64, HandleLess, TestType>;
+	Map m;
+	for (int i = 0; i < 20; ++i) {
+		m.Insert(std::make_pair(Handle{2 * (i / 2), i}, i));
+	}
+
+	REQUIRE(m.Find(10)->second == 10);
+	REQUIRE(m.find(11) == m.end());
+	REQUIRE(m.contains(18));
+	REQUIRE_FALSE(m.contains(19));
+	REQUIRE(m.count(4) == 2u);
+	REQUIRE(m.count(Handle{4, 0}) == 2u);
+	REQUIRE(m.count(5) == 0u);
+	REQUIRE(m.lower_bound(5)->first.id == 6);
+	REQUIRE(m.upper_bound(6)->first.id == 8);
+
+	const Map& cm = m;
+	auto range = cm.equal_range(12);
+	REQUIRE(range.second - range.first == 2);
+	REQUIRE(range.first->first.generation == 12);
+	REQUIRE((range.first + 1)->first.generation == 13);
+	REQUIRE(cm.upper_bound(Handle{18, 0}) == cm.end());
+}
+
+TEMPLATE_TEST_CASE("SFM stateful comparator", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	StaticFlatMap<int, int, 32, Direction, TestType> m{Direction{true}};
+	for (int i : {5, 1, 9, 3, 7, 3}) {
+		m.Insert(std::make_pair(i, i * 10));
+	}
+	std::vector<std::pair<int, int>> bulk{{4, 40}, {8, 80}};
+	m.Insert(bulk.begin(), bulk.end());
+
+	std::vector<int> keys;
+	for (const auto& kv : m) {
+		keys.push_back(kv.first);
+	}
+	REQUIRE(keys == std::vector<int>{9, 8, 7, 5, 4, 3, 3, 1});
+	REQUIRE(m.Find(7)->second == 70);
+	REQUIRE(m.find(6) == m.end());
+	REQUIRE(m.count(3) == 2u);
+	REQUIRE(m.lower_bound(6)->first == 5);
+	REQUIRE(m.upper_bound(3)->first == 1);
+	REQUIRE(m.at(1) == 10);
+}
+
+TEMPLATE_TEST_CASE("SFM unique keys", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, int, 16, std::less<int>, flatmap::UniqueKeys, TestType>;
+	Map m;
+
+	auto r1 = m.Insert(std::make_pair(5, 50));
+	REQUIRE(r1.second);
+	REQUIRE(r1.first->second == 50);
+	auto r2 = m.insert(std::make_pair(5, 51));
+	REQUIRE_FALSE(r2.second);
+	REQUIRE(r2.first == r1.first);
+	REQUIRE(r2.first->second == 50);
+	REQUIRE(m.size() == 1u);
+
+	auto r3 = m.try_emplace(3, 30);
+	REQUIRE(r3.second);
+	REQUIRE(m.try_emplace(3, 31).second == false);
+	REQUIRE(m.at(3) == 30);
+
+	auto r4 = m.insert_or_assign(3, 32);
+	REQUIRE_FALSE(r4.second);
+	REQUIRE(r4.first->second == 32);
+	REQUIRE(m.insert_or_assign(4, 40).second);
+	REQUIRE(m.size() == 3u);
+
+	// the bulk paths keep the first of the equal keys, existing elements first
+	std::vector<std::pair<int, int>> bulk{{9, 90}, {4, 41}, {9, 91}, {1, 10}, {9, 92}};
+	m.Insert(bulk.begin(), bulk.end());
+	std::vector<std::pair<int, int>> expected{{1, 10}, {3, 32}, {4, 40}, {5, 50}, {9, 90}};
+	REQUIRE(std::equal(m.begin(), m.end(), expected.begin(), expected.end(), [](const auto& a, const auto& b) {
+		return a.first == b.first && a.second == b.second;
+	}));
+
+	Map sorted{flatmap::sorted_equivalent, {{1, 1}, {1, 2}, {2, 3}, {2, 4}, {2, 5}, {3, 6}}};
+	REQUIRE(sorted.size() == 3u);
+	REQUIRE(sorted.at(2) == 3);
+
+	Map list{{7, 1}, {2, 2}, {7, 3}};
+	REQUIRE(list.size() == 2u);
+	REQUIRE(list.at(7) == 1);
+	REQUIRE(list.erase(7) == 1u);
+}
+
+TEST_CASE("SFM constexpr unique keys", "[StaticFlatMap]")
+{
+	constexpr StaticFlatMap<int, int, 4, std::less<int>, flatmap::UniqueKeys> m{
+		flatmap::constant_init, {{2, 1}, {1, 1}, {2, 2}, {1, 2}}};
+	static_assert(m.size() == 2, "duplicates dropped at compile time");
+	static_assert(m.begin()->second == 1 && (m.begin() + 1)->second == 1, "first one kept");
+	REQUIRE(m.size() == 2u);
+}
+
+TEST_CASE("SFM try_emplace and insert_or_assign on a multimap", "[StaticFlatMap]")
+{
+	StaticFlatMap<int, int, 16> m;
+	m.Insert(std::make_pair(1, 10));
+	m.Insert(std::make_pair(1, 11));
+	REQUIRE_FALSE(m.try_emplace(1, 12).second);
+	REQUIRE(m.count(1) == 2u);
+	REQUIRE_FALSE(m.insert_or_assign(1, 13).second);
+	REQUIRE(m.Find(1)->second == 13);
+	REQUIRE((m.Find(1) + 1)->second == 11);
+	REQUIRE(m.try_emplace(2).second);
+	REQUIRE(m.at(2) == 0);
+}
+
+TEMPLATE_TEST_CASE("SFM range erase and erase_if", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, int, 128, std::less<int>, TestType>;
+	Map m;
+	for (int i = 0; i < 100; ++i) {
+		m.Insert(std::make_pair(i / 2, i));
+	}
+
+	SECTION("range") {
+		auto it = m.erase(m.lower_bound(10), m.lower_bound(30));
+		REQUIRE(it->first == 30);
+		REQUIRE(m.size() == 60u);
+		REQUIRE(m.count(20) == 0u);
+		REQUIRE(m.Find(9)->second == 18);
+		it = m.Erase(m.cbegin(), m.cend());
+		REQUIRE(it == m.end());
+		REQUIRE(m.empty());
+	}
+
+	SECTION("erase_if") {
+		// drop the second of every pair of equal keys and every key past 40
+		size_t removed = erase_if(m, [](const auto& kv) { return kv.second % 2 == 1 || kv.first >= 40; });
+		REQUIRE(removed == 60u);
+		REQUIRE(m.size() == 40u);
+		int expected = 0;
+		for (const auto& kv : m) {
+			REQUIRE(kv.first == expected);
+			REQUIRE(kv.second == 2 * expected);
+			++expected;
+		}
+		REQUIRE(m.at(17) == 34);
+	}
+}
+
+TEMPLATE_TEST_CASE("SFM merge and set operations", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, int, 64, std::less<int>, TestType>;
+	Map a{{1, 10}, {3, 30}, {3, 31}, {5, 50}, {7, 70}};
+	Map b{{0, 0}, {3, -30}, {5, -50}, {5, -51}, {8, -80}};
+	auto pairs = [](const Map& m) {
+		std::vector<std::pair<int, int>> out;
+		for (const auto& kv : m) {
+			out.emplace_back(kv.first, kv.second);
+		}
+		return out;
+	};
+	using Pairs = std::vector<std::pair<int, int>>;
+
+	// equal keys are paired up in order, the extra ones behave as if unique
+	REQUIRE(pairs(map_union(a, b)) == Pairs{{0, 0}, {1, 10}, {3, 30}, {3, 31}, {5, 50}, {5, -51}, {7, 70}, {8, -80}});
+	REQUIRE(pairs(map_union(a, b, flatmap::KeepRight{})) ==
+		Pairs{{0, 0}, {1, 10}, {3, -30}, {3, 31}, {5, -50}, {5, -51}, {7, 70}, {8, -80}});
+	REQUIRE(pairs(map_intersection(a, b, [](int, int x, int y) { return x + y; })) == Pairs{{3, 0}, {5, 0}});
+	REQUIRE(pairs(map_difference(a, b)) == Pairs{{1, 10}, {3, 31}, {7, 70}});
+
+	// a multimap merge keeps everything, the incoming equal keys last
+	a.merge(b);
+	REQUIRE(pairs(a) == Pairs{{0, 0}, {1, 10}, {3, 30}, {3, 31}, {3, -30}, {5, 50}, {5, -50}, {5, -51},
+		{7, 70}, {8, -80}});
+	REQUIRE(pairs(b).size() == 5u);
+
+	StaticFlatMap<int, int, 4, std::less<int>, TestType> small{{1, 1}, {2, 2}, {3, 3}};
+	StaticFlatMap<int, int, 4, std::less<int>, TestType> other{{0, 0}, {4, 4}};
+	REQUIRE_THROWS_AS(small.merge(other), std::range_error);
+	REQUIRE(small.size() == 3u);
+}
+
+TEMPLATE_TEST_CASE("SFM unique keys merge", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, int, 6, std::less<int>, flatmap::UniqueKeys, TestType>;
+	Map base{{1, 1}, {2, 2}, {4, 4}, {6, 6}};
+	Map overlay{{0, 0}, {2, -2}, {6, -6}};
+
+	// in place, the common keys leave holes that get closed
+	Map m = base;
+	m.merge(overlay, flatmap::KeepRight{});
+	REQUIRE(m.size() == 5u);
+	std::vector<int> values;
+	for (const auto& kv : m) {
+		values.push_back(kv.second);
+	}
+	REQUIRE(values == std::vector<int>{0, 1, -2, 4, -6});
+
+	// 4 + 3 elements don't fit in 6 slots but the union does
+	Map full{{1, 1}, {2, 2}, {3, 3}, {4, 4}};
+	full.merge(Map{{2, 20}, {3, 30}, {5, 50}});
+	REQUIRE(full.size() == 5u);
+	REQUIRE(full.at(3) == 3);
+	REQUIRE(full.at(5) == 50);
+
+	Map big{{10, 0}, {11, 0}, {12, 0}};
+	REQUIRE_THROWS_AS(full.merge(big), std::range_error);
+	REQUIRE(full.size() == 5u);
+}
+
+// No operator<< needed on the key and value types, errors don't print them
+struct Opaque {
+	int id;
+	bool operator<(const Opaque& o) const { return id < o.id; }
+};
+
+TEMPLATE_TEST_CASE("SFM non-throwing insert and lookup", "[StaticFlatMap]", flatmap::MultiKeys, flatmap::UniqueKeys)
+{
+	using Map = StaticFlatMap<Opaque, Opaque, 4, std::less<Opaque>, TestType>;
+	constexpr bool unique = std::is_same<TestType, flatmap::UniqueKeys>::value;
+	Map m;
+
+	auto r1 = m.try_insert(std::make_pair(Opaque{1}, Opaque{10}));
+	REQUIRE(r1.second == flatmap::InsertStatus::Inserted);
+	REQUIRE(r1.first->second.id == 10);
+
+	auto r2 = m.try_insert(std::make_pair(Opaque{1}, Opaque{11}));
+	REQUIRE(r2.second == (unique ? flatmap::InsertStatus::Exists : flatmap::InsertStatus::Inserted));
+	REQUIRE(r2.first->second.id == (unique ? 10 : 11));
+
+	std::vector<std::pair<Opaque, Opaque>> two{{Opaque{3}, Opaque{30}}, {Opaque{2}, Opaque{20}}};
+	REQUIRE(m.try_insert(two.begin(), two.end()) == flatmap::InsertStatus::Inserted);
+	REQUIRE(m.size() == (unique ? 3u : 4u));
+	if (unique) {
+		REQUIRE(m.try_insert(std::make_pair(Opaque{4}, Opaque{40})).second == flatmap::InsertStatus::Inserted);
+	}
+
+	auto r3 = m.try_insert(std::make_pair(Opaque{9}, Opaque{90}));
+	REQUIRE(r3.second == flatmap::InsertStatus::Overflow);
+	REQUIRE(r3.first == m.end());
+	// the range must fit before duplicates are dropped
+	REQUIRE(m.try_insert(two.begin(), two.end()) == flatmap::InsertStatus::Overflow);
+	REQUIRE(m.size() == m.capacity());
+	REQUIRE_THROWS_AS(m.Insert(std::make_pair(Opaque{9}, Opaque{90})), std::range_error);
+
+	REQUIRE(m.try_at(Opaque{1})->id == 10);
+	REQUIRE(m.try_at(Opaque{7}) == nullptr);
+	m.try_at(Opaque{1})->id = 12;
+	const Map& cm = m;
+	REQUIRE(cm.try_at(Opaque{1})->id == 12);
+	REQUIRE_THROWS_AS(cm.at(Opaque{7}), std::out_of_range);
+}
+
+TEMPLATE_TEST_CASE("SFM stats", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, int, 16, std::less<int>, TestType, flatmap::UniqueKeys, flatmap::CollectStats>;
+	REQUIRE(sizeof(StaticFlatMap<int, int, 16, std::less<int>, TestType>) ==
+			sizeof(StaticFlatMap<int, int, 16, std::less<int>, TestType, flatmap::NoStats>));
+	constexpr size_t element = sizeof(int) + sizeof(int);
+	Map m;
+
+	m.insert({3, 30});
+	m.insert({1, 10});   // shifts 3
+	m.insert({2, 20});   // shifts 3
+	m.insert({2, 21});   // already there
+	flatmap::MapStats s = m.stats();
+	REQUIRE(s.inserts == 3u);
+	REQUIRE(s.bytes_moved == 2 * element);
+	REQUIRE(s.peak_size == 3u);
+	REQUIRE(s.size == 3u);
+	REQUIRE(s.capacity == 16u);
+	REQUIRE(s.lookups == 0u);
+
+	REQUIRE(m.find(2) != m.end());
+	REQUIRE(m.contains(1));
+	REQUIRE_FALSE(m.contains(5));
+	REQUIRE(m.try_at(7) == nullptr);
+	m[4] = 40;           // a miss, then an insert at the end
+	s = m.stats();
+	REQUIRE(s.lookups == 5u);
+	REQUIRE(s.hits == 2u);
+	REQUIRE(s.misses() == 3u);
+	REQUIRE(s.probes == 5 * 2u);   // over 3 keys: 2 halvings
+	REQUIRE(s.hit_ratio() == Approx(0.4));
+
+	m.reset_stats();
+	REQUIRE(m.stats().peak_size == 4u);
+	REQUIRE(m.erase(1) == 1u);       // shifts 2, 3 and 4
+	std::vector<std::pair<int, int>> more{{0, 0}, {9, 90}, {3, 31}};
+	m.insert(more.begin(), more.end());
+	REQUIRE(erase_if(m, [](const auto& kv) { return kv.first > 5; }) == 1u);
+	s = m.stats();
+	REQUIRE(s.erases == 2u);
+	REQUIRE(s.inserts == 2u);
+	REQUIRE(s.peak_size == 5u);
+	REQUIRE(s.bytes_moved >= 3 * element);
+
+	Map copy{m};
+	REQUIRE(copy.stats().inserts == 0u);
+	REQUIRE(copy.stats().peak_size == copy.size());
+	Map assigned;
+	assigned.insert({1, 1});
+	assigned = m;
+	REQUIRE(assigned.stats().peak_size == m.size());
+	m.clear();
+	REQUIRE(m.stats().peak_size == 5u);
+	REQUIRE(m.stats().size == 0u);
+}
+
+TEMPLATE_TEST_CASE("SFM bloom filter", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, int, 256, std::less<int>, TestType, flatmap::UniqueKeys, flatmap::BloomFilter<>>;
+	REQUIRE(sizeof(StaticFlatMap<int, int, 256, std::less<int>, TestType>) ==
+			sizeof(StaticFlatMap<int, int, 256, std::less<int>, TestType, flatmap::NoFilter>));
+	std::mt19937 gen(24);
+	std::uniform_int_distribution<int> dist(-1000, 1000);
+	std::map<int, int> ref;
+	Map m;
+
+	// a filter never rejects a key in the map
+	auto check = [&]() {
+		REQUIRE(m.size() == ref.size());
+		for (const auto& kv : ref)
+			REQUIRE(m.at(kv.first) == kv.second);
+		for (int key = -1000; key <= 1000; ++key)
+			REQUIRE(m.contains(key) == (ref.count(key) != 0));
+	};
+
+	for (int round = 0; round < 3; ++round) {
+		while (ref.size() < 200) {
+			int key = dist(gen);
+			ref.emplace(key, key * 2);
+			m.insert({key, key * 2});
+		}
+		check();
+		// erase most of them, the filter gets rebuilt on the way
+		for (int i = 0; i < 150; ++i) {
+			int key = std::next(ref.begin(), gen() % ref.size())->first;
+			REQUIRE(m.erase(key) == 1u);
+			ref.erase(key);
+		}
+		check();
+		m[dist(gen)];
+		ref.clear();
+		for (const auto& kv : m)
+			ref.insert(kv);
+	}
+
+	std::vector<std::pair<int, int>> more;
+	for (int i = 0; i < 40; ++i)
+		more.emplace_back(dist(gen), i);
+	m.insert(more.begin(), more.end());
+	ref.insert(more.begin(), more.end());
+	check();
+	size_t thirds = 0;
+	for (auto it = ref.begin(); it != ref.end();)
+		it = it->first % 3 == 0 ? (++thirds, ref.erase(it)) : std::next(it);
+	REQUIRE(erase_if(m, [](const auto& kv) { return kv.first % 3 == 0; }) == thirds);
+	check();
+
+	Map copy{m};
+	for (const auto& kv : ref)
+		REQUIRE(copy.contains(kv.first));
+	m.clear();
+	ref.clear();
+	check();
+	copy = Map(more.begin(), more.end());
+	for (const auto& kv : more)
+		REQUIRE(copy.contains(kv.first));
+
+	constexpr StaticFlatMap<int, int, 8, std::greater<int>, TestType, flatmap::BloomFilter<16>> small{
+		flatmap::constant_init, {{5, 1}, {2, 2}, {9, 3}}};
+	static_assert(small.find(9) != small.end() && small.find(4) == small.end(), "constexpr lookups go through the filter");
+	REQUIRE(small.at(2) == 2);
+}
+
+TEMPLATE_TEST_CASE("SFM hot key cache", "[StaticFlatMap]", flatmap::PairLayout, flatmap::SplitLayout)
+{
+	using Map = StaticFlatMap<int, int, 128, std::less<int>, TestType, flatmap::HotKeyCache<4>>;
+	REQUIRE(sizeof(StaticFlatMap<int, int, 128, std::less<int>, TestType>) ==
+			sizeof(StaticFlatMap<int, int, 128, std::less<int>, TestType, flatmap::NoCache>));
+	std::mt19937 gen(25);
+	std::uniform_int_distribution<int> dist(0, 199);
+	std::multimap<int, int> ref;
+	Map m;
+
+	// a few keys are looked up over and over, every kind of change moves them around
+	const int hot[] = {7, 50, 51, 120, 199};
+	auto check = [&]() {
+		REQUIRE(m.size() == ref.size());
+		for (int round = 0; round < 3; ++round) {
+			for (int key : hot) {
+				auto it = m.find(key);
+				auto expected = ref.find(key);
+				REQUIRE((it == m.end()) == (expected == ref.end()));
+				if (it != m.end())
+					REQUIRE(it->second == expected->second);
+				REQUIRE(m.contains(key) == (expected != ref.end()));
+			}
+		}
+	};
+
+	for (int step = 0; step < 300; ++step) {
+		int key = dist(gen);
+		switch (step % 6) {
+		case 0:
+		case 1:
+			if (m.size() < 120) {
+				m.Insert({key, step});
+				ref.emplace(key, step);
+			}
+			break;
+		case 2:
+			m.Erase(key);
+			ref.erase(key);
+			break;
+		case 3:
+			if (m.size() < 120 && !m.contains(key)) {
+				m[key] = step;
+				ref.emplace(key, step);
+			}
+			break;
+		case 4:
+			if (m.size() < 100) {
+				std::vector<std::pair<int, int>> more{{dist(gen), step}, {dist(gen), step}, {hot[step % 5], step}};
+				m.Insert(more.begin(), more.end());
+				ref.insert(more.begin(), more.end());
+			}
+			break;
+		case 5:
+			if (step % 60 == 5) {
+				m.Clear();
+				ref.clear();
+			}
+			else if (step % 30 == 11) {
+				erase_if(m, [](const auto& kv) { return kv.first % 2 == 0; });
+				for (auto it = ref.begin(); it != ref.end();)
+					it = it->first % 2 == 0 ? ref.erase(it) : std::next(it);
+			}
+			break;
+		}
+		check();
+	}
+
+	// the copy starts with an empty cache, assignment drops the old entries
+	Map copy{m};
+	Map other;
+	other.Insert({hot[0], -1});
+	REQUIRE(other.at(hot[0]) == -1);
+	other = copy;
+	check();
+	REQUIRE(other.contains(hot[0]) == (ref.count(hot[0]) != 0));
+
+	// cache hits are lookups without a search
+	StaticFlatMap<int, int, 64, std::less<int>, TestType, flatmap::HotKeyCache<>, flatmap::CollectStats> s;
+	for (int i = 0; i < 32; ++i)
+		s.Insert({i, i});
+	REQUIRE(s.at(5) == 5);
+	REQUIRE(s.at(5) == 5);
+	REQUIRE(s.at(5) == 5);
+	++s[5];
+	REQUIRE(s.stats().lookups == 4u);
+	REQUIRE(s.stats().hits == 4u);
+	REQUIRE(s.stats().probes == 6u);   // only the first lookup searched 32 keys
+	s.Insert({-1, -1});
+	REQUIRE(s.at(5) == 6);
+	REQUIRE(s.stats().probes == 12u);
+}
+
+TEMPLATE_TEST_CASE("SFM buffered insert", "[StaticFlatMap]",
+		(StaticFlatMap<int, int, 600, std::less<int>, flatmap::BufferedInsert<16>>),
+		(StaticFlatMap<int, int, 600, std::less<int>, flatmap::SplitLayout, flatmap::BufferedInsert<8>>),
+		(StaticFlatMap<int, int, 600, std::greater<int>, flatmap::UniqueKeys, flatmap::BufferedInsert<16>,
+			flatmap::BloomFilter<>, flatmap::HotKeyCache<4>>),
+		(StaticFlatMap<double, int, 600, std::less<double>, flatmap::SplitLayout, flatmap::UniqueKeys,
+			flatmap::BufferedInsert<>>))
+{
+	using Key = typename TestType::key_type;
+	using Compare = typename TestType::key_compare;
+	using Ref = std::conditional_t<std::is_same<typename TestType::InsertResult,
+		typename TestType::iterator>::value, std::multimap<Key, int, Compare>, std::map<Key, int, Compare>>;
+	constexpr bool unique = !std::is_same<typename TestType::InsertResult, typename TestType::iterator>::value;
+	REQUIRE(sizeof(StaticFlatMap<Key, int, 600, Compare>) ==
+			sizeof(StaticFlatMap<Key, int, 600, Compare, flatmap::DirectInsert>));
+
+	std::mt19937 gen(31);
+	auto key = [&] { return static_cast<Key>(gen() % 300); };
+	TestType m;
+	Ref ref;
+
+	auto same = [&] {
+		REQUIRE(m.size() == ref.size());
+		REQUIRE(std::equal(m.begin(), m.end(), ref.begin(), ref.end(),
+				[](const auto& a, const auto& b) { return a.first == b.first && a.second == b.second; }));
+	};
+	auto insert = [&](Key k, int v) {
+		auto res = m.Insert({k, v});
+		if constexpr (unique) {
+			bool inserted = ref.emplace(k, v).second;
+			REQUIRE(res.second == inserted);
+			REQUIRE(res.first->second == ref[k]);
+		}
+		else {
+			ref.emplace(k, v);
+			REQUIRE(res->first == k);
+			REQUIRE(res->second == v);
+		}
+	};
+
+	SECTION("lookups see the pending inserts")
+	{
+		for (int i = 0; i < 3000; ++i) {
+			if (m.size() == 500) {
+				same();
+				m.Clear();
+				ref.clear();
+			}
+			insert(key(), i);
+			const TestType& cm = m;
+			Key probe = key();
+			REQUIRE(cm.contains(probe) == (ref.count(probe) != 0));
+			REQUIRE(cm.count(probe) == ref.count(probe));
+			auto it = cm.find(probe);
+			if (it != cm.end()) {
+				// the first of the equal keys
+				REQUIRE(it->second == ref.lower_bound(probe)->second);
+			}
+		}
+		same();
+	}
+
+	SECTION("erase, erase_if, operator[] and try_emplace")
+	{
+		for (int i = 0; i < 2000; ++i) {
+			Key k = key();
+			switch (i % 5) {
+			case 0:
+			case 1:
+				if (m.size() < 550)
+					insert(k, i);
+				break;
+			case 2:
+				REQUIRE(m.erase(k) == ref.erase(k));
+				break;
+			case 3: {
+				auto it = m.find(k);
+				REQUIRE((it == m.end()) == (ref.count(k) == 0));
+				if (it != m.end()) {
+					m.erase(it);
+					ref.erase(ref.lower_bound(k));
+				}
+				break;
+			}
+			case 4:
+				if (m.size() < 550) {
+					int& v = m[k];
+					if (ref.count(k) == 0) {
+						REQUIRE(v == 0);
+						ref.emplace(k, 0);
+					}
+					v = -i;
+					ref.lower_bound(k)->second = -i;
+					REQUIRE(m.try_emplace(k, 5).second == false);
+				}
+				break;
+			}
+			if (i % 400 == 399) {
+				erase_if(m, [](const auto& kv) { return kv.second % 3 == 0; });
+				for (auto it = ref.begin(); it != ref.end();)
+					it = it->second % 3 == 0 ? ref.erase(it) : std::next(it);
+			}
+		}
+		same();
+	}
+
+	SECTION("const reads leave the pending inserts alone")
+	{
+		for (int i = 0; i < 40; ++i)
+			insert(key(), i);
+		m.flush();
+		insert(Key(400), 1);
+		insert(Key(401), 2);
+		auto tail = m.end() - 1;
+		const TestType& cm = m;
+
+		std::vector<Key> keys;
+		for (const auto& kv : ref)
+			keys.push_back(kv.first);
+		keys.push_back(Key(999));
+		std::vector<typename TestType::const_iterator> found;
+		cm.find_batch(keys.begin(), keys.end(), std::back_inserter(found));
+		for (std::size_t i = 0; i != keys.size(); ++i)
+			REQUIRE(found[i] == cm.find(keys[i]));
+		REQUIRE(found.back() == cm.end());
+		REQUIRE(tail->first == Key(401));
+		REQUIRE(m.end() - 1 == tail);
+
+		// copies and merges of a map with pending inserts come out sorted
+		TestType copy{cm};
+		REQUIRE(std::is_sorted(copy.cbegin(), copy.cend(), copy.value_comp()));
+		TestType merged;
+		merged.merge(cm);
+		REQUIRE(map_union(cm, merged).size() == ref.size());
+		REQUIRE(map_difference(cm, merged).empty());
+		REQUIRE(m.end() - 1 == tail);
+		same();
+		REQUIRE(std::equal(merged.begin(), merged.end(), m.begin(), m.end()));
+		REQUIRE(std::equal(copy.begin(), copy.end(), m.begin(), m.end()));
+		REQUIRE(cm.lower_bound(Key(400))->second == 1);
+	}
+
+	SECTION("full maps and bulk inserts")
+	{
+		std::vector<std::pair<Key, int>> bulk;
+		for (int i = 0; i < 100; ++i)
+			bulk.emplace_back(key(), -i);
+		for (int i = 0; i < 7; ++i)
+			insert(key(), i);
+		m.Insert(bulk.begin(), bulk.end());
+		ref.insert(bulk.begin(), bulk.end());
+		same();
+
+		for (int i = 0; m.size() != m.capacity(); ++i)
+			insert(static_cast<Key>(1000 + i), i);
+		auto overflow = m.try_insert({Key(5000), 0});
+		REQUIRE(overflow.second == flatmap::InsertStatus::Overflow);
+		REQUIRE(overflow.first == m.end());
+		REQUIRE_THROWS_AS(m.Insert({Key(5000), 0}), std::range_error);
+		REQUIRE(m.lower_bound(Key(1000))->first == Key(1000));
+		same();
+	}
+}
@@ -0,0 +1,152 @@
+#include <catch2/catch.hpp>
+#include <FlatMap/TieredFlatMap.hpp>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+template <class Map, class Ref>
+bool same_contents(const Map& map, const Ref& ref)
+{
+    if (map.size() != ref.size())
+        return false;
+    return std::equal(map.begin(), map.end(), ref.begin(), ref.end(),
+        [](const auto& a, const auto& b) { return a.first == b.first && a.second == b.second; });
+}
+
+} // namespace
+
+TEST_CASE("Tiered empty", "[TieredFlatMap]")
+{
+    TieredFlatMap<int, int> m;
+    REQUIRE(m.empty());
+    REQUIRE(m.begin() == m.end());
+    REQUIRE(m.find(1) == m.end());
+    REQUIRE(m.lower_bound(1) == m.end());
+    REQUIRE(m.erase(1) == 0u);
+}
+
+TEST_CASE("Tiered insert splits blocks", "[TieredFlatMap]")
+{
+    TieredFlatMap<int, int, std::less<int>, 4> m;
+    for (int i = 0; i < 20; ++i)
+        REQUIRE(m.insert({i * 2, i}).second);
+    REQUIRE_FALSE(m.insert({4, 100}).second);
+    REQUIRE(m.size() == 20u);
+    REQUIRE(m.block_count() >= 5u);
+    REQUIRE(m.find(4)->second == 2);
+
+    // before the first key, in the middle of a full block, on a boundary
+    REQUIRE(m.insert({-1, -1}).second);
+    REQUIRE(m.insert({5, 5}).second);
+    REQUIRE(m.insert({7, 7}).second);
+    REQUIRE(m.begin()->first == -1);
+    REQUIRE(std::is_sorted(m.begin(), m.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; }));
+
+    REQUIRE(m.lower_bound(6)->first == 6);
+    REQUIRE(m.upper_bound(6)->first == 7);
+    REQUIRE(m.upper_bound(38) == m.end());
+    auto range = m.equal_range(5);
+    REQUIRE(std::distance(range.first, range.second) == 1);
+
+    auto last = m.end();
+    --last;
+    REQUIRE(last->first == 38);
+}
+
+TEST_CASE("Tiered against std::map", "[TieredFlatMap]")
+{
+    std::mt19937 gen(3);
+    std::uniform_int_distribution<int> dist(0, 3000);
+    TieredFlatMap<int, int, std::less<int>, 16> m;
+    std::map<int, int> ref;
+
+    for (int round = 0; round < 6; ++round) {
+        for (int i = 0; i < 2000; ++i) {
+            int key = dist(gen);
+            REQUIRE(m.insert({key, i}).second == ref.insert({key, i}).second);
+        }
+        REQUIRE(same_contents(m, ref));
+        for (int i = 0; i < 1500; ++i) {
+            int key = dist(gen);
+            REQUIRE(m.erase(key) == ref.erase(key));
+        }
+        REQUIRE(same_contents(m, ref));
+        for (int i = 0; i < 200; ++i) {
+            int key = dist(gen);
+            auto it = m.lower_bound(key);
+            auto rit = ref.lower_bound(key);
+            REQUIRE((it == m.end()) == (rit == ref.end()));
+            if (rit != ref.end())
+                REQUIRE(it->first == rit->first);
+        }
+    }
+    // blocks do not stay nearly empty
+    REQUIRE(m.block_count() <= 4 * m.size() / 16 + 1);
+
+    SECTION("erase by iterator walks forward")
+    {
+        auto it = m.begin();
+        while (it != m.end()) {
+            if (it->first % 3 == 0)
+                it = m.erase(it);
+            else
+                ++it;
+        }
+        for (auto rit = ref.begin(); rit != ref.end(); ) {
+            if (rit->first % 3 == 0)
+                rit = ref.erase(rit);
+            else
+                ++rit;
+        }
+        REQUIRE(same_contents(m, ref));
+
+        while (!m.empty())
+            m.erase(m.begin());
+        REQUIRE(m.block_count() == 0u);
+    }
+}
+
+TEST_CASE("Tiered bulk insert, copy and move", "[TieredFlatMap]")
+{
+    std::vector<std::pair<int, int>> data;
+    for (int i = 0; i < 1000; ++i)
+        data.emplace_back((i * 37) % 1000, i);
+    data.emplace_back(5, -1);
+
+    TieredFlatMap<int, int, std::less<int>, 64> m{data.begin(), data.end()};
+    REQUIRE(m.size() == 1000u);
+    REQUIRE(m.block_count() == 16u);
+    REQUIRE(m.find(5)->second != -1);
+
+    // few new elements go in one by one, many get merged and rebuilt
+    std::vector<std::pair<int, int>> more{{1000, 0}, {5, -2}};
+    m.insert(more.begin(), more.end());
+    REQUIRE(m.size() == 1001u);
+    REQUIRE(m.find(5)->second != -2);
+    std::vector<std::pair<int, int>> lots;
+    for (int i = 500; i < 2000; ++i)
+        lots.emplace_back(i, -i);
+    m.insert(lots.begin(), lots.end());
+    REQUIRE(m.size() == 2000u);
+    REQUIRE(m.find(700)->second != -700);
+    REQUIRE(m.find(1500)->second == -1500);
+
+    TieredFlatMap<int, int, std::less<int>, 64> copy{m};
+    copy.find(1)->second = 42;
+    REQUIRE(m.find(1)->second != 42);
+    REQUIRE(copy.size() == m.size());
+
+    TieredFlatMap<int, int, std::less<int>, 64> moved{std::move(copy)};
+    REQUIRE(copy.empty());
+    REQUIRE(moved.find(1)->second == 42);
+
+    const auto& cm = moved;
+    TieredFlatMap<int, int, std::less<int>, 64>::const_iterator cit = moved.begin();
+    REQUIRE(cit == cm.begin());
+    moved.clear();
+    REQUIRE(moved.empty());
+}